@@ -0,0 +1,299 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GearAssembly.h"
+#include "ProceduralGear.h"
+#include "GearMeshCache.h"
+#include "GearBakedMesh.h"
+#include "GearTrainSubsystem.h"
+#include "Components/StaticMeshComponent.h"
+#include "Engine/StaticMesh.h"
+#include "StaticMeshAttributes.h"
+#include "StaticMeshResources.h"
+#include "Materials/MaterialInstance.h"
+#include "MeshDescription.h"
+
+AGearAssembly::AGearAssembly()
+{
+	//UGearTrainSubsystem updates the shafts after the gears turned, so they are not a frame behind kinematic gears
+	PrimaryActorTick.bCanEverTick = false;
+
+	scene = CreateDefaultSubobject<USceneComponent>("DefaultSceneRoot");
+	SetRootComponent(scene);
+}
+
+void AGearAssembly::addGear(AProceduralGear* gear)
+{
+	if (!gear || gears.Contains(gear)) {
+		return;
+	}
+
+	gears.Add(gear);
+	regroup = true;
+}
+
+void AGearAssembly::removeGear(AProceduralGear* gear)
+{
+	if (gears.Remove(gear) > 0) {
+		regroup = true;
+	}
+}
+
+void AGearAssembly::updateGear(AProceduralGear* gear)
+{
+	if (auto shaft = gear_shafts.Find(gear)) {
+		shafts[*shaft].dirty = true;
+	}
+}
+
+void AGearAssembly::markDirty()
+{
+	regroup = true;
+}
+
+void AGearAssembly::flushShafts()
+{
+	if (regroup) {
+		groupShafts();
+	}
+
+	for (auto& shaft : shafts) {
+		if (shaft.dirty) {
+			mergeShaft(shaft);
+		}
+	}
+}
+
+void AGearAssembly::updateShaftTransforms()
+{
+	//The merged mesh is in the frame of the first gear of the shaft, the others turn with it
+	for (auto& shaft : shafts) {
+		auto transform = shaft.gears[0]->getMeshTransform();
+		if (!transform.Equals(shaft.component->GetComponentTransform())) {
+			shaft.component->SetWorldTransform(transform);
+		}
+	}
+}
+
+int32 AGearAssembly::getGearCount() const
+{
+	return gears.Num();
+}
+
+int32 AGearAssembly::getShaftCount() const
+{
+	return shafts.Num();
+}
+
+int32 AGearAssembly::getSectionCount() const
+{
+	int32 sections = 0;
+	for (const auto& shaft : shafts) {
+		sections += shaft.materials.Num();
+	}
+	return sections;
+}
+
+bool AGearAssembly::getGearTransform(const AProceduralGear* gear, FTransform& transform) const
+{
+	auto shaft_index = gear_shafts.Find(gear);
+	if (!shaft_index) {
+		return false;
+	}
+
+	const auto& shaft = shafts[*shaft_index];
+	auto index = shaft.gears.IndexOfByKey(gear);
+	transform = shaft.relative_transforms[index] * shaft.component->GetComponentTransform();
+	return true;
+}
+
+void AGearAssembly::BeginPlay()
+{
+	Super::BeginPlay();
+
+	GetWorld()->GetSubsystem<UGearTrainSubsystem>()->addAssembly(this);
+}
+
+void AGearAssembly::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (auto gear_train = GetWorld()->GetSubsystem<UGearTrainSubsystem>()) {
+		gear_train->removeAssembly(this);
+	}
+
+	clearShafts();
+	gears.Empty();
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void AGearAssembly::clearShafts()
+{
+	for (auto component : shaft_components) {
+		component->DestroyComponent();
+	}
+	shaft_components.Empty();
+	merged_meshes.Empty();
+	shafts.Empty();
+	gear_shafts.Empty();
+}
+
+void AGearAssembly::groupShafts()
+{
+	regroup = false;
+
+	//Union find over the shaft gears, only gears of this assembly are joined
+	TMap<const AProceduralGear*, int32> indices;
+	for (int32 index = 0; index < gears.Num(); index++) {
+		indices.Add(gears[index], index);
+	}
+
+	TArray<int32> parents;
+	parents.SetNum(gears.Num());
+	for (int32 index = 0; index < gears.Num(); index++) {
+		parents[index] = index;
+	}
+
+	auto findRoot = [&parents](int32 index) {
+		while (parents[index] != index) {
+			parents[index] = parents[parents[index]];
+			index = parents[index];
+		}
+		return index;
+	};
+
+	for (int32 index = 0; index < gears.Num(); index++) {
+		for (const auto& partner : gears[index]->getShaftGears()) {
+			auto partner_index = indices.Find(partner.Get());
+			if (partner_index) {
+				parents[findRoot(*partner_index)] = findRoot(index);
+			}
+		}
+	}
+
+	TMap<int32, int32> root_groups;
+	TArray<TArray<AProceduralGear*>> groups;
+	for (int32 index = 0; index < gears.Num(); index++) {
+		auto root = findRoot(index);
+		auto group = root_groups.Find(root);
+		if (!group) {
+			group = &root_groups.Add(root, groups.AddDefaulted());
+		}
+		groups[*group].Add(gears[index]);
+	}
+
+	//Every group takes over the shaft of one of its gears, so only groups whose gears changed are merged again and
+	//untouched shafts keep their component and merged mesh
+	auto previous_shafts = MoveTemp(shafts);
+	auto previous_gear_shafts = MoveTemp(gear_shafts);
+	shafts.Reset();
+	gear_shafts.Reset();
+	TArray<bool> taken;
+	taken.SetNumZeroed(previous_shafts.Num());
+	for (auto& group : groups) {
+		auto& shaft = shafts.AddDefaulted_GetRef();
+		for (auto gear : group) {
+			auto previous_index = previous_gear_shafts.Find(gear);
+			if (previous_index && !taken[*previous_index]) {
+				taken[*previous_index] = true;
+				shaft = MoveTemp(previous_shafts[*previous_index]);
+				shaft.dirty |= shaft.gears != group;
+				break;
+			}
+		}
+		if (!shaft.component) {
+			shaft.component = createShaftComponent();
+			shaft.dirty = true;
+		}
+
+		shaft.gears = MoveTemp(group);
+		for (auto gear : shaft.gears) {
+			gear_shafts.Add(gear, shafts.Num() - 1);
+		}
+	}
+
+	//Shafts whose gears all left or joined other shafts
+	for (int32 index = 0; index < previous_shafts.Num(); index++) {
+		if (!taken[index]) {
+			destroyShaftComponent(previous_shafts[index].component);
+		}
+	}
+}
+
+UStaticMeshComponent* AGearAssembly::createShaftComponent()
+{
+	auto component = NewObject<UStaticMeshComponent>(this);
+	component->SetupAttachment(scene);
+	component->SetMobility(EComponentMobility::Movable);
+	component->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+	component->RegisterComponent();
+	shaft_components.Add(component);
+	return component;
+}
+
+void AGearAssembly::destroyShaftComponent(UStaticMeshComponent* component)
+{
+	if (auto static_mesh = component->GetStaticMesh()) {
+		merged_meshes.Remove(static_mesh);
+	}
+	shaft_components.Remove(component);
+	component->DestroyComponent();
+}
+
+void AGearAssembly::mergeShaft(FShaft& shaft)
+{
+	shaft.dirty = false;
+
+	auto root_transform = shaft.gears[0]->getMeshTransform();
+	shaft.relative_transforms.Reset();
+	shaft.materials.Reset();
+	TArray<int32> gear_materials;
+	for (auto gear : shaft.gears) {
+		shaft.relative_transforms.Add(gear->getMeshTransform().GetRelativeTransform(root_transform));
+		gear_materials.Add(shaft.materials.AddUnique(const_cast<UMaterialInstance*>(gear->getMaterial())));
+	}
+
+	//Every LOD merges the same LOD of each gear, so the shaft switches LODs at the same screen sizes as UGearMeshComponent
+	TArray<FMeshDescription> mesh_descriptions;
+	mesh_descriptions.SetNum(GearGeometry::LOD_COUNT);
+	TArray<const FMeshDescription*> mesh_description_pointers;
+	for (int32 lod = 0; lod < GearGeometry::LOD_COUNT; lod++) {
+		auto& mesh_description = mesh_descriptions[lod];
+		FStaticMeshAttributes attributes(mesh_description);
+		attributes.Register();
+
+		TArray<FPolygonGroupID> polygon_groups;
+		for (int32 material = 0; material < shaft.materials.Num(); material++) {
+			auto polygon_group = mesh_description.CreatePolygonGroup();
+			attributes.GetPolygonGroupMaterialSlotNames()[polygon_group] = FName("Gear", material);
+			polygon_groups.Add(polygon_group);
+		}
+
+		for (int32 index = 0; index < shaft.gears.Num(); index++) {
+			auto geometry = FGearMeshCache::Get().getGeometry(GearGeometry::getLODParams(shaft.gears[index]->getParams(), lod));
+			GearBakedMesh::appendMeshDescription(*geometry, shaft.relative_transforms[index], polygon_groups[gear_materials[index]], mesh_description);
+		}
+		mesh_description_pointers.Add(&mesh_description);
+	}
+
+	auto static_mesh = NewObject<UStaticMesh>(this, NAME_None, RF_Transient);
+	for (int32 material = 0; material < shaft.materials.Num(); material++) {
+		static_mesh->GetStaticMaterials().Add(FStaticMaterial(shaft.materials[material], FName("Gear", material)));
+	}
+
+	UStaticMesh::FBuildMeshDescriptionsParams build_params;
+	build_params.bBuildSimpleCollision = false;
+	build_params.bFastBuild = true;
+	static_mesh->BuildFromMeshDescriptions(mesh_description_pointers, build_params);
+	for (int32 lod = 0; lod < GearGeometry::LOD_COUNT; lod++) {
+		static_mesh->GetRenderData()->ScreenSize[lod].Default = GearGeometry::LOD_SCREEN_SIZES[lod];
+	}
+
+	//Let the mesh this shaft drew before go
+	if (auto previous_mesh = shaft.component->GetStaticMesh()) {
+		merged_meshes.Remove(previous_mesh);
+	}
+	merged_meshes.Add(static_mesh);
+
+	shaft.component->SetStaticMesh(static_mesh);
+	shaft.component->SetWorldTransform(root_transform);
+}
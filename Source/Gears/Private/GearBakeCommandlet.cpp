@@ -0,0 +1,224 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GearBakeCommandlet.h"
+#include "Gears.h"
+#include "GearBakedMesh.h"
+#include "GearGeometry.h"
+#include "GearMeshCache.h"
+#include "ProceduralGear.h"
+#include "Engine/Level.h"
+#include "Engine/StaticMesh.h"
+#include "Engine/World.h"
+#include "MeshDescription.h"
+#include "Misc/PackageName.h"
+#include "Misc/Parse.h"
+#include "PhysicsEngine/BodySetup.h"
+#include "UObject/Package.h"
+#include "UObject/SavePackage.h"
+#include "UObject/UObjectHash.h"
+#if WITH_EDITOR
+#include "AssetRegistry/AssetRegistryModule.h"
+#endif // WITH_EDITOR
+
+UGearBakeCommandlet::UGearBakeCommandlet()
+{
+	IsClient = false;
+	IsEditor = false;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+static bool savePackage(UPackage* package)
+{
+	auto extension = package->ContainsMap() ? FPackageName::GetMapPackageExtension() : FPackageName::GetAssetPackageExtension();
+	auto file_name = FPackageName::LongPackageNameToFilename(package->GetName(), extension);
+
+	FSavePackageArgs save_args;
+	save_args.TopLevelFlags = RF_Public | RF_Standalone;
+	if (!UPackage::SavePackage(package, package->FindAssetInPackage(), *file_name, save_args)) {
+		UE_LOG(LogGears, Error, TEXT("Could not save %s"), *file_name);
+		return false;
+	}
+	return true;
+}
+
+int32 UGearBakeCommandlet::Main(const FString& Params)
+{
+#if WITH_EDITOR
+	auto& asset_registry = FModuleManager::LoadModuleChecked<FAssetRegistryModule>("AssetRegistry").Get();
+	asset_registry.SearchAllAssets(true);
+
+	TArray<FString> maps;
+	FString maps_param;
+	if (FParse::Value(*Params, TEXT("Maps="), maps_param, false)) {
+		maps_param.ParseIntoArray(maps, TEXT(","));
+	}
+	else {
+		TArray<FAssetData> map_assets;
+		asset_registry.GetAssetsByClass(UWorld::StaticClass()->GetClassPathName(), map_assets);
+		for (const auto& map_asset : map_assets) {
+			auto package_name = map_asset.PackageName.ToString();
+			if (package_name.StartsWith(TEXT("/Game/"))) {
+				maps.AddUnique(package_name);
+			}
+		}
+	}
+
+	TMap<FGearParams, UStaticMesh*> meshes;
+	auto meshes_created = 0;
+	auto gears_bound = 0;
+	auto gears_total = 0;
+	auto errors = 0;
+
+	for (const auto& map : maps) {
+		//Gears either live in the map itself or in external actor packages
+		TArray<FString> package_names = { map };
+		TArray<FAssetData> external_actors;
+		asset_registry.GetAssetsByPath(FName(ULevel::GetExternalActorsPath(map)), external_actors, true);
+		for (const auto& external_actor : external_actors) {
+			package_names.AddUnique(external_actor.PackageName.ToString());
+		}
+
+		for (const auto& package_name : package_names) {
+			auto package = LoadPackage(nullptr, *package_name, LOAD_None);
+			if (!package) {
+				UE_LOG(LogGears, Error, TEXT("Could not load %s"), *package_name);
+				errors++;
+				continue;
+			}
+
+			TArray<AProceduralGear*> gears;
+			ForEachObjectWithPackage(package, [&gears](UObject* object) {
+				auto gear = Cast<AProceduralGear>(object);
+				if (gear && !gear->IsTemplate()) {
+					gears.Add(gear);
+				}
+				return true;
+			});
+
+			auto package_changed = false;
+			for (auto gear : gears) {
+				gears_total++;
+
+				auto params = gear->getParams();
+				auto& static_mesh = meshes.FindOrAdd(params);
+				if (!static_mesh) {
+					auto created = false;
+					static_mesh = bakeMesh(params, created);
+					meshes_created += created ? 1 : 0;
+				}
+				if (!static_mesh) {
+					errors++;
+					continue;
+				}
+
+				if (gear->getBakedMesh() != static_mesh) {
+					gear->Modify();
+					gear->setBakedMesh(static_mesh);
+					gears_bound++;
+					package_changed = true;
+				}
+			}
+
+			if (package_changed && !savePackage(package)) {
+				errors++;
+			}
+		}
+	}
+
+	UE_LOG(LogGears, Display, TEXT("Baked %d maps: %d gears, %d distinct meshes (%d rebuilt), %d gears rebound, %d errors"),
+		maps.Num(), gears_total, meshes.Num(), meshes_created, gears_bound, errors);
+	return errors > 0 ? 1 : 0;
+#else
+	UE_LOG(LogGears, Error, TEXT("Gears can only be baked by editor builds"));
+	return 1;
+#endif // WITH_EDITOR
+}
+
+UStaticMesh* UGearBakeCommandlet::bakeMesh(const FGearParams& params, bool& created)
+{
+#if WITH_EDITOR
+	created = false;
+	const auto package_name = GearBakedMesh::getPackageName(params);
+	const auto asset_name = FPackageName::GetShortName(package_name);
+
+	//Reuse the mesh of an earlier run if nothing changed since
+	if (FPackageName::DoesPackageExist(package_name)) {
+		LoadPackage(nullptr, *package_name, LOAD_None);
+	}
+	auto package = CreatePackage(*package_name);
+	auto static_mesh = FindObject<UStaticMesh>(package, *asset_name);
+	if (static_mesh && GearBakedMesh::findBakeData(static_mesh, params)) {
+		baked_meshes.Add(static_mesh);
+		return static_mesh;
+	}
+
+	auto is_new = static_mesh == nullptr;
+	if (is_new) {
+		static_mesh = NewObject<UStaticMesh>(package, *asset_name, RF_Public | RF_Standalone);
+	}
+
+	auto geometry = FGearMeshCache::Get().getGeometry(params);
+
+	static_mesh->GetStaticMaterials().Reset();
+	static_mesh->GetStaticMaterials().Add(FStaticMaterial(nullptr, FName("Gear")));
+
+	//Every LOD of the gear is a source model, switched at the same screen sizes as UGearMeshComponent
+	static_mesh->SetNumSourceModels(GearGeometry::LOD_COUNT);
+	static_mesh->bAutoComputeLODScreenSize = false;
+	for (int32 lod = 0; lod < GearGeometry::LOD_COUNT; lod++) {
+		auto lod_geometry = lod == 0 ? geometry : FGearMeshCache::Get().getGeometry(GearGeometry::getLODParams(params, lod));
+		FMeshDescription mesh_description;
+		GearBakedMesh::buildMeshDescription(*lod_geometry, mesh_description);
+
+		auto& source_model = static_mesh->GetSourceModel(lod);
+		source_model.BuildSettings.bRecomputeNormals = false;
+		source_model.BuildSettings.bRecomputeTangents = true;
+		source_model.BuildSettings.bGenerateLightmapUVs = false;
+		source_model.ScreenSize.Default = GearGeometry::LOD_SCREEN_SIZES[lod];
+		static_mesh->CreateMeshDescription(lod, MoveTemp(mesh_description));
+		static_mesh->CommitMeshDescription(lod);
+	}
+	static_mesh->Build(true);
+
+	//The gear hulls, not collision derived from the render mesh. The teeth are the first tooth hull rotated, the same
+	//as the collision the cache cooks, so gears loading the mesh can share one tooth convex again
+	static_mesh->bCustomizedCollision = true;
+	static_mesh->CreateBodySetup();
+	auto body_setup = static_mesh->GetBodySetup();
+	body_setup->RemoveSimpleCollision();
+	body_setup->InvalidatePhysicsData();
+	body_setup->bGenerateMirroredCollision = false;
+	body_setup->bDoubleSidedGeometry = true;
+	body_setup->CollisionTraceFlag = CTF_UseDefault;
+	auto cooked = FGearMeshCache::prepareCollision(params, *geometry);
+	cooked->CreatePhysicsMeshes();
+	FGearMeshCache::finishCollision(params, cooked, body_setup);
+
+	auto bake_data = static_mesh->GetAssetUserData<UGearBakeData>();
+	if (!bake_data) {
+		bake_data = NewObject<UGearBakeData>(static_mesh);
+		static_mesh->AddAssetUserData(bake_data);
+	}
+	bake_data->key = GearGeometry::makeKey(params);
+	bake_data->version = GearGeometry::VERSION;
+	bake_data->bake_version = GearBakedMesh::BAKE_VERSION;
+	bake_data->profile_area = geometry->profile_area;
+	bake_data->profile_polar_moment = geometry->profile_polar_moment;
+
+	if (is_new) {
+		FAssetRegistryModule::AssetCreated(static_mesh);
+	}
+	static_mesh->MarkPackageDirty();
+	if (!savePackage(package)) {
+		return nullptr;
+	}
+
+	created = true;
+	baked_meshes.Add(static_mesh);
+	return static_mesh;
+#else
+	return nullptr;
+#endif // WITH_EDITOR
+}
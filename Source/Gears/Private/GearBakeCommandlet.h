@@ -0,0 +1,37 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "GearBakeCommandlet.generated.h"
+
+class UStaticMesh;
+struct FGearParams;
+
+/**
+ * Bakes every distinct gear configuration of the given maps into a static mesh with its collision
+ * under /Game/_GENERATED/Gears and binds the gears to it, so packaged builds do not build gears at load.
+ * UnrealEditor-Cmd Gears.uproject -run=GearBake -nullrhi [-Maps=/Game/Maps/A,/Game/Maps/B]
+ *
+ * Without -Maps every map under /Game is baked. Gears of World Partition maps are found in their external actor packages.
+ * Meshes baked by an earlier run are reused while the params, the kernel version and the bake version match.
+ * Every LOD of the gear is baked into its own source model.
+ */
+UCLASS()
+class UGearBakeCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UGearBakeCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+
+private:
+	//Baked or reused meshes of this run
+	UPROPERTY()
+	TArray<UStaticMesh*> baked_meshes;
+
+	UStaticMesh* bakeMesh(const FGearParams& params, bool& created);
+};
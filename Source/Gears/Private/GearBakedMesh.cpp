@@ -0,0 +1,65 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GearBakedMesh.h"
+#include "Engine/StaticMesh.h"
+#include "MeshDescription.h"
+#include "StaticMeshAttributes.h"
+
+FString GearBakedMesh::getPackageName(const FGearParams& params)
+{
+	return FString::Printf(TEXT("/Game/_GENERATED/Gears/Gear_%08X"), FCrc::StrCrc32(*GearGeometry::makeKey(params)));
+}
+
+void GearBakedMesh::buildMeshDescription(const FGearMeshData& geometry, FMeshDescription& mesh_description)
+{
+	FStaticMeshAttributes attributes(mesh_description);
+	attributes.Register();
+
+	auto polygon_group = mesh_description.CreatePolygonGroup();
+	attributes.GetPolygonGroupMaterialSlotNames()[polygon_group] = FName("Gear");
+
+	appendMeshDescription(geometry, FTransform::Identity, polygon_group, mesh_description);
+}
+
+void GearBakedMesh::appendMeshDescription(const FGearMeshData& geometry, const FTransform& transform, FPolygonGroupID polygon_group, FMeshDescription& mesh_description)
+{
+	FStaticMeshAttributes attributes(mesh_description);
+	auto positions = attributes.GetVertexPositions();
+	auto normals = attributes.GetVertexInstanceNormals();
+
+	mesh_description.ReserveNewVertices(geometry.verts.Num());
+	mesh_description.ReserveNewVertexInstances(geometry.verts.Num());
+	mesh_description.ReserveNewTriangles(geometry.indices.Num() / 3);
+
+	TArray<FVertexInstanceID> vertex_instances;
+	vertex_instances.Reserve(geometry.verts.Num());
+	for (int32 index = 0; index < geometry.verts.Num(); index++) {
+		auto vertex = mesh_description.CreateVertex();
+		positions[vertex] = FVector3f(transform.TransformPosition(geometry.verts[index]));
+
+		auto vertex_instance = mesh_description.CreateVertexInstance(vertex);
+		normals[vertex_instance] = FVector3f(transform.TransformVectorNoScale(geometry.normals[index]));
+		vertex_instances.Add(vertex_instance);
+	}
+
+	for (int32 index = 0; index + 2 < geometry.indices.Num(); index += 3) {
+		mesh_description.CreateTriangle(polygon_group, {
+			vertex_instances[geometry.indices[index]],
+			vertex_instances[geometry.indices[index + 1]],
+			vertex_instances[geometry.indices[index + 2]] });
+	}
+}
+
+const UGearBakeData* GearBakedMesh::findBakeData(const UStaticMesh* static_mesh, const FGearParams& params)
+{
+	if (!static_mesh) {
+		return nullptr;
+	}
+
+	auto bake_data = const_cast<UStaticMesh*>(static_mesh)->GetAssetUserData<UGearBakeData>();
+	if (!bake_data || bake_data->version != GearGeometry::VERSION || bake_data->bake_version != GearBakedMesh::BAKE_VERSION || bake_data->key != GearGeometry::makeKey(params)) {
+		return nullptr;
+	}
+	return bake_data;
+}
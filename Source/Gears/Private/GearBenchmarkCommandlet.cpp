@@ -0,0 +1,1934 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GearBenchmarkCommandlet.h"
+#include "Gears.h"
+#include "GearAssembly.h"
+#include "GearGeometry.h"
+#include "GearInstancer.h"
+#include "GearLayoutSubsystem.h"
+#include "GearMeshCache.h"
+#include "GearMeshComponent.h"
+#include "GearTrain.h"
+#include "GearTrainSubsystem.h"
+#include "ProceduralGear.h"
+#include "ProceduralMeshComponent.h"
+#include "Components/StaticMeshComponent.h"
+#include "Engine/Engine.h"
+#include "Engine/StaticMesh.h"
+#include "Engine/StaticMeshActor.h"
+#include "Engine/World.h"
+#include "HAL/PlatformTime.h"
+#include "HAL/PlatformMemory.h"
+#include "HAL/PlatformTLS.h"
+#include "HAL/MemoryBase.h"
+#include "Materials/Material.h"
+#include "Materials/MaterialInstanceDynamic.h"
+#include "Algo/Count.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "Chaos/ChaosArchive.h"
+#include "Chaos/Convex.h"
+#include "EngineUtils.h"
+#include "SceneManagement.h"
+#include "Misc/FileHelper.h"
+#include "Misc/PackageName.h"
+#include "Misc/Parse.h"
+#include "PhysicsEngine/BodySetup.h"
+#include "Serialization/MemoryWriter.h"
+#include "UObject/Package.h"
+#include "UObject/SavePackage.h"
+#if WITH_EDITOR
+#include "DerivedDataCacheInterface.h"
+#endif // WITH_EDITOR
+
+UGearBenchmarkCommandlet::UGearBenchmarkCommandlet()
+{
+	IsClient = false;
+	IsEditor = false;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+static UWorld* createBenchmarkWorld()
+{
+	auto world = UWorld::CreateWorld(EWorldType::Game, false, TEXT("GearBenchmarkWorld"));
+	auto& world_context = GEngine->CreateNewWorldContext(EWorldType::Game);
+	world_context.SetCurrentWorld(world);
+
+	world->bShouldSimulatePhysics = true;
+	world->InitializeActorsForPlay(FURL());
+	world->BeginPlay();
+	return world;
+}
+
+static void destroyBenchmarkWorld(UWorld* world)
+{
+	GEngine->DestroyWorldContext(world);
+	world->DestroyWorld(false);
+}
+
+//Forwards to the real allocator and counts the allocations made by the thread that installed it
+class FGearAllocationCounter : public FMalloc
+{
+public:
+	explicit FGearAllocationCounter(FMalloc* inner_malloc)
+		: inner(inner_malloc)
+		, thread_id(FPlatformTLS::GetCurrentThreadId())
+	{
+	}
+
+	virtual void* Malloc(SIZE_T Count, uint32 Alignment) override
+	{
+		countAllocation();
+		return inner->Malloc(Count, Alignment);
+	}
+
+	virtual void* TryMalloc(SIZE_T Count, uint32 Alignment) override
+	{
+		countAllocation();
+		return inner->TryMalloc(Count, Alignment);
+	}
+
+	virtual void* Realloc(void* Original, SIZE_T Count, uint32 Alignment) override
+	{
+		countAllocation();
+		return inner->Realloc(Original, Count, Alignment);
+	}
+
+	virtual void* TryRealloc(void* Original, SIZE_T Count, uint32 Alignment) override
+	{
+		countAllocation();
+		return inner->TryRealloc(Original, Count, Alignment);
+	}
+
+	virtual void Free(void* Original) override
+	{
+		inner->Free(Original);
+	}
+
+	virtual SIZE_T QuantizeSize(SIZE_T Count, uint32 Alignment) override
+	{
+		return inner->QuantizeSize(Count, Alignment);
+	}
+
+	virtual bool GetAllocationSize(void* Original, SIZE_T& SizeOut) override
+	{
+		return inner->GetAllocationSize(Original, SizeOut);
+	}
+
+	virtual void Trim(bool bTrimThreadCaches) override
+	{
+		inner->Trim(bTrimThreadCaches);
+	}
+
+	virtual bool IsInternallyThreadSafe() const override
+	{
+		return inner->IsInternallyThreadSafe();
+	}
+
+	virtual const TCHAR* GetDescriptiveName() override
+	{
+		return inner->GetDescriptiveName();
+	}
+
+	FMalloc* getInner() const
+	{
+		return inner;
+	}
+
+	int64 getAllocations() const
+	{
+		return allocations;
+	}
+
+private:
+	FMalloc* inner;
+	uint32 thread_id;
+	int64 allocations = 0;
+
+	void countAllocation()
+	{
+		if (FPlatformTLS::GetCurrentThreadId() == thread_id) {
+			allocations++;
+		}
+	}
+};
+
+//Number of allocations the calling thread makes while running the function
+template<typename FunctionType>
+static int64 countAllocations(FunctionType&& function)
+{
+	FGearAllocationCounter counter(GMalloc);
+	GMalloc = &counter;
+	function();
+	GMalloc = counter.getInner();
+	return counter.getAllocations();
+}
+
+static TArray<int32> parseCounts(const FString& Params, const TCHAR* match, const TCHAR* default_counts)
+{
+	FString counts_string = default_counts;
+	FParse::Value(*Params, match, counts_string, false);
+
+	TArray<FString> count_strings;
+	counts_string.ParseIntoArray(count_strings, TEXT(","));
+
+	TArray<int32> counts;
+	for (const auto& count_string : count_strings) {
+		counts.Add(FMath::Max(FCString::Atoi(*count_string), 1));
+	}
+	return counts;
+}
+
+int32 UGearBenchmarkCommandlet::Main(const FString& Params)
+{
+	FString mode = TEXT("Kernel");
+	FParse::Value(*Params, TEXT("Mode="), mode);
+
+	if (mode == TEXT("Kernel")) {
+		return runKernelBenchmark(Params);
+	}
+	else if (mode == TEXT("KernelPaths")) {
+		return runKernelPathBenchmark(Params);
+	}
+	else if (mode == TEXT("Instancing")) {
+		return runInstancingCheck(Params);
+	}
+	else if (mode == TEXT("Kinematics")) {
+		return runKinematicsBenchmark(Params);
+	}
+	else if (mode == TEXT("Collision")) {
+		return runCollisionBenchmark(Params);
+	}
+	else if (mode == TEXT("Allocations")) {
+		return runAllocationCheck(Params);
+	}
+	else if (mode == TEXT("BatchedUpdates")) {
+		return runBatchedUpdateCheck(Params);
+	}
+	else if (mode == TEXT("Load")) {
+		return runLoadBenchmark(Params);
+	}
+	else if (mode == TEXT("DerivedData")) {
+		return runDerivedDataBenchmark(Params);
+	}
+	else if (mode == TEXT("BulkGeneration")) {
+		return runBulkGenerationBenchmark(Params);
+	}
+	else if (mode == TEXT("MeshMemory")) {
+		return runMeshMemoryBenchmark(Params);
+	}
+	else if (mode == TEXT("IncrementalUpdates")) {
+		return runIncrementalUpdateBenchmark(Params);
+	}
+	else if (mode == TEXT("InteractiveEdits")) {
+		return runInteractiveEditBenchmark(Params);
+	}
+	else if (mode == TEXT("LODs")) {
+		return runLODBenchmark(Params);
+	}
+	else if (mode == TEXT("Tessellation")) {
+		return runTessellationBenchmark(Params);
+	}
+	else if (mode == TEXT("SharedCollision")) {
+		return runSharedCollisionBenchmark(Params);
+	}
+	else if (mode == TEXT("AsyncCooking")) {
+		return runAsyncCookingBenchmark(Params);
+	}
+	else if (mode == TEXT("Coupling")) {
+		return runCouplingBenchmark(Params);
+	}
+	else if (mode == TEXT("Layout")) {
+		return runLayoutBenchmark(Params);
+	}
+	else if (mode == TEXT("Assembly")) {
+		return runAssemblyBenchmark(Params);
+	}
+
+	UE_LOG(LogGears, Error, TEXT("Unknown benchmark mode %s"), *mode);
+	return 1;
+}
+
+int32 UGearBenchmarkCommandlet::runKernelBenchmark(const FString& Params)
+{
+	unsigned int min_teeth = 8;
+	unsigned int max_teeth = 100;
+	unsigned int teeth_step = 4;
+	unsigned int min_steps = 4;
+	unsigned int max_steps = 50;
+	unsigned int steps_step = 2;
+	int32 iterations = 20;
+	FString csv_path;
+
+	FParse::Value(*Params, TEXT("MinTeeth="), min_teeth);
+	FParse::Value(*Params, TEXT("MaxTeeth="), max_teeth);
+	FParse::Value(*Params, TEXT("TeethStep="), teeth_step);
+	FParse::Value(*Params, TEXT("MinSteps="), min_steps);
+	FParse::Value(*Params, TEXT("MaxSteps="), max_steps);
+	FParse::Value(*Params, TEXT("StepsStep="), steps_step);
+	FParse::Value(*Params, TEXT("Iterations="), iterations);
+	FParse::Value(*Params, TEXT("Csv="), csv_path);
+
+	teeth_step = FMath::Max(teeth_step, 1u);
+	steps_step = FMath::Max(steps_step, 1u);
+	iterations = FMath::Max(iterations, 1);
+
+	FString csv = TEXT("teeth,involute_steps,vertices,indices,gears_per_sec,vertices_per_sec,buffer_bytes\n");
+	FGearMeshData mesh_data;
+	double total_seconds = 0.0;
+	int64 total_gears = 0;
+
+	for (unsigned int teeth = min_teeth; teeth <= max_teeth; teeth += teeth_step) {
+		for (unsigned int steps = min_steps; steps <= max_steps; steps += steps_step) {
+			FGearParams params;
+			params.number_of_teeth = teeth;
+			params.involute_steps = steps;
+
+			//Warm up so the first iteration does not pay for growing the buffers
+			GearGeometry::generateGear(params, mesh_data);
+
+			auto start = FPlatformTime::Seconds();
+			for (int32 iteration = 0; iteration < iterations; iteration++) {
+				GearGeometry::generateGear(params, mesh_data);
+			}
+			auto elapsed = FMath::Max(FPlatformTime::Seconds() - start, SMALL_NUMBER);
+
+			auto gears_per_sec = iterations / elapsed;
+			auto verts_per_sec = gears_per_sec * mesh_data.verts.Num();
+			total_seconds += elapsed;
+			total_gears += iterations;
+
+			UE_LOG(LogGears, Display, TEXT("teeth=%3u steps=%2u verts=%6d gears/sec=%10.1f verts/sec=%12.0f buffers=%llu bytes"),
+				teeth, steps, mesh_data.verts.Num(), gears_per_sec, verts_per_sec, (uint64)mesh_data.GetAllocatedSize());
+			csv += FString::Printf(TEXT("%u,%u,%d,%d,%f,%f,%llu\n"),
+				teeth, steps, mesh_data.verts.Num(), mesh_data.indices.Num(), gears_per_sec, verts_per_sec, (uint64)mesh_data.GetAllocatedSize());
+		}
+	}
+
+	auto memory_stats = FPlatformMemory::GetStats();
+	UE_LOG(LogGears, Display, TEXT("Generated %lld gears in %.3f s (%.1f gears/sec)"), total_gears, total_seconds, total_gears / FMath::Max(total_seconds, SMALL_NUMBER));
+	UE_LOG(LogGears, Display, TEXT("Peak used physical memory: %.2f MB"), memory_stats.PeakUsedPhysical / (1024.0 * 1024.0));
+
+	if (!csv_path.IsEmpty()) {
+		FFileHelper::SaveStringToFile(csv, *csv_path);
+	}
+
+	return 0;
+}
+
+//Largest distance between matching vertices, normals and hull points of two builds of the same params
+static double maxDeviation(const FGearMeshData& a, const FGearMeshData& b)
+{
+	if (a.verts.Num() != b.verts.Num() || a.collision_verts.Num() != b.collision_verts.Num() || a.indices != b.indices) {
+		return MAX_dbl;
+	}
+
+	double deviation = 0.0;
+	for (int32 index = 0; index < a.verts.Num(); index++) {
+		deviation = FMath::Max(deviation, FVector::Dist(a.verts[index], b.verts[index]));
+		deviation = FMath::Max(deviation, FVector::Dist(a.normals[index], b.normals[index]));
+	}
+	for (int32 index = 0; index < a.collision_verts.Num(); index++) {
+		deviation = FMath::Max(deviation, FVector::Dist(a.collision_verts[index], b.collision_verts[index]));
+	}
+	return deviation;
+}
+
+int32 UGearBenchmarkCommandlet::runKernelPathBenchmark(const FString& Params)
+{
+	int32 iterations = 200;
+	FParse::Value(*Params, TEXT("Iterations="), iterations);
+	iterations = FMath::Max(iterations, 1);
+
+	const TCHAR* path_names[] = { TEXT("Scalar"), TEXT("VectorFloat"), TEXT("VectorDouble") };
+	const double tolerances[] = { 0.0, GearGeometry::VECTOR_FLOAT_TOLERANCE, GearGeometry::VECTOR_DOUBLE_TOLERANCE };
+	const unsigned int teeth_counts[] = { 24, 60, 100 };
+	const unsigned int step_counts[] = { 8, 24, 50 };
+
+	auto errors = 0;
+	FGearMeshData reference;
+	FGearMeshData mesh_data;
+	for (auto teeth : teeth_counts) {
+		for (auto steps : step_counts) {
+			FGearParams params;
+			params.number_of_teeth = teeth;
+			params.involute_steps = steps;
+			GearGeometry::generateGear(params, reference, EGearKernelPath::Scalar);
+
+			//Profile points placed per build, every one is a top and a bottom vertex
+			auto points = teeth * steps * GearGeometry::SECTIONS_PER_TOOTH;
+			double scalar_seconds = 0.0;
+			for (int32 path = 0; path < UE_ARRAY_COUNT(path_names); path++) {
+				GearGeometry::generateGear(params, mesh_data, EGearKernelPath(path));
+
+				auto start = FPlatformTime::Seconds();
+				for (int32 iteration = 0; iteration < iterations; iteration++) {
+					GearGeometry::generateGear(params, mesh_data, EGearKernelPath(path));
+				}
+				auto elapsed = FMath::Max(FPlatformTime::Seconds() - start, SMALL_NUMBER);
+				if (path == 0) {
+					scalar_seconds = elapsed;
+				}
+
+				auto deviation = maxDeviation(reference, mesh_data);
+				UE_LOG(LogGears, Display, TEXT("teeth=%3u steps=%2u %-12s points/sec=%12.0f %.2fx deviation=%g cm"),
+					teeth, steps, path_names[path], points * iterations / elapsed, scalar_seconds / elapsed, deviation);
+
+				if (deviation > tolerances[path]) {
+					UE_LOG(LogGears, Error, TEXT("%s is %g cm off the scalar kernel, more than %g"), path_names[path], deviation, tolerances[path]);
+					errors++;
+				}
+			}
+		}
+	}
+
+	UE_LOG(LogGears, Display, TEXT("Kernel paths: %d errors"), errors);
+	return errors > 0 ? 1 : 0;
+}
+
+int32 UGearBenchmarkCommandlet::runInstancingCheck(const FString& Params)
+{
+	int32 configs = 4;
+	int32 gears_per_config = 25;
+	FParse::Value(*Params, TEXT("Configs="), configs);
+	FParse::Value(*Params, TEXT("GearsPerConfig="), gears_per_config);
+
+	auto world = createBenchmarkWorld();
+	auto instancer = world->SpawnActor<AGearInstancer>();
+
+	TArray<AProceduralGear*> gears;
+	for (int32 config = 0; config < configs; config++) {
+		for (int32 index = 0; index < gears_per_config; index++) {
+			auto location = FVector(config * 100.0, index * 100.0, 0);
+			auto gear = world->SpawnActor<AProceduralGear>(location, FRotator::ZeroRotator);
+			gear->setNumberOfTeeth(8 + config * 4);
+			gear->setInstancer(instancer);
+			gears.Add(gear);
+		}
+	}
+
+	//Let physics move the gears so the batched transform update is exercised
+	for (int32 frame = 0; frame < 10; frame++) {
+		world->Tick(LEVELTICK_All, 1.0f / 60.0f);
+	}
+
+	auto errors = 0;
+	if (instancer->getBatchCount() != configs) {
+		UE_LOG(LogGears, Error, TEXT("Expected %d batches, found %d"), configs, instancer->getBatchCount());
+		errors++;
+	}
+	if (instancer->getInstanceCount() != gears.Num()) {
+		UE_LOG(LogGears, Error, TEXT("Expected %d instances, found %d"), gears.Num(), instancer->getInstanceCount());
+		errors++;
+	}
+
+	auto checkInstances = [&]() {
+		for (auto gear : gears) {
+			FTransform instance_transform;
+			if (!instancer->getInstanceTransform(gear, instance_transform) || !instance_transform.Equals(gear->getMeshTransform(), KINDA_SMALL_NUMBER)) {
+				UE_LOG(LogGears, Error, TEXT("%s: instance transform does not match the gear"), *gear->GetName());
+				errors++;
+			}
+		}
+	};
+
+	for (auto gear : gears) {
+		if (instancer->getBatchInstanceCount(gear) != gears_per_config) {
+			UE_LOG(LogGears, Error, TEXT("%s: expected %d instances in its batch, found %d"), *gear->GetName(), gears_per_config, instancer->getBatchInstanceCount(gear));
+			errors++;
+		}
+	}
+	checkInstances();
+
+	//Removing gears from the middle of a batch moves other instances, and a batch whose gears all left is destroyed
+	for (int32 index = gears_per_config - 1; index >= 0; index--) {
+		gears[index]->setInstancer(nullptr);
+		if (instancer->getBatchInstanceCount(gears[index]) != 0) {
+			UE_LOG(LogGears, Error, TEXT("%s is still instanced after leaving"), *gears[index]->GetName());
+			errors++;
+		}
+	}
+	for (int32 config = 1; config < configs; config++) {
+		for (int32 index = 1; index < gears_per_config; index += 2) {
+			gears[config * gears_per_config + index]->setInstancer(nullptr);
+		}
+	}
+	gears.RemoveAll([instancer](const AProceduralGear* gear) { return gear->getInstancer().Get() != instancer; });
+	world->Tick(LEVELTICK_All, 1.0f / 60.0f);
+
+	if (instancer->getBatchCount() != configs - 1 || instancer->getInstanceCount() != gears.Num()) {
+		UE_LOG(LogGears, Error, TEXT("%d batches and %d instances after removal, expected %d and %d"), instancer->getBatchCount(), instancer->getInstanceCount(), configs - 1, gears.Num());
+		errors++;
+	}
+	checkInstances();
+
+	destroyBenchmarkWorld(world);
+
+	UE_LOG(LogGears, Display, TEXT("Instancing check: %d gears in %d batches, %d errors"), configs * gears_per_config, configs, errors);
+	return errors > 0 ? 1 : 0;
+}
+
+int32 UGearBenchmarkCommandlet::runKinematicsBenchmark(const FString& Params)
+{
+	auto counts = parseCounts(Params, TEXT("Counts="), TEXT("1000,10000"));
+	int32 frames = 120;
+	FParse::Value(*Params, TEXT("Frames="), frames);
+	frames = FMath::Max(frames, 1);
+	auto with_actors = FParse::Param(*Params, TEXT("WithActors"));
+	const auto delta_seconds = 1.0f / 60.0f;
+
+	for (auto count : counts) {
+		//Chain of gear pairs, every pair meshes and every second gear shares a shaft with the next pair
+		FGearTrain train;
+		for (int32 index = 0; index < count; index++) {
+			train.addGear(index % 2 ? 12 : 36);
+			if (index % 2) {
+				train.addMesh(index - 1, index);
+			}
+			else if (index > 0) {
+				train.addShaft(index - 1, index);
+			}
+		}
+		train.setDriver(0, 60.0);
+
+		auto start = FPlatformTime::Seconds();
+		train.solve();
+		auto solve_ms = (FPlatformTime::Seconds() - start) * 1000.0;
+
+		start = FPlatformTime::Seconds();
+		for (int32 frame = 0; frame < frames; frame++) {
+			train.advance(delta_seconds);
+		}
+		auto advance_ms = (FPlatformTime::Seconds() - start) * 1000.0 / frames;
+
+		UE_LOG(LogGears, Display, TEXT("%6d gears: solve %.3f ms, advance %.4f ms/frame"), count, solve_ms, advance_ms);
+
+		if (!with_actors) {
+			continue;
+		}
+
+		auto world = createBenchmarkWorld();
+		TArray<AProceduralGear*> gears;
+		for (int32 index = 0; index < count; index++) {
+			auto gear = world->SpawnActorDeferred<AProceduralGear>(AProceduralGear::StaticClass(), FTransform(FVector(index * 50.0, 0, 0)));
+			gear->setDriveMode(EGearDriveMode::Kinematic);
+			gear->setNumberOfTeeth(index % 2 ? 12 : 36);
+			gear->ApplyRotation(index == 0);
+			gear->setRPM(60.0);
+			if (index % 2) {
+				gear->addMeshingGear(gears[index - 1]);
+			}
+			else if (index > 0) {
+				gear->addShaftGear(gears[index - 1]);
+			}
+			gear->FinishSpawning(FTransform(FVector(index * 50.0, 0, 0)));
+			gears.Add(gear);
+		}
+
+		//First frame rebuilds the train
+		world->Tick(LEVELTICK_All, delta_seconds);
+
+		start = FPlatformTime::Seconds();
+		for (int32 frame = 0; frame < frames; frame++) {
+			world->Tick(LEVELTICK_All, delta_seconds);
+		}
+		auto world_ms = (FPlatformTime::Seconds() - start) * 1000.0 / frames;
+
+		start = FPlatformTime::Seconds();
+		auto gear_train = world->GetSubsystem<UGearTrainSubsystem>();
+		for (int32 frame = 0; frame < frames; frame++) {
+			gear_train->updateGears(delta_seconds);
+		}
+		auto update_ms = (FPlatformTime::Seconds() - start) * 1000.0 / frames;
+
+		UE_LOG(LogGears, Display, TEXT("%6d gear actors: world tick %.3f ms/frame, gear train update %.3f ms/frame"), count, world_ms, update_ms);
+
+		destroyBenchmarkWorld(world);
+	}
+
+	return 0;
+}
+
+int32 UGearBenchmarkCommandlet::runCollisionBenchmark(const FString& Params)
+{
+	int32 pairs = 50;
+	unsigned int teeth = 48;
+	int32 frames = 120;
+	FParse::Value(*Params, TEXT("Pairs="), pairs);
+	FParse::Value(*Params, TEXT("Teeth="), teeth);
+	FParse::Value(*Params, TEXT("Frames="), frames);
+	pairs = FMath::Max(pairs, 1);
+	frames = FMath::Max(frames, 1);
+	const auto delta_seconds = 1.0f / 60.0f;
+
+	//None is left out, a gear without shapes has no body to simulate
+	const EGearCollisionMode modes[] = {
+		EGearCollisionMode::Hub,
+		EGearCollisionMode::TipCircle,
+		EGearCollisionMode::PerTooth,
+		EGearCollisionMode::MeshingWindow
+	};
+
+	for (auto collision_mode : modes) {
+		//Cook from scratch so the spawn time includes it
+		FGearMeshCache::Get().Empty();
+
+		auto world = createBenchmarkWorld();
+		auto start = FPlatformTime::Seconds();
+
+		//Pairs of meshing gears, the first one of every pair is driven by its constraint motor
+		AProceduralGear* gear = nullptr;
+		for (int32 pair = 0; pair < pairs; pair++) {
+			AProceduralGear* pair_gears[2];
+			for (int32 side = 0; side < 2; side++) {
+				gear = world->SpawnActorDeferred<AProceduralGear>(AProceduralGear::StaticClass(), FTransform::Identity);
+				gear->setNumberOfTeeth(teeth);
+				gear->setCollisionMode(collision_mode);
+				gear->ApplyRotation(side == 0);
+				gear->setRPM(30.0);
+				gear->setVelocityStrength(1000.0);
+				pair_gears[side] = gear;
+			}
+			pair_gears[0]->addMeshingGear(pair_gears[1]);
+			pair_gears[1]->addMeshingGear(pair_gears[0]);
+			pair_gears[0]->flushUpdate();
+			pair_gears[1]->flushUpdate();
+
+			auto center_distance = pair_gears[0]->getRefDiameter();
+			auto location = FVector(0, 0, pair * center_distance * 2.0);
+			pair_gears[0]->FinishSpawning(FTransform(location));
+			pair_gears[1]->FinishSpawning(FTransform(location + FVector(center_distance, 0, 0)));
+		}
+		FGearMeshCache::Get().flushCollision();
+		auto spawn_ms = (FPlatformTime::Seconds() - start) * 1000.0;
+		auto shapes = FGearMeshCache::Get().getGeometry(gear->getParams())->getCollisionShapeCount();
+
+		//Let the first contacts settle
+		world->Tick(LEVELTICK_All, delta_seconds);
+
+		start = FPlatformTime::Seconds();
+		for (int32 frame = 0; frame < frames; frame++) {
+			world->Tick(LEVELTICK_All, delta_seconds);
+		}
+		auto tick_ms = (FPlatformTime::Seconds() - start) * 1000.0 / frames;
+
+		UE_LOG(LogGears, Display, TEXT("%-14s %3d shapes/gear, %.2f kg/gear: spawn and cook %.2f ms, world tick %.3f ms/frame"),
+			*StaticEnum<EGearCollisionMode>()->GetNameStringByValue(int64(collision_mode)), shapes, gear->getMass(), spawn_ms, tick_ms);
+
+		destroyBenchmarkWorld(world);
+	}
+
+	return 0;
+}
+
+int32 UGearBenchmarkCommandlet::runAllocationCheck(const FString& Params)
+{
+	int32 iterations = 100;
+	FParse::Value(*Params, TEXT("Iterations="), iterations);
+	iterations = FMath::Max(iterations, 1);
+
+	FGearParams small_params;
+	small_params.number_of_teeth = 40;
+	FGearParams large_params;
+	large_params.number_of_teeth = 60;
+	large_params.involute_steps = 20;
+
+	auto errors = 0;
+
+	//Regenerating into the same buffers must not allocate once they are big enough
+	FGearMeshData mesh_data;
+	GearGeometry::generateGear(large_params, mesh_data);
+	GearGeometry::generateGear(small_params, mesh_data);
+	auto kernel_allocations = countAllocations([&]() {
+		for (int32 iteration = 0; iteration < iterations; iteration++) {
+			GearGeometry::generateGear(iteration % 2 ? small_params : large_params, mesh_data);
+		}
+	});
+	if (kernel_allocations > 0) {
+		UE_LOG(LogGears, Error, TEXT("Gear kernel allocated %lld times in %d regenerations"), kernel_allocations, iterations);
+		errors++;
+	}
+
+	//A single gear being edited releases its old geometry, so the cache keeps building into the same buffers
+	auto& cache = FGearMeshCache::Get();
+	cache.Empty();
+	TSharedPtr<const FGearMeshData> edited_geometry = cache.getGeometry(large_params);
+	auto edited_params = large_params;
+	auto cache_allocations = countAllocations([&]() {
+		for (int32 iteration = 0; iteration < iterations; iteration++) {
+			auto next_params = iteration % 2 ? large_params : small_params;
+			TSharedPtr<const FGearMeshData> next_geometry = cache.getGeometry(next_params);
+			cache.releaseGeometry(edited_params, edited_geometry);
+			edited_geometry = next_geometry;
+			edited_params = next_params;
+		}
+	});
+	UE_LOG(LogGears, Display, TEXT("Cache edit cycle: %lld allocations in %d edits"), cache_allocations, iterations);
+
+	//Setters also go through the mesh component and physics, which allocate on their own
+	auto world = createBenchmarkWorld();
+	auto gear = world->SpawnActor<AProceduralGear>();
+	gear->setNumberOfTeeth(small_params.number_of_teeth);
+	gear->flushUpdate();
+	gear->setNumberOfTeeth(large_params.number_of_teeth);
+	gear->flushUpdate();
+	auto actor_allocations = countAllocations([&]() {
+		for (int32 iteration = 0; iteration < iterations; iteration++) {
+			gear->setNumberOfTeeth(iteration % 2 ? large_params.number_of_teeth : small_params.number_of_teeth);
+			gear->flushUpdate();
+		}
+	});
+	destroyBenchmarkWorld(world);
+
+	UE_LOG(LogGears, Display, TEXT("Kernel: %lld allocations in %d regenerations"), kernel_allocations, iterations);
+	UE_LOG(LogGears, Display, TEXT("Actor setters: %.1f allocations per setNumberOfTeeth"), double(actor_allocations) / iterations);
+	UE_LOG(LogGears, Display, TEXT("Allocation check: %d errors"), errors);
+	return errors > 0 ? 1 : 0;
+}
+
+int32 UGearBenchmarkCommandlet::runBatchedUpdateCheck(const FString& Params)
+{
+	auto world = createBenchmarkWorld();
+	auto gear = world->SpawnActor<AProceduralGear>();
+	gear->flushUpdate();
+	auto errors = 0;
+
+	//Configuring a gear from script should only rebuild it once, at the end of the frame
+	auto serial_before = gear->getGenerationSerial();
+	gear->setModule(5.0f);
+	gear->setNumberOfTeeth(40);
+	gear->setWidth(20.0f);
+	gear->setPressureAngle(25.0f);
+	gear->setInvoluteSteps(8);
+	gear->enableCollision(false);
+	if (gear->getGenerationSerial() != serial_before || !gear->isUpdatePending()) {
+		UE_LOG(LogGears, Error, TEXT("Mutators rebuilt the gear before the end of the frame"));
+		errors++;
+	}
+
+	world->Tick(LEVELTICK_All, 1.0f / 60.0f);
+	if (gear->getGenerationSerial() != serial_before + 1 || gear->isUpdatePending()) {
+		UE_LOG(LogGears, Error, TEXT("Expected one rebuild after the frame, got %u"), gear->getGenerationSerial() - serial_before);
+		errors++;
+	}
+
+	//Material changes do not touch the geometry
+	serial_before = gear->getGenerationSerial();
+	gear->setMaterial(nullptr);
+	world->Tick(LEVELTICK_All, 1.0f / 60.0f);
+	if (gear->getGenerationSerial() != serial_before) {
+		UE_LOG(LogGears, Error, TEXT("setMaterial rebuilt the geometry"));
+		errors++;
+	}
+
+	//Setting the same params again is not a change
+	serial_before = gear->getGenerationSerial();
+	gear->setParams(gear->getParams());
+	world->Tick(LEVELTICK_All, 1.0f / 60.0f);
+	if (gear->getGenerationSerial() != serial_before) {
+		UE_LOG(LogGears, Error, TEXT("setParams with unchanged params rebuilt the gear"));
+		errors++;
+	}
+
+	destroyBenchmarkWorld(world);
+
+	UE_LOG(LogGears, Display, TEXT("Batched update check: %d errors"), errors);
+	return errors > 0 ? 1 : 0;
+}
+
+//Number of gears in the world and how many of them were built more than once
+static void countBuilds(UWorld* world, int32& gears, int32& rebuilt_gears)
+{
+	gears = 0;
+	rebuilt_gears = 0;
+	for (TActorIterator<AProceduralGear> gear(world); gear; ++gear) {
+		gears++;
+		rebuilt_gears += gear->getGenerationSerial() > 1 ? 1 : 0;
+	}
+}
+
+int32 UGearBenchmarkCommandlet::runLoadBenchmark(const FString& Params)
+{
+	int32 gear_count = 2000;
+	int32 configs = 8;
+	FParse::Value(*Params, TEXT("Gears="), gear_count);
+	FParse::Value(*Params, TEXT("Configs="), configs);
+	gear_count = FMath::Max(gear_count, 1);
+	configs = FMath::Max(configs, 1);
+
+	auto errors = 0;
+	if (GetDefault<AProceduralGear>()->getGenerationSerial() != 0) {
+		UE_LOG(LogGears, Error, TEXT("The class default object built a gear"));
+		errors++;
+	}
+
+	TArray<FGearParams> params;
+	TArray<FTransform> transforms;
+	for (int32 index = 0; index < gear_count; index++) {
+		auto& gear_params = params.AddDefaulted_GetRef();
+		gear_params.number_of_teeth = 12 + (index % configs) * 4;
+		transforms.Add(FTransform(FVector((index % 50) * 60.0, 0, (index / 50) * 60.0)));
+	}
+
+	auto& cache = FGearMeshCache::Get();
+	int32 gears;
+	int32 rebuilt_gears;
+
+	//Bulk spawn into a running world
+	cache.Empty();
+	auto world = createBenchmarkWorld();
+	auto start = FPlatformTime::Seconds();
+	AProceduralGear::spawnGears(world, transforms, params);
+	auto spawn_ms = (FPlatformTime::Seconds() - start) * 1000.0;
+	countBuilds(world, gears, rebuilt_gears);
+	destroyBenchmarkWorld(world);
+
+	UE_LOG(LogGears, Display, TEXT("Bulk spawn: %d gears in %.2f ms, %d built more than once"), gears, spawn_ms, rebuilt_gears);
+	errors += rebuilt_gears > 0 ? 1 : 0;
+
+	//Save a level with the gears and load it back like a game would
+	const auto package_name = FString(TEXT("/Temp/GearBenchmark/GearLoadBenchmark"));
+	const auto file_name = FPackageName::LongPackageNameToFilename(package_name, FPackageName::GetMapPackageExtension());
+	{
+		auto package = CreatePackage(*package_name);
+		auto level_world = UWorld::CreateWorld(EWorldType::Inactive, false, TEXT("GearLoadBenchmark"), package);
+		level_world->SetFlags(RF_Public | RF_Standalone);
+		AProceduralGear::spawnGears(level_world, transforms, params);
+
+		FSavePackageArgs save_args;
+		save_args.TopLevelFlags = RF_Public | RF_Standalone;
+		if (!UPackage::SavePackage(package, level_world, *file_name, save_args)) {
+			UE_LOG(LogGears, Error, TEXT("Could not save %s"), *file_name);
+			return 1;
+		}
+
+		level_world->DestroyWorld(false);
+		level_world->RemoveFromRoot();
+		level_world->ClearFlags(RF_Public | RF_Standalone);
+		CollectGarbage(RF_NoFlags);
+	}
+
+	cache.Empty();
+	cache.resetStats();
+
+	start = FPlatformTime::Seconds();
+	auto loaded_world = UWorld::FindWorldInPackage(LoadPackage(nullptr, *package_name, LOAD_None));
+	auto load_ms = (FPlatformTime::Seconds() - start) * 1000.0;
+	if (!loaded_world) {
+		UE_LOG(LogGears, Error, TEXT("Could not load %s"), *package_name);
+		return 1;
+	}
+
+	loaded_world->WorldType = EWorldType::Game;
+	loaded_world->AddToRoot();
+	auto& world_context = GEngine->CreateNewWorldContext(EWorldType::Game);
+	world_context.SetCurrentWorld(loaded_world);
+	loaded_world->InitWorld();
+	loaded_world->bShouldSimulatePhysics = true;
+
+	start = FPlatformTime::Seconds();
+	loaded_world->InitializeActorsForPlay(FURL());
+	loaded_world->BeginPlay();
+	auto begin_play_ms = (FPlatformTime::Seconds() - start) * 1000.0;
+
+	countBuilds(loaded_world, gears, rebuilt_gears);
+	auto stats = cache.getStats();
+	destroyBenchmarkWorld(loaded_world);
+
+	UE_LOG(LogGears, Display, TEXT("Level load: %d gears, load %.2f ms, begin play %.2f ms, %llu geometry builds (%llu from DDC), %d built more than once"),
+		gears, load_ms, begin_play_ms, stats.misses, stats.ddc_hits, rebuilt_gears);
+	errors += rebuilt_gears > 0 ? 1 : 0;
+
+	UE_LOG(LogGears, Display, TEXT("Load benchmark: %d errors"), errors);
+	return errors > 0 ? 1 : 0;
+}
+
+int32 UGearBenchmarkCommandlet::runDerivedDataBenchmark(const FString& Params)
+{
+#if WITH_EDITOR
+	int32 gear_count = 2000;
+	int32 configs = 64;
+	FParse::Value(*Params, TEXT("Gears="), gear_count);
+	FParse::Value(*Params, TEXT("Configs="), configs);
+	gear_count = FMath::Max(gear_count, 1);
+	configs = FMath::Max(configs, 1);
+
+	if (!GetDerivedDataCache()) {
+		UE_LOG(LogGears, Error, TEXT("No derived data cache available"));
+		return 1;
+	}
+
+	//A width no earlier run used, so the first pass starts with nothing on disk
+	const auto width = 10.0f + FMath::RandRange(0, 99999) * 0.0001f;
+
+	TArray<FGearParams> params;
+	TArray<FTransform> transforms;
+	for (int32 index = 0; index < gear_count; index++) {
+		auto& gear_params = params.AddDefaulted_GetRef();
+		gear_params.number_of_teeth = 12 + (index % configs) % 88;
+		gear_params.involute_steps = 4 + (index % configs) / 88;
+		gear_params.width = width;
+		transforms.Add(FTransform(FVector((index % 50) * 60.0, 0, (index / 50) * 60.0)));
+	}
+
+	auto& cache = FGearMeshCache::Get();
+	const TCHAR* pass_names[] = { TEXT("Cold"), TEXT("Warm") };
+	for (auto pass_name : pass_names) {
+		cache.Empty();
+		cache.resetStats();
+
+		auto world = createBenchmarkWorld();
+		auto start = FPlatformTime::Seconds();
+		AProceduralGear::spawnGears(world, transforms, params);
+		auto open_ms = (FPlatformTime::Seconds() - start) * 1000.0;
+		destroyBenchmarkWorld(world);
+
+		auto stats = cache.getStats();
+		auto lookups = stats.ddc_hits + stats.ddc_misses;
+		UE_LOG(LogGears, Display, TEXT("%s: %d gears in %.2f ms, %llu / %llu geometry loaded from DDC (%.1f%%)"),
+			pass_name, gear_count, open_ms, stats.ddc_hits, lookups, lookups > 0 ? 100.0 * stats.ddc_hits / lookups : 0.0);
+
+		//Writes are asynchronous, the warm pass has to see all of them
+		GetDerivedDataCacheRef().WaitForQuiescence(true);
+	}
+	return 0;
+#else
+	UE_LOG(LogGears, Error, TEXT("The derived data cache is only used in editor builds"));
+	return 1;
+#endif // WITH_EDITOR
+}
+
+int32 UGearBenchmarkCommandlet::runBulkGenerationBenchmark(const FString& Params)
+{
+	int32 gear_count = 500;
+	int32 configs = 64;
+	int32 iterations = 5;
+	FParse::Value(*Params, TEXT("Gears="), gear_count);
+	FParse::Value(*Params, TEXT("Configs="), configs);
+	FParse::Value(*Params, TEXT("Iterations="), iterations);
+	gear_count = FMath::Max(gear_count, 1);
+	configs = FMath::Max(configs, 1);
+	iterations = FMath::Max(iterations, 1);
+
+	auto worker_counts = parseCounts(Params, TEXT("Workers="), TEXT("1,2,4,8,16,32"));
+
+	TArray<FGearParams> params;
+	TArray<FTransform> transforms;
+	for (int32 index = 0; index < gear_count; index++) {
+		auto& gear_params = params.AddDefaulted_GetRef();
+		gear_params.number_of_teeth = 12 + (index % configs) % 88;
+		gear_params.involute_steps = 10 + (index % configs) / 88;
+		transforms.Add(FTransform(FVector((index % 50) * 60.0, 0, (index / 50) * 60.0)));
+	}
+
+	auto world = createBenchmarkWorld();
+	auto gears = AProceduralGear::spawnGears(world, transforms, params);
+	auto& cache = FGearMeshCache::Get();
+
+	//More workers than task graph threads only queue up
+	UE_LOG(LogGears, Display, TEXT("%d gears, %d distinct, %d worker threads"),
+		gears.Num(), FMath::Min(configs, gear_count), FTaskGraphInterface::Get().GetNumWorkerThreads());
+
+	auto width = params[0].width;
+	double serial_ms = 0.0;
+	for (auto workers : worker_counts) {
+		double total_ms = 0.0;
+		for (int32 iteration = 0; iteration < iterations; iteration++) {
+			//A new width every pass so nothing is served from the cache
+			width = width == 15.0f ? 15.5f : 15.0f;
+			cache.Empty();
+			for (auto gear : gears) {
+				gear->beginUpdate();
+				gear->setWidth(width);
+				gear->endUpdate();
+			}
+
+			auto start = FPlatformTime::Seconds();
+			AProceduralGear::generateGears(gears, workers);
+			total_ms += (FPlatformTime::Seconds() - start) * 1000.0;
+		}
+
+		auto average_ms = total_ms / iterations;
+		if (serial_ms == 0.0) {
+			serial_ms = average_ms;
+		}
+		UE_LOG(LogGears, Display, TEXT("%2d workers: %8.2f ms, %.2fx"), workers, average_ms, serial_ms / average_ms);
+	}
+
+	destroyBenchmarkWorld(world);
+	return 0;
+}
+
+int32 UGearBenchmarkCommandlet::runMeshMemoryBenchmark(const FString& Params)
+{
+	unsigned int involute_steps = 4;
+	FParse::Value(*Params, TEXT("Steps="), involute_steps);
+	auto teeth_counts = parseCounts(Params, TEXT("Teeth="), TEXT("8,24,60,100"));
+
+	auto world = createBenchmarkWorld();
+	auto errors = 0;
+
+	//The procedural mesh component keeps its sections on the game thread, and its proxy keeps a CPU copy of the
+	//buffers it uploads. The proxy uses four half precision UV channels, vertex colors and 32 bit indices
+	constexpr SIZE_T PROC_MESH_VERTEX_BYTES = sizeof(FVector3f) + 2 * sizeof(FPackedNormal) + 4 * sizeof(FVector2DHalf) + sizeof(FColor);
+	auto proc_mesh_actor = world->SpawnActor<AActor>();
+	auto proc_mesh = NewObject<UProceduralMeshComponent>(proc_mesh_actor);
+	proc_mesh->RegisterComponent();
+
+	UE_LOG(LogGears, Display, TEXT("Per gear bytes, procedural mesh component -> gear mesh component with every LOD. CPU is what the component owns + its share of the geometry it draws"));
+	for (auto teeth : teeth_counts) {
+		FGearParams params;
+		params.number_of_teeth = teeth;
+		params.involute_steps = involute_steps;
+		auto gear = AProceduralGear::spawnGears(world, { FTransform::Identity }, { params })[0];
+		auto mesh = gear->FindComponentByClass<UGearMeshComponent>();
+		auto geometry = mesh->getGeometry();
+
+		proc_mesh->CreateMeshSection(0, geometry->verts, geometry->indices, geometry->normals, TArray<FVector2D>(), TArray<FColor>(), TArray<FProcMeshTangent>(), false);
+		auto section = proc_mesh->GetProcMeshSection(0);
+		auto proc_mesh_gpu = geometry->verts.Num() * PROC_MESH_VERTEX_BYTES + geometry->indices.Num() * sizeof(uint32);
+		auto proc_mesh_cpu = section->ProcVertexBuffer.GetAllocatedSize() + section->ProcIndexBuffer.GetAllocatedSize() + proc_mesh_gpu;
+		auto num_verts = geometry->verts.Num();
+		auto num_indices = geometry->indices.Num();
+		//Only the gear, its mesh and the mesh cache should hold the geometry while it is measured
+		geometry.Reset();
+
+		//The gear mesh component draws the shared geometry and its proxy drops the CPU copy after uploading it. Each LOD
+		//is split evenly between everything that holds it, the mesh cache among them
+		auto gear_mesh_gpu = mesh->getGPUMemory();
+		FResourceSizeEx own_size(EResourceSizeMode::Exclusive);
+		mesh->GetResourceSizeEx(own_size);
+		auto gear_mesh_cpu = own_size.GetDedicatedSystemMemoryBytes();
+		SIZE_T shared_cpu = 0;
+		SIZE_T shared_cpu_per_gear = 0;
+		for (const auto& lod_geometry : mesh->getLODs()) {
+			auto lod_size = lod_geometry->GetAllocatedSize();
+			shared_cpu += lod_size;
+			shared_cpu_per_gear += lod_size / lod_geometry.GetSharedReferenceCount();
+		}
+
+		UE_LOG(LogGears, Display, TEXT("%3u teeth, %5d verts, %6d indices: CPU %8llu -> %llu + %llu of %llu shared, GPU %8llu -> %8llu (%.0f%%)"),
+			teeth, num_verts, num_indices,
+			uint64(proc_mesh_cpu), uint64(gear_mesh_cpu), uint64(shared_cpu_per_gear), uint64(shared_cpu), uint64(proc_mesh_gpu), uint64(gear_mesh_gpu),
+			proc_mesh_gpu > 0 ? 100.0 * gear_mesh_gpu / proc_mesh_gpu : 0.0);
+
+		//A change that keeps the topology is written into the existing buffers
+		auto buffer_serial = mesh->getRenderBufferSerial();
+		if (buffer_serial == 0) {
+			UE_LOG(LogGears, Warning, TEXT("No render state, run with -AllowCommandletRendering to check buffer updates"));
+		}
+		else {
+			gear->setModule(gear->getModule() * 1.5f);
+			gear->flushUpdate();
+			world->SendAllEndOfFrameUpdates();
+			if (mesh->getRenderBufferSerial() != buffer_serial) {
+				UE_LOG(LogGears, Error, TEXT("Changing the module of a %u teeth gear recreated its render buffers"), teeth);
+				errors++;
+			}
+
+			gear->setNumberOfTeeth(teeth > 8 ? teeth - 1 : teeth + 1);
+			gear->flushUpdate();
+			world->SendAllEndOfFrameUpdates();
+			if (mesh->getRenderBufferSerial() == buffer_serial) {
+				UE_LOG(LogGears, Error, TEXT("Changing the teeth of a %u teeth gear kept render buffers of the old size"), teeth);
+				errors++;
+			}
+		}
+		gear->Destroy();
+	}
+
+	destroyBenchmarkWorld(world);
+
+	UE_LOG(LogGears, Display, TEXT("Mesh memory check: %d errors"), errors);
+	return errors > 0 ? 1 : 0;
+}
+
+int32 UGearBenchmarkCommandlet::runIncrementalUpdateBenchmark(const FString& Params)
+{
+	int32 iterations = 50;
+	unsigned int teeth = 60;
+	unsigned int steps = 20;
+	FParse::Value(*Params, TEXT("Iterations="), iterations);
+	FParse::Value(*Params, TEXT("Teeth="), teeth);
+	FParse::Value(*Params, TEXT("Steps="), steps);
+	iterations = FMath::Max(iterations, 1);
+
+	FGearParams source_params;
+	source_params.number_of_teeth = teeth;
+	source_params.involute_steps = steps;
+	source_params.collision_mode = EGearCollisionMode::PerTooth;
+
+	TArray<TPair<const TCHAR*, FGearParams>> edits;
+	edits.Add({ TEXT("Module"), source_params });
+	edits.Last().Value.module *= 1.5f;
+	edits.Add({ TEXT("Width"), source_params });
+	edits.Last().Value.width *= 2.0f;
+	edits.Add({ TEXT("Module and width"), source_params });
+	edits.Last().Value.module *= 0.5f;
+	edits.Last().Value.width *= 0.5f;
+	edits.Add({ TEXT("Collision mode"), source_params });
+	edits.Last().Value.collision_mode = EGearCollisionMode::MeshingWindow;
+	edits.Add({ TEXT("Teeth"), source_params });
+	edits.Last().Value.number_of_teeth = teeth > 8 ? teeth - 1 : teeth + 1;
+
+	auto errors = 0;
+
+	//Deriving against building the edited params from scratch
+	FGearMeshData source;
+	FGearMeshData reference;
+	FGearMeshData derived;
+	GearGeometry::generateGear(source_params, source);
+	for (const auto& edit : edits) {
+		const auto& params = edit.Value;
+		if (EnumHasAnyFlags(GearGeometry::classifyChange(source_params, params), EGearChange::Rebuild)) {
+			continue;
+		}
+
+		auto start = FPlatformTime::Seconds();
+		for (int32 iteration = 0; iteration < iterations; iteration++) {
+			GearGeometry::generateGear(params, reference);
+		}
+		auto build_seconds = FMath::Max(FPlatformTime::Seconds() - start, SMALL_NUMBER);
+
+		start = FPlatformTime::Seconds();
+		for (int32 iteration = 0; iteration < iterations; iteration++) {
+			GearGeometry::deriveGear(source_params, source, params, derived);
+		}
+		auto derive_seconds = FMath::Max(FPlatformTime::Seconds() - start, SMALL_NUMBER);
+
+		auto deviation = maxDeviation(reference, derived);
+		auto mass_deviation = FMath::Abs(derived.profile_polar_moment / reference.profile_polar_moment - 1.0);
+		UE_LOG(LogGears, Display, TEXT("%-16s build %8.1f us, derive %8.1f us, %.2fx, deviation=%g cm, inertia deviation=%g"),
+			edit.Key, build_seconds * 1e6 / iterations, derive_seconds * 1e6 / iterations, build_seconds / derive_seconds, deviation, mass_deviation);
+
+		if (deviation > GearGeometry::DERIVED_TOLERANCE || mass_deviation > GearGeometry::DERIVED_TOLERANCE) {
+			UE_LOG(LogGears, Error, TEXT("%s edit derived %g cm off the kernel, more than %g"), edit.Key, deviation, GearGeometry::DERIVED_TOLERANCE);
+			errors++;
+		}
+	}
+
+	//The same edits on a gear, including collision. A rescale shares the cooked hulls of the previous params
+	auto world = createBenchmarkWorld();
+	auto gear = world->SpawnActor<AProceduralGear>();
+	auto& cache = FGearMeshCache::Get();
+	for (const auto& edit : edits) {
+		cache.Empty();
+		gear->setParams(source_params);
+		gear->flushUpdate();
+		cache.flushCollision();
+		auto stats_before = cache.getStats();
+
+		auto start = FPlatformTime::Seconds();
+		gear->setParams(edit.Value);
+		gear->flushUpdate();
+		auto elapsed_ms = (FPlatformTime::Seconds() - start) * 1000.0;
+		cache.flushCollision();
+
+		auto stats = cache.getStats();
+		auto derived_count = stats.derived - stats_before.derived;
+		auto scaled_count = stats.collision_scaled - stats_before.collision_scaled;
+		UE_LOG(LogGears, Display, TEXT("%-16s gear update %8.3f ms, %llu derived, %llu collision scaled, %llu collision cooked"),
+			edit.Key, elapsed_ms, derived_count, scaled_count, stats.collision_misses - stats_before.collision_misses - scaled_count);
+
+		auto change = GearGeometry::classifyChange(source_params, edit.Value);
+		if (!EnumHasAnyFlags(change, EGearChange::Rebuild) && derived_count == 0) {
+			UE_LOG(LogGears, Error, TEXT("%s edit rebuilt the gear instead of deriving it"), edit.Key);
+			errors++;
+		}
+		if (change == EGearChange::Scale && scaled_count == 0) {
+			UE_LOG(LogGears, Error, TEXT("%s edit cooked collision instead of rescaling it"), edit.Key);
+			errors++;
+		}
+	}
+	destroyBenchmarkWorld(world);
+
+	UE_LOG(LogGears, Display, TEXT("Incremental updates: %d errors"), errors);
+	return errors > 0 ? 1 : 0;
+}
+
+#if WITH_EDITOR
+//Sets a gear property the way the details panel does and notifies the gear
+static void editProperty(AProceduralGear* gear, FProperty* property, double value, EPropertyChangeType::Type change_type)
+{
+	if (auto float_property = CastField<FFloatProperty>(property)) {
+		float_property->SetPropertyValue_InContainer(gear, float(value));
+	}
+	else if (auto uint_property = CastField<FUInt32Property>(property)) {
+		uint_property->SetPropertyValue_InContainer(gear, uint32(value));
+	}
+
+	FPropertyChangedEvent event(property, change_type);
+	static_cast<UObject*>(gear)->PostEditChangeProperty(event);
+}
+#endif // WITH_EDITOR
+
+int32 UGearBenchmarkCommandlet::runInteractiveEditBenchmark(const FString& Params)
+{
+#if WITH_EDITOR
+	int32 frames = 60;
+	unsigned int teeth = 100;
+	unsigned int steps = 50;
+	FParse::Value(*Params, TEXT("Frames="), frames);
+	FParse::Value(*Params, TEXT("Teeth="), teeth);
+	FParse::Value(*Params, TEXT("Steps="), steps);
+	frames = FMath::Max(frames, 2);
+
+	struct FDrag
+	{
+		const TCHAR* property_name;
+		double from;
+		double to;
+	};
+	const FDrag drags[] = {
+		{ TEXT("_module"), 10.0, 20.0 },
+		{ TEXT("_width"), 15.0, 60.0 },
+		{ TEXT("_number_of_teeth"), 20.0, 100.0 },
+		{ TEXT("_involute_steps"), 4.0, 50.0 },
+	};
+
+	auto world = createBenchmarkWorld();
+	auto gear = world->SpawnActor<AProceduralGear>();
+	auto& cache = FGearMeshCache::Get();
+	auto errors = 0;
+
+	for (const auto& drag : drags) {
+		auto property = FindFProperty<FProperty>(AProceduralGear::StaticClass(), drag.property_name);
+		if (!property) {
+			UE_LOG(LogGears, Error, TEXT("AProceduralGear has no property %s"), drag.property_name);
+			errors++;
+			continue;
+		}
+
+		//Every frame of the drag as a committed value, which is how every change was built before, then as a preview
+		for (auto change_type : { EPropertyChangeType::ValueSet, EPropertyChangeType::Interactive }) {
+			FGearParams params;
+			params.number_of_teeth = teeth;
+			params.involute_steps = steps;
+			params.collision_mode = EGearCollisionMode::PerTooth;
+			gear->setParams(params);
+			gear->flushUpdate();
+			cache.Empty();
+
+			double total_ms = 0.0;
+			double max_ms = 0.0;
+			for (int32 frame = 0; frame < frames; frame++) {
+				auto value = FMath::Lerp(drag.from, drag.to, double(frame) / (frames - 1));
+				auto start = FPlatformTime::Seconds();
+				editProperty(gear, property, value, change_type);
+				world->Tick(LEVELTICK_All, 1.0f / 60.0f);
+				auto frame_ms = (FPlatformTime::Seconds() - start) * 1000.0;
+				total_ms += frame_ms;
+				max_ms = FMath::Max(max_ms, frame_ms);
+			}
+
+			//Releasing the slider commits the last value
+			auto start = FPlatformTime::Seconds();
+			if (change_type == EPropertyChangeType::Interactive) {
+				editProperty(gear, property, drag.to, EPropertyChangeType::ValueSet);
+			}
+			auto release_ms = (FPlatformTime::Seconds() - start) * 1000.0;
+			gear->waitForGeneration();
+
+			UE_LOG(LogGears, Display, TEXT("%-16s %-11s frame %8.2f ms avg, %8.2f ms max, release %6.2f ms"),
+				drag.property_name, change_type == EPropertyChangeType::Interactive ? TEXT("Interactive") : TEXT("ValueSet"),
+				total_ms / frames, max_ms, release_ms);
+
+			if (gear->isShowingPreview()) {
+				UE_LOG(LogGears, Error, TEXT("Gear still shows the preview after releasing %s"), drag.property_name);
+				errors++;
+			}
+		}
+	}
+
+	destroyBenchmarkWorld(world);
+
+	UE_LOG(LogGears, Display, TEXT("Interactive edits: %d errors"), errors);
+	return errors > 0 ? 1 : 0;
+#else
+	UE_LOG(LogGears, Error, TEXT("Interactive edits need an editor build"));
+	return 1;
+#endif // WITH_EDITOR
+}
+
+int32 UGearBenchmarkCommandlet::runLODBenchmark(const FString& Params)
+{
+	int32 gear_count = 1000;
+	unsigned int teeth = 60;
+	unsigned int steps = 20;
+	FParse::Value(*Params, TEXT("Gears="), gear_count);
+	FParse::Value(*Params, TEXT("Teeth="), teeth);
+	FParse::Value(*Params, TEXT("Steps="), steps);
+	gear_count = FMath::Max(gear_count, 1);
+	auto distances = parseCounts(Params, TEXT("Distances="), TEXT("500,2000,5000,20000"));
+
+	FGearParams params;
+	params.number_of_teeth = teeth;
+	params.involute_steps = steps;
+
+	auto errors = 0;
+	auto& cache = FGearMeshCache::Get();
+	cache.Empty();
+
+	auto start = FPlatformTime::Seconds();
+	FGearLODGeometry lods;
+	cache.getLODs(params, params, {}, lods);
+	auto build_ms = (FPlatformTime::Seconds() - start) * 1000.0;
+
+	for (int32 lod = 0; lod < lods.Num(); lod++) {
+		const auto& geometry = *lods[lod];
+		UE_LOG(LogGears, Display, TEXT("LOD %d: %5d verts, %6d triangles, %7llu bytes, screen size < %.2f"),
+			lod, geometry.verts.Num(), geometry.indices.Num() / 3, uint64(geometry.GetAllocatedSize()), GearGeometry::LOD_SCREEN_SIZES[lod]);
+
+		if (lod > 0 && geometry.getCollisionShapeCount() > 0) {
+			UE_LOG(LogGears, Error, TEXT("LOD %d has collision"), lod);
+			errors++;
+		}
+		if (lod > 0 && geometry.indices.Num() > lods[lod - 1]->indices.Num()) {
+			UE_LOG(LogGears, Error, TEXT("LOD %d draws more triangles than LOD %d"), lod, lod - 1);
+			errors++;
+		}
+	}
+	UE_LOG(LogGears, Display, TEXT("Building every LOD took %.2f ms"), build_ms);
+
+	//Square grid of gears on the ground, seen from above its center
+	auto world = createBenchmarkWorld();
+	TArray<FTransform> transforms;
+	const auto columns = FMath::CeilToInt(FMath::Sqrt(double(gear_count)));
+	const auto spacing = GearGeometry::computeDimensions(params).tip_diameter * 1.5;
+	for (int32 index = 0; index < gear_count; index++) {
+		transforms.Emplace(FVector((index % columns - columns / 2) * spacing, (index / columns - columns / 2) * spacing, 0.0));
+	}
+	auto gears = AProceduralGear::spawnGears(world, transforms, { params });
+	cache.flushCollision();
+
+	TArray<UGearMeshComponent*> meshes;
+	for (auto gear : gears) {
+		auto mesh = gear->FindComponentByClass<UGearMeshComponent>();
+		meshes.Add(mesh);
+		if (mesh->GetBodySetup() != cache.getCollision(params)) {
+			UE_LOG(LogGears, Error, TEXT("Gear does not collide with the LOD 0 hulls"));
+			errors++;
+			break;
+		}
+	}
+
+	//Same projection as a 90 degree 1080p viewport
+	const FPerspectiveMatrix projection(FMath::DegreesToRadians(45.0f), 1920.0f, 1080.0f, 10.0f);
+	const auto lod0_triangles = int64(lods[0]->indices.Num() / 3) * meshes.Num();
+	for (auto distance : distances) {
+		const FVector view_origin(0.0, 0.0, distance);
+		int32 lod_gears[GearGeometry::LOD_COUNT] = {};
+		int64 triangles = 0;
+
+		start = FPlatformTime::Seconds();
+		for (auto mesh : meshes) {
+			const auto& bounds = mesh->Bounds;
+			auto lod = FMath::Min(UGearMeshComponent::selectLOD(ComputeBoundsScreenSize(bounds.Origin, bounds.SphereRadius, view_origin, projection)), mesh->getLODs().Num() - 1);
+			lod_gears[lod]++;
+			triangles += mesh->getLODs()[lod]->indices.Num() / 3;
+		}
+		auto select_ms = (FPlatformTime::Seconds() - start) * 1000.0;
+
+		FString lod_gears_string;
+		for (int32 lod = 0; lod < GearGeometry::LOD_COUNT; lod++) {
+			lod_gears_string += FString::Printf(TEXT("%s%d"), lod > 0 ? TEXT("/") : TEXT(""), lod_gears[lod]);
+		}
+		UE_LOG(LogGears, Display, TEXT("%6d cm: %9lld -> %9lld triangles (%.0f%%), gears per LOD %s, selection %.3f ms/frame"),
+			distance, lod0_triangles, triangles, lod0_triangles > 0 ? 100.0 * triangles / lod0_triangles : 0.0,
+			*lod_gears_string, select_ms);
+	}
+
+	if (meshes.Num() > 0 && meshes[0]->getGPUMemory() > 0) {
+		UE_LOG(LogGears, Display, TEXT("GPU memory per gear with every LOD: %llu bytes"), uint64(meshes[0]->getGPUMemory()));
+	}
+	else {
+		UE_LOG(LogGears, Warning, TEXT("No render state, run with -AllowCommandletRendering to report GPU memory. Draw times need a rendering session with gears.LOD.Force"));
+	}
+
+	destroyBenchmarkWorld(world);
+
+	UE_LOG(LogGears, Display, TEXT("LOD check: %d errors"), errors);
+	return errors > 0 ? 1 : 0;
+}
+
+int32 UGearBenchmarkCommandlet::runTessellationBenchmark(const FString& Params)
+{
+	FString modules_string = TEXT("0.1,0.5,2,10,50");
+	FParse::Value(*Params, TEXT("Modules="), modules_string, false);
+	TArray<FString> module_strings;
+	modules_string.ParseIntoArray(module_strings, TEXT(","));
+	unsigned int teeth = 24;
+	float max_chordal_error = 0.01f;
+	FParse::Value(*Params, TEXT("Teeth="), teeth);
+	FParse::Value(*Params, TEXT("Error="), max_chordal_error);
+
+	auto errors = 0;
+	FGearMeshData geometry;
+	UE_LOG(LogGears, Display, TEXT("Chordal error %.4f mm, %u teeth. Even steps that meet the error -> adaptive flank and spacing arc samples"), max_chordal_error, teeth);
+	for (const auto& module_string : module_strings) {
+		FGearParams params;
+		params.module = FCString::Atof(*module_string);
+		params.number_of_teeth = teeth;
+		params.collision_mode = EGearCollisionMode::None;
+
+		//Fixed steps need as many samples on the spacing arc as on the flanks, spaced evenly
+		auto even_params = params;
+		even_params.involute_steps = GearGeometry::MIN_INVOLUTE_STEPS;
+		while (even_params.involute_steps < GearGeometry::MAX_INVOLUTE_STEPS && GearGeometry::computeChordalError(even_params) > max_chordal_error) {
+			even_params.involute_steps++;
+		}
+
+		auto start = FPlatformTime::Seconds();
+		auto adaptive_params = params;
+		GearGeometry::setChordalError(adaptive_params, max_chordal_error);
+		auto pick_ms = (FPlatformTime::Seconds() - start) * 1000.0;
+
+		GearGeometry::generateGear(adaptive_params, geometry);
+		auto adaptive_error = GearGeometry::computeChordalError(adaptive_params);
+		auto even_verts = GearGeometry::computeSizes(even_params).verts;
+
+		UE_LOG(LogGears, Display, TEXT("module %6.2f mm: %3u steps, %6d verts, %.4f mm -> %3u/%3u steps, %6d verts (%.0f%%), %.4f mm, picked in %.3f ms"),
+			params.module, even_params.involute_steps, even_verts, GearGeometry::computeChordalError(even_params),
+			adaptive_params.involute_steps, adaptive_params.spacing_steps, geometry.verts.Num(), even_verts > 0 ? 100.0 * geometry.verts.Num() / even_verts : 0.0,
+			adaptive_error, pick_ms);
+
+		auto limited = adaptive_params.involute_steps == GearGeometry::MAX_INVOLUTE_STEPS || adaptive_params.spacing_steps == GearGeometry::MAX_INVOLUTE_STEPS;
+		if (adaptive_error > max_chordal_error && !limited) {
+			UE_LOG(LogGears, Error, TEXT("Module %.2f gear misses the chordal error"), params.module);
+			errors++;
+		}
+	}
+
+	//The gear resolves its sample counts from the property and reports them once built
+	auto world = createBenchmarkWorld();
+	auto gear = world->SpawnActorDeferred<AProceduralGear>(AProceduralGear::StaticClass(), FTransform::Identity);
+	gear->setMaxChordalError(max_chordal_error);
+	gear->FinishSpawning(FTransform::Identity);
+	auto mesh = gear->FindComponentByClass<UGearMeshComponent>();
+	if (!mesh->getGeometry() || mesh->getGeometry()->verts.Num() != gear->getVertexCount() || gear->getChordalError() > max_chordal_error) {
+		UE_LOG(LogGears, Error, TEXT("Gear reports %d vertices at %.4f mm for a chordal error of %.4f mm"), gear->getVertexCount(), gear->getChordalError(), max_chordal_error);
+		errors++;
+	}
+	destroyBenchmarkWorld(world);
+
+	UE_LOG(LogGears, Display, TEXT("Tessellation check: %d errors"), errors);
+	return errors > 0 ? 1 : 0;
+}
+
+//Collision memory of a body setup. Every distinct cooked convex counts once, at the size it serializes to
+static SIZE_T getCollisionBytes(const UBodySetup* body_setup, int32& convexes)
+{
+	const auto& convex_elems = body_setup->AggGeom.ConvexElems;
+	auto bytes = convex_elems.GetAllocatedSize();
+	TSet<const Chaos::FConvex*> counted;
+	for (const auto& convex_elem : convex_elems) {
+		bytes += convex_elem.VertexData.GetAllocatedSize() + convex_elem.IndexData.GetAllocatedSize();
+		auto chaos_convex = convex_elem.GetChaosConvexMesh().Get();
+		if (chaos_convex && !counted.Contains(chaos_convex)) {
+			counted.Add(chaos_convex);
+			TArray<uint8> data;
+			FMemoryWriter writer(data);
+			Chaos::FChaosArchive chaos_archive(writer);
+			chaos_convex->Serialize(chaos_archive);
+			bytes += data.Num();
+		}
+	}
+	convexes = counted.Num();
+	return bytes;
+}
+
+int32 UGearBenchmarkCommandlet::runSharedCollisionBenchmark(const FString& Params)
+{
+	auto teeth_counts = parseCounts(Params, TEXT("Teeth="), TEXT("8,24,60,100"));
+	unsigned int steps = 4;
+	int32 iterations = 5;
+	FParse::Value(*Params, TEXT("Steps="), steps);
+	FParse::Value(*Params, TEXT("Iterations="), iterations);
+	iterations = FMath::Max(iterations, 1);
+
+	auto errors = 0;
+	auto& cache = FGearMeshCache::Get();
+	UE_LOG(LogGears, Display, TEXT("Per tooth cooking -> shared tooth convex, %u involute steps, %d iterations"), steps, iterations);
+	for (auto teeth : teeth_counts) {
+		double per_tooth_ms = 0.0;
+		double shared_ms = 0.0;
+		SIZE_T per_tooth_bytes = 0;
+		SIZE_T shared_bytes = 0;
+		int32 per_tooth_convexes = 0;
+		int32 shared_convexes = 0;
+
+		for (int32 iteration = 0; iteration < iterations; iteration++) {
+			//Another width every iteration, so the cooked hulls of the last one are not loaded from disk
+			FGearParams params;
+			params.number_of_teeth = teeth;
+			params.involute_steps = steps;
+			params.width = 15.0f + iteration;
+			params.collision_mode = EGearCollisionMode::PerTooth;
+
+			cache.Empty();
+			auto geometry = cache.getGeometry(params);
+
+			//How the cache cooked collision before, one convex per hull
+			auto start = FPlatformTime::Seconds();
+			auto per_tooth = NewObject<UBodySetup>(GetTransientPackage(), NAME_None, RF_Transient);
+			per_tooth->BodySetupGuid = FGuid::NewDeterministicGuid(GearGeometry::makeKey(params) + TEXT("PerTooth"), GearGeometry::VERSION);
+			per_tooth->bGenerateMirroredCollision = false;
+			per_tooth->bDoubleSidedGeometry = true;
+			for (int32 shape = 0; shape < geometry->getCollisionShapeCount(); shape++) {
+				auto collision_shape = geometry->getCollisionShape(shape);
+				auto& convex_elem = per_tooth->AggGeom.ConvexElems.AddDefaulted_GetRef();
+				convex_elem.VertexData.Append(collision_shape.GetData(), collision_shape.Num());
+				convex_elem.UpdateElemBox();
+			}
+			per_tooth->CreatePhysicsMeshes();
+			per_tooth_ms += (FPlatformTime::Seconds() - start) * 1000.0;
+
+			start = FPlatformTime::Seconds();
+			auto shared = cache.getCollision(params);
+			shared_ms += (FPlatformTime::Seconds() - start) * 1000.0;
+
+			per_tooth_bytes = getCollisionBytes(per_tooth, per_tooth_convexes);
+			shared_bytes = getCollisionBytes(shared, shared_convexes);
+
+			//Every tooth elem has to end up where its hull is
+			const auto& shared_elems = shared->AggGeom.ConvexElems;
+			if (shared_elems.Num() != geometry->getCollisionShapeCount()) {
+				UE_LOG(LogGears, Error, TEXT("%d teeth: %d shared elems for %d hulls"), teeth, shared_elems.Num(), geometry->getCollisionShapeCount());
+				errors++;
+				continue;
+			}
+			double max_distance = 0.0;
+			for (int32 shape = 0; shape < shared_elems.Num(); shape++) {
+				auto collision_shape = geometry->getCollisionShape(shape);
+				const auto& convex_elem = shared_elems[shape];
+				if (convex_elem.VertexData.Num() != collision_shape.Num()) {
+					max_distance = MAX_dbl;
+					break;
+				}
+				for (int32 vert = 0; vert < collision_shape.Num(); vert++) {
+					auto elem_vert = convex_elem.GetTransform().TransformPosition(convex_elem.VertexData[vert]);
+					max_distance = FMath::Max(max_distance, FVector::Dist(elem_vert, collision_shape[vert]));
+				}
+			}
+			if (max_distance > GearGeometry::VECTOR_FLOAT_TOLERANCE) {
+				UE_LOG(LogGears, Error, TEXT("%d teeth: a shared tooth elem is %f cm off its hull"), teeth, max_distance);
+				errors++;
+			}
+		}
+
+		UE_LOG(LogGears, Display, TEXT("%3d teeth: %3d convexes, %8.3f ms, %8.1f KB -> %d convexes, %8.3f ms, %8.1f KB"),
+			teeth, per_tooth_convexes, per_tooth_ms / iterations, per_tooth_bytes / 1024.0,
+			shared_convexes, shared_ms / iterations, shared_bytes / 1024.0);
+		if (shared_convexes != 1) {
+			UE_LOG(LogGears, Error, TEXT("%d teeth: shared collision cooked %d convexes"), teeth, shared_convexes);
+			errors++;
+		}
+	}
+	cache.Empty();
+
+	UE_LOG(LogGears, Display, TEXT("Shared collision check: %d errors"), errors);
+	return errors > 0 ? 1 : 0;
+}
+
+int32 UGearBenchmarkCommandlet::runAsyncCookingBenchmark(const FString& Params)
+{
+	int32 gear_count = 500;
+	int32 configs = 16;
+	unsigned int teeth = 60;
+	FParse::Value(*Params, TEXT("Gears="), gear_count);
+	FParse::Value(*Params, TEXT("Configs="), configs);
+	FParse::Value(*Params, TEXT("Teeth="), teeth);
+	gear_count = FMath::Max(gear_count, 1);
+	configs = FMath::Clamp(configs, 1, gear_count);
+
+	const EGearCollisionCooking policies[] = {
+		EGearCollisionCooking::Synchronous,
+		EGearCollisionCooking::KeepPrevious,
+		EGearCollisionCooking::DisableUntilReady
+	};
+
+	auto errors = 0;
+	auto& cache = FGearMeshCache::Get();
+	for (auto policy : policies) {
+		auto policy_name = StaticEnum<EGearCollisionCooking>()->GetNameStringByValue(int64(policy));
+		//Cook from scratch, and with widths no earlier policy used so the cooked hulls are not loaded from disk
+		cache.Empty();
+		cache.resetStats();
+		auto world = createBenchmarkWorld();
+
+		auto start = FPlatformTime::Seconds();
+		TArray<AProceduralGear*> gears;
+		for (int32 index = 0; index < gear_count; index++) {
+			FGearParams params;
+			params.number_of_teeth = teeth;
+			params.width = 10.0f + int32(policy) * configs + index % configs;
+			params.collision_mode = EGearCollisionMode::PerTooth;
+
+			auto gear = world->SpawnActorDeferred<AProceduralGear>(AProceduralGear::StaticClass(), FTransform::Identity);
+			gear->beginUpdate();
+			gear->setParams(params);
+			gear->setCollisionCooking(policy);
+			gear->FinishSpawning(FTransform(FVector((index % 50) * 60.0, 0, (index / 50) * 60.0)));
+			gear->endUpdate();
+			gears.Add(gear);
+		}
+		auto spawn_ms = (FPlatformTime::Seconds() - start) * 1000.0;
+
+		//The mesh shows before the collision is ready
+		auto pending_gears = 0;
+		for (auto gear : gears) {
+			pending_gears += gear->isCollisionPending() ? 1 : 0;
+			auto mesh = gear->FindComponentByClass<UGearMeshComponent>();
+			if (!mesh->getGeometry()) {
+				UE_LOG(LogGears, Error, TEXT("%s: a gear has no mesh while its collision cooks"), *policy_name);
+				errors++;
+				break;
+			}
+		}
+
+		start = FPlatformTime::Seconds();
+		cache.flushCollision();
+		auto ready_ms = spawn_ms + (FPlatformTime::Seconds() - start) * 1000.0;
+		auto stats = cache.getStats();
+
+		for (auto gear : gears) {
+			auto mesh = gear->FindComponentByClass<UGearMeshComponent>();
+			if (gear->isCollisionPending() || !mesh->getSharedBodySetup() || mesh->getSharedBodySetup() != cache.getCollision(gear->getParams())) {
+				UE_LOG(LogGears, Error, TEXT("%s: a gear does not collide with the cooked hulls of its params"), *policy_name);
+				errors++;
+				break;
+			}
+		}
+		destroyBenchmarkWorld(world);
+
+		UE_LOG(LogGears, Display, TEXT("%-17s %d gears: game thread %8.2f ms, all collision ready %8.2f ms, %4d pending after spawn, %llu background cooks, %llu joined, peak queue depth %d"),
+			*policy_name, gear_count, spawn_ms, ready_ms, pending_gears, stats.collision_async_cooks, stats.collision_joined, stats.collision_peak_pending);
+
+		if (policy == EGearCollisionCooking::Synchronous && pending_gears > 0) {
+			UE_LOG(LogGears, Error, TEXT("%s: %d gears wait for their collision"), *policy_name, pending_gears);
+			errors++;
+		}
+		if (stats.collision_async_cooks > uint64(configs)) {
+			UE_LOG(LogGears, Error, TEXT("%s: cooked %llu times in the background for %d params"), *policy_name, stats.collision_async_cooks, configs);
+			errors++;
+		}
+	}
+
+	UE_LOG(LogGears, Display, TEXT("Async cooking check: %d errors"), errors);
+	return errors > 0 ? 1 : 0;
+}
+
+int32 UGearBenchmarkCommandlet::runCouplingBenchmark(const FString& Params)
+{
+	int32 gear_count = 200;
+	unsigned int teeth = 24;
+	int32 frames = 300;
+	FParse::Value(*Params, TEXT("Gears="), gear_count);
+	FParse::Value(*Params, TEXT("Teeth="), teeth);
+	FParse::Value(*Params, TEXT("Frames="), frames);
+	gear_count = FMath::Max(gear_count, 2);
+	frames = FMath::Max(frames, 2);
+	const auto delta_seconds = 1.0f / 60.0f;
+	const auto max_ratio_error = 0.02;
+
+	//Physics meshes through the tooth contacts of MeshingWindow collision, Coupled through couplings and hubs
+	const EGearDriveMode modes[] = {
+		EGearDriveMode::Physics,
+		EGearDriveMode::Coupled
+	};
+
+	auto errors = 0;
+	for (auto drive_mode : modes) {
+		auto mode_name = StaticEnum<EGearDriveMode>()->GetNameStringByValue(int64(drive_mode));
+		auto world = createBenchmarkWorld();
+
+		//A chain of gears with alternating tooth counts, driven by the constraint motor of the first one
+		TArray<AProceduralGear*> gears;
+		auto x = 0.0;
+		for (int32 index = 0; index < gear_count; index++) {
+			auto gear = world->SpawnActorDeferred<AProceduralGear>(AProceduralGear::StaticClass(), FTransform::Identity);
+			gear->setNumberOfTeeth(index % 2 == 0 ? teeth : teeth * 3 / 2);
+			gear->setDriveMode(drive_mode);
+			gear->ApplyRotation(index == 0);
+			gear->setRPM(30.0);
+			gear->setVelocityStrength(1000.0);
+			if (index > 0) {
+				gear->addMeshingGear(gears.Last());
+				gears.Last()->addMeshingGear(gear);
+				x += (gears.Last()->getRefDiameter() + gear->getRefDiameter()) / 2.0;
+			}
+			gear->flushUpdate();
+			gear->FinishSpawning(FTransform(FVector(x, 0, 0)));
+			gears.Add(gear);
+		}
+		FGearMeshCache::Get().flushCollision();
+
+		//Coupled chains also drive a cube without gravity along X as a rack of the first gear, away from the chain so
+		//only the coupling moves it
+		UStaticMeshComponent* rack = nullptr;
+		if (drive_mode == EGearDriveMode::Coupled) {
+			auto rack_actor = world->SpawnActor<AStaticMeshActor>(FVector(0, 0, -1000.0), FRotator::ZeroRotator);
+			rack = rack_actor->GetStaticMeshComponent();
+			rack->SetMobility(EComponentMobility::Movable);
+			rack->SetStaticMesh(LoadObject<UStaticMesh>(nullptr, TEXT("/Engine/BasicShapes/Cube.Cube")));
+			rack->SetSimulatePhysics(true);
+			rack->SetEnableGravity(false);
+			world->GetSubsystem<UGearTrainSubsystem>()->addRack(gears[0], rack, FVector::XAxisVector);
+		}
+
+		//Let the chain spin up before measuring, the couplings are built in the first update
+		for (int32 frame = 0; frame < frames / 2; frame++) {
+			world->Tick(LEVELTICK_All, delta_seconds);
+		}
+		auto couplings = world->GetSubsystem<UGearTrainSubsystem>()->getCouplingCount();
+
+		TArray<double> velocities;
+		velocities.SetNumZeroed(gear_count);
+		auto rack_velocity = 0.0;
+		auto start = FPlatformTime::Seconds();
+		for (int32 frame = 0; frame < frames; frame++) {
+			world->Tick(LEVELTICK_All, delta_seconds);
+			for (int32 index = 0; index < gear_count; index++) {
+				auto axis = gears[index]->getMeshTransform().GetUnitAxis(EAxis::Y);
+				velocities[index] += FVector::DotProduct(gears[index]->getMesh()->GetPhysicsAngularVelocityInRadians(), axis) / frames;
+			}
+			if (rack) {
+				rack_velocity += rack->GetPhysicsLinearVelocity().X / frames;
+			}
+		}
+		auto tick_ms = (FPlatformTime::Seconds() - start) * 1000.0 / frames;
+
+		//Meshing pairs turn the other way at the inverse of their tooth ratio, z_a * w_a + z_b * w_b = 0
+		auto driver_speed = FMath::Abs(velocities[0] * gears[0]->getNumberOfTeeth());
+		auto worst_error = 0.0;
+		for (int32 index = 1; index < gear_count; index++) {
+			auto pair_speed = velocities[index - 1] * gears[index - 1]->getNumberOfTeeth() + velocities[index] * gears[index]->getNumberOfTeeth();
+			worst_error = FMath::Max(worst_error, FMath::Abs(pair_speed) / FMath::Max(driver_speed, SMALL_NUMBER));
+		}
+
+		UE_LOG(LogGears, Display, TEXT("%-8s %d gears, %3d couplings: world tick %.3f ms/frame, driver %.2f rad/s, worst ratio error %.2f%%"),
+			*mode_name, gear_count, couplings, tick_ms, velocities[0], worst_error * 100.0);
+
+		if (drive_mode == EGearDriveMode::Coupled && couplings != gear_count) {
+			UE_LOG(LogGears, Error, TEXT("%s: %d couplings for %d meshing pairs and a rack"), *mode_name, couplings, gear_count - 1);
+			errors++;
+		}
+		if (drive_mode == EGearDriveMode::Coupled && worst_error > max_ratio_error) {
+			UE_LOG(LogGears, Error, TEXT("%s: a pair is %.2f%% off its gear ratio"), *mode_name, worst_error * 100.0);
+			errors++;
+		}
+
+		//The rack moves by the arc the reference circle of the driver rolls, v = w * r
+		if (rack) {
+			auto expected_velocity = velocities[0] * gears[0]->getRefDiameter() / 2.0;
+			auto rack_error = FMath::Abs(rack_velocity - expected_velocity) / FMath::Max(FMath::Abs(expected_velocity), SMALL_NUMBER);
+			UE_LOG(LogGears, Display, TEXT("%-8s rack %.2f cm/s, expected %.2f cm/s, error %.2f%%"), *mode_name, rack_velocity, expected_velocity, rack_error * 100.0);
+			if (rack_error > max_ratio_error) {
+				UE_LOG(LogGears, Error, TEXT("%s: the rack is %.2f%% off the speed of the reference circle"), *mode_name, rack_error * 100.0);
+				errors++;
+			}
+		}
+
+		destroyBenchmarkWorld(world);
+	}
+
+	UE_LOG(LogGears, Display, TEXT("Coupling check: %d errors"), errors);
+	return errors > 0 ? 1 : 0;
+}
+
+int32 UGearBenchmarkCommandlet::runLayoutBenchmark(const FString& Params)
+{
+	auto counts = parseCounts(Params, TEXT("Counts="), TEXT("1000,10000"));
+	unsigned int teeth = 24;
+	float jitter = 0.5f;
+	FParse::Value(*Params, TEXT("Teeth="), teeth);
+	FParse::Value(*Params, TEXT("Jitter="), jitter);
+	//Tip circles stop overlapping a module past the reference circles touching
+	jitter = FMath::Clamp(jitter, 0.0f, 0.9f);
+	const int32 chain_length = 50;
+
+	auto errors = 0;
+	FRandomStream random(1234);
+	for (auto count : counts) {
+		auto world = createBenchmarkWorld();
+
+		//Chains of gears with alternating tooth counts, each gear off its partner by up to jitter modules and turned
+		//to a random phase
+		int32 expected_pairs = 0;
+		auto z = 0.0;
+		for (int32 first = 0; first < count; first += chain_length) {
+			auto length = FMath::Min(chain_length, count - first);
+			expected_pairs += length - 1;
+
+			AProceduralGear* previous = nullptr;
+			auto x = 0.0;
+			auto largest = 0.0;
+			for (int32 index = 0; index < length; index++) {
+				auto gear = world->SpawnActorDeferred<AProceduralGear>(AProceduralGear::StaticClass(), FTransform::Identity);
+				gear->setNumberOfTeeth(index % 2 == 0 ? teeth : teeth * 3 / 2);
+				gear->setDriveMode(EGearDriveMode::Kinematic);
+				gear->setCollisionMode(EGearCollisionMode::None);
+				gear->flushUpdate();
+
+				const auto& dimensions = gear->getDimensions();
+				if (previous) {
+					x += (previous->getDimensions().ref_diameter + dimensions.ref_diameter) / 2.0 + random.FRandRange(-jitter, jitter) * dimensions.module;
+				}
+				largest = FMath::Max(largest, dimensions.tip_diameter);
+
+				auto rotation = FQuat(FVector::YAxisVector, random.FRandRange(0.0f, 2.0f * PI));
+				gear->FinishSpawning(FTransform(rotation, FVector(x, 0, z)));
+				previous = gear;
+			}
+			z += largest * 2.0;
+		}
+
+		auto layout = world->GetSubsystem<UGearLayoutSubsystem>();
+		auto start = FPlatformTime::Seconds();
+		layout->updateLayout();
+		auto hash_ms = (FPlatformTime::Seconds() - start) * 1000.0;
+
+		TArray<FGearMeshing> meshings;
+		start = FPlatformTime::Seconds();
+		layout->findMeshings(meshings);
+		auto find_ms = (FPlatformTime::Seconds() - start) * 1000.0;
+		auto misplaced_pairs = Algo::CountIf(meshings, [](const FGearMeshing& meshing) { return meshing.problems != EGearMeshingProblem::None; });
+
+		start = FPlatformTime::Seconds();
+		auto snapped = layout->snapLayout();
+		auto snap_ms = (FPlatformTime::Seconds() - start) * 1000.0;
+
+		TArray<FGearMeshing> snapped_meshings;
+		layout->findMeshings(snapped_meshings);
+		auto remaining_pairs = Algo::CountIf(snapped_meshings, [](const FGearMeshing& meshing) { return meshing.problems != EGearMeshingProblem::None; });
+
+		UE_LOG(LogGears, Display, TEXT("%6d gears: hash %.3f ms, find %5d pairs %.3f ms, %5d misplaced, snap %5d gears %.3f ms, %d pairs with problems after"),
+			count, hash_ms, meshings.Num(), find_ms, misplaced_pairs, snapped, snap_ms, remaining_pairs);
+
+		if (meshings.Num() != expected_pairs || snapped_meshings.Num() != expected_pairs) {
+			UE_LOG(LogGears, Error, TEXT("%d gears: found %d and %d pairs after snapping, expected %d"), count, meshings.Num(), snapped_meshings.Num(), expected_pairs);
+			errors++;
+		}
+		if (remaining_pairs > 0) {
+			UE_LOG(LogGears, Error, TEXT("%d gears: %d pairs do not mesh after snapping"), count, remaining_pairs);
+			errors++;
+		}
+
+		destroyBenchmarkWorld(world);
+	}
+
+	UE_LOG(LogGears, Display, TEXT("Layout check: %d errors"), errors);
+	return errors > 0 ? 1 : 0;
+}
+
+int32 UGearBenchmarkCommandlet::runAssemblyBenchmark(const FString& Params)
+{
+	int32 gear_count = 500;
+	int32 gears_per_shaft = 5;
+	int32 material_count = 2;
+	int32 frames = 60;
+	FParse::Value(*Params, TEXT("Gears="), gear_count);
+	FParse::Value(*Params, TEXT("GearsPerShaft="), gears_per_shaft);
+	FParse::Value(*Params, TEXT("Materials="), material_count);
+	FParse::Value(*Params, TEXT("Frames="), frames);
+	gear_count = FMath::Max(gear_count, 1);
+	gears_per_shaft = FMath::Clamp(gears_per_shaft, 1, gear_count);
+	material_count = FMath::Max(material_count, 1);
+	frames = FMath::Max(frames, 1);
+	const auto delta_seconds = 1.0f / 60.0f;
+
+	auto world = createBenchmarkWorld();
+	auto assembly = world->SpawnActor<AGearAssembly>();
+
+	TArray<UMaterialInstance*> materials;
+	for (int32 material = 0; material < material_count; material++) {
+		materials.Add(UMaterialInstanceDynamic::Create(UMaterial::GetDefaultMaterial(MD_Surface), nullptr));
+	}
+
+	//Kinematic shafts of gears with different tooth counts and materials, each driven through its first gear
+	TArray<AProceduralGear*> gears;
+	auto shaft_count = 0;
+	for (int32 first = 0; first < gear_count; first += gears_per_shaft, shaft_count++) {
+		auto shaft_location = FVector((shaft_count % 20) * 100.0, 0, (shaft_count / 20) * 100.0);
+		AProceduralGear* shaft_gear = nullptr;
+		for (int32 index = first; index < FMath::Min(first + gears_per_shaft, gear_count); index++) {
+			auto gear = world->SpawnActorDeferred<AProceduralGear>(AProceduralGear::StaticClass(), FTransform::Identity);
+			gear->setNumberOfTeeth(8 + (index * 7) % 60);
+			gear->setMaterial(materials[index % material_count]);
+			gear->setDriveMode(EGearDriveMode::Kinematic);
+			gear->setCollisionMode(EGearCollisionMode::None);
+			gear->ApplyRotation(index == first);
+			gear->setRPM(30.0);
+			gear->setAssembly(assembly);
+			gear->flushUpdate();
+			gear->FinishSpawning(FTransform(shaft_location + FVector(0, (index - first) * 2.0, 0)));
+
+			if (shaft_gear) {
+				gear->addShaftGear(shaft_gear);
+				shaft_gear->addShaftGear(gear);
+			}
+			else {
+				shaft_gear = gear;
+			}
+			gears.Add(gear);
+		}
+	}
+
+	//Estimated, not measured: without the assembly every gear is a component of its own with a section per material
+	auto sections = 0;
+	for (auto gear : gears) {
+		sections += gear->getMesh()->GetNumMaterials();
+	}
+
+	auto start = FPlatformTime::Seconds();
+	assembly->flushShafts();
+	auto merge_ms = (FPlatformTime::Seconds() - start) * 1000.0;
+
+	start = FPlatformTime::Seconds();
+	for (int32 frame = 0; frame < frames; frame++) {
+		world->Tick(LEVELTICK_All, delta_seconds);
+	}
+	auto tick_ms = (FPlatformTime::Seconds() - start) * 1000.0 / frames;
+
+	UE_LOG(LogGears, Display, TEXT("%d gears, %d materials: own components estimated %d components and %d sections, assembly estimated %d components and %d sections, merge %.2f ms, world tick %.3f ms/frame"),
+		gear_count, material_count, gears.Num(), sections, assembly->getShaftCount(), assembly->getSectionCount(), merge_ms, tick_ms);
+
+	auto errors = 0;
+	if (assembly->getGearCount() != gears.Num() || assembly->getShaftCount() != shaft_count) {
+		UE_LOG(LogGears, Error, TEXT("%d gears merged into %d shafts, expected %d gears on %d shafts"), assembly->getGearCount(), assembly->getShaftCount(), gears.Num(), shaft_count);
+		errors++;
+	}
+	if (assembly->getSectionCount() > shaft_count * FMath::Min(material_count, gears_per_shaft)) {
+		UE_LOG(LogGears, Error, TEXT("%d sections for %d shafts of %d materials"), assembly->getSectionCount(), shaft_count, material_count);
+		errors++;
+	}
+
+	//Shafts turned since they were merged, every gear has to be drawn where the last frame turned it to
+	for (auto gear : gears) {
+		FTransform transform;
+		if (!assembly->getGearTransform(gear, transform) || !transform.Equals(gear->getMeshTransform(), KINDA_SMALL_NUMBER)) {
+			UE_LOG(LogGears, Error, TEXT("A merged gear is drawn off its transform"));
+			errors++;
+			break;
+		}
+	}
+
+	//A gear leaving merges only its own shaft again
+	start = FPlatformTime::Seconds();
+	gears.Pop()->setAssembly(nullptr);
+	assembly->flushShafts();
+	auto regroup_ms = (FPlatformTime::Seconds() - start) * 1000.0;
+	UE_LOG(LogGears, Display, TEXT("One gear leaving: regroup %.2f ms"), regroup_ms);
+
+	auto last_shaft_gears = gear_count - (shaft_count - 1) * gears_per_shaft;
+	if (assembly->getGearCount() != gears.Num() || assembly->getShaftCount() != shaft_count - (last_shaft_gears == 1 ? 1 : 0)) {
+		UE_LOG(LogGears, Error, TEXT("%d gears on %d shafts after a gear left"), assembly->getGearCount(), assembly->getShaftCount());
+		errors++;
+	}
+
+	destroyBenchmarkWorld(world);
+
+	UE_LOG(LogGears, Display, TEXT("Assembly check: %d errors"), errors);
+	return errors > 0 ? 1 : 0;
+}
@@ -0,0 +1,103 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "GearBenchmarkCommandlet.generated.h"
+
+/**
+ * Headless gear benchmarks and checks.
+ * UnrealEditor-Cmd Gears.uproject -run=GearBenchmark -nullrhi [-Mode=Kernel] [-Csv=path]
+ *
+ * Kernel:     [-MinTeeth=8] [-MaxTeeth=100] [-TeethStep=4] [-MinSteps=4] [-MaxSteps=50] [-StepsStep=2] [-Iterations=20]
+ *             Reports gears/sec, vertices/sec and peak memory of the gear kernel.
+ * KernelPaths: [-Iterations=200]
+ *             Reports profile points/sec of the scalar and SIMD kernel paths. Fails if a SIMD path is off the scalar one.
+ * Instancing: [-Configs=4] [-GearsPerConfig=25]
+ *             Checks instance counts and transforms of gears drawn through an AGearInstancer, also after gears leave.
+ * Kinematics: [-Counts=1000,10000] [-Frames=120] [-WithActors]
+ *             Reports the frame cost of kinematic gear trains, solver only or with spawned gears.
+ * Collision:  [-Pairs=50] [-Teeth=48] [-Frames=120]
+ *             Reports cook and physics step time of meshing physics gears for every collision mode.
+ * Allocations: [-Iterations=100]
+ *             Counts heap allocations of regenerating gears. Fails if the kernel allocates when rebuilding into its buffers.
+ * BatchedUpdates:
+ *             Checks that mutator calls are collected into one rebuild per frame and that material changes skip it.
+ * Load:       [-Gears=2000] [-Configs=8]
+ *             Times bulk spawning and loading a saved level of gears. Fails if any gear or the class default object builds twice.
+ * DerivedData: [-Gears=2000] [-Configs=64]
+ *             Times spawning gears with the derived data cache cold and warm and reports its hit rate.
+ * BulkGeneration: [-Gears=500] [-Configs=64] [-Workers=1,2,4,8,16,32] [-Iterations=5]
+ *             Reports how rebuilding a level of gears through AProceduralGear::generateGears scales with the worker count.
+ * MeshMemory: [-Teeth=8,24,60,100] [-Steps=4]
+ *             Reports CPU and GPU mesh memory per gear against a procedural mesh component, with the geometry a gear shares
+ *             split between its holders. With -AllowCommandletRendering also fails if a change that keeps the topology
+ *             recreates the render buffers.
+ * IncrementalUpdates: [-Teeth=60] [-Steps=20] [-Iterations=50]
+ *             Times deriving edited gears from their previous geometry against building them. Fails if a derived gear is off
+ *             the kernel output, or if a gear rebuilds or cooks collision for an edit that only rescales it.
+ * InteractiveEdits: [-Teeth=100] [-Steps=50] [-Frames=60]
+ *             Reports the frame time of dragging gear properties in the details panel, with every frame committed and
+ *             as interactive previews. Fails if the gear keeps showing the preview after the drag. Editor builds only.
+ * LODs:       [-Gears=1000] [-Teeth=60] [-Steps=20] [-Distances=500,2000,5000,20000]
+ *             Reports the triangles drawn of a grid of gears seen from each distance, with the LOD chain and LOD 0 only,
+ *             and the memory and per frame selection cost of the LODs. Fails if a LOD has collision or draws more
+ *             triangles than the one before it.
+ * Tessellation: [-Modules=0.1,0.5,2,10,50] [-Teeth=24] [-Error=0.01]
+ *             Reports the vertices and chordal error of gears tessellated for a chordal error in mm, against the even
+ *             involute steps that meet the same error. Fails if an adaptive gear misses the error below the sample limit.
+ * SharedCollision: [-Teeth=8,24,60,100] [-Steps=4] [-Iterations=5]
+ *             Reports cook time and collision memory of per tooth collision with one convex per tooth and with the
+ *             shared tooth convex. Fails if a gear cooks more than one tooth convex or a tooth elem is off its hull.
+ *             Cooked hulls are cached on disk, run with a cold derived data cache for cook times.
+ * AsyncCooking: [-Gears=500] [-Configs=16] [-Teeth=60]
+ *             Reports the game thread time of spawning gears and the time until all their collision is ready for every
+ *             collision cooking policy, with the background cook queue depth. Fails if params cook more than once or a
+ *             gear is left without its collision.
+ * Coupling:   [-Gears=200] [-Teeth=24] [-Frames=300]
+ *             Reports the physics step time of a driven chain of meshing gears with tooth contacts and with gear ratio
+ *             couplings, and how far each pair is off its ratio. The coupled chain also drives a rack from its first gear.
+ *             Fails if a coupled pair or the rack is off by more than 2%.
+ * Layout:     [-Counts=1000,10000] [-Teeth=24] [-Jitter=0.5]
+ *             Times hashing a layout of misplaced gear chains, finding their meshing partners and snapping them, with
+ *             the centre distances off by up to Jitter modules. Fails if a pair is missed or still has a problem after
+ *             snapping.
+ * Assembly:   [-Gears=500] [-GearsPerShaft=5] [-Materials=2] [-Frames=60]
+ *             Times merging a machine of turning shafts with gears of different params and materials into an
+ *             AGearAssembly, and regrouping it after one gear leaves. The components and mesh sections it reports are counted from the gears and shafts, not
+ *             measured from the renderer. Fails if a shaft is not merged into one section per material or a merged gear
+ *             is drawn off its own transform.
+ */
+UCLASS()
+class UGearBenchmarkCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UGearBenchmarkCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+
+private:
+	int32 runKernelBenchmark(const FString& Params);
+	int32 runKernelPathBenchmark(const FString& Params);
+	int32 runInstancingCheck(const FString& Params);
+	int32 runKinematicsBenchmark(const FString& Params);
+	int32 runCollisionBenchmark(const FString& Params);
+	int32 runAllocationCheck(const FString& Params);
+	int32 runBatchedUpdateCheck(const FString& Params);
+	int32 runLoadBenchmark(const FString& Params);
+	int32 runDerivedDataBenchmark(const FString& Params);
+	int32 runBulkGenerationBenchmark(const FString& Params);
+	int32 runMeshMemoryBenchmark(const FString& Params);
+	int32 runIncrementalUpdateBenchmark(const FString& Params);
+	int32 runInteractiveEditBenchmark(const FString& Params);
+	int32 runLODBenchmark(const FString& Params);
+	int32 runTessellationBenchmark(const FString& Params);
+	int32 runSharedCollisionBenchmark(const FString& Params);
+	int32 runAsyncCookingBenchmark(const FString& Params);
+	int32 runCouplingBenchmark(const FString& Params);
+	int32 runLayoutBenchmark(const FString& Params);
+	int32 runAssemblyBenchmark(const FString& Params);
+};
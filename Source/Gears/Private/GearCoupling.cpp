@@ -0,0 +1,101 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GearCoupling.h"
+#include "PhysicsProxy/SingleParticlePhysicsProxy.h"
+
+//Velocity state of a coupled body for the duration of one solve. Bodies that are not dynamic get no inverse mass
+struct FCoupledBody
+{
+	Chaos::FRigidBodyHandle_Internal* handle = nullptr;
+	FVector v = FVector::ZeroVector;
+	FVector w = FVector::ZeroVector;
+	double inv_mass = 0.0;
+	FVector inv_inertia = FVector::ZeroVector;
+	//From the principal axes of inertia to world space
+	FQuat rotation = FQuat::Identity;
+	bool changed = false;
+
+	//Inverse of the moment of inertia about axis
+	double getAngularInvMass(const FVector& axis) const
+	{
+		auto local_axis = rotation.UnrotateVector(axis);
+		return inv_inertia.X * local_axis.X * local_axis.X + inv_inertia.Y * local_axis.Y * local_axis.Y + inv_inertia.Z * local_axis.Z * local_axis.Z;
+	}
+
+	void applyAngularImpulse(const FVector& axis, double impulse)
+	{
+		w += rotation.RotateVector(inv_inertia * rotation.UnrotateVector(axis)) * impulse;
+		changed = true;
+	}
+
+	void applyLinearImpulse(const FVector& axis, double impulse)
+	{
+		v += axis * (inv_mass * impulse);
+		changed = true;
+	}
+};
+
+void FGearCouplingCallback::OnPreSimulate_Internal()
+{
+	auto input = GetConsumerInput();
+	const double delta_seconds = GetDeltaTime_Internal();
+	if (!input || input->constraints.IsEmpty() || delta_seconds <= 0.0) {
+		return;
+	}
+
+	TArray<FCoupledBody, TInlineAllocator<64>> bodies;
+	bodies.SetNum(input->bodies.Num());
+	for (int32 index = 0; index < bodies.Num(); index++) {
+		auto proxy = input->bodies[index];
+		auto handle = proxy ? proxy->GetPhysicsThreadAPI() : nullptr;
+		if (!handle || handle->ObjectState() != Chaos::EObjectStateType::Dynamic) {
+			continue;
+		}
+
+		auto& body = bodies[index];
+		body.handle = handle;
+		body.v = handle->V();
+		body.w = handle->W();
+		body.inv_mass = handle->InvM();
+		body.inv_inertia = FVector(handle->InvI());
+		body.rotation = handle->R() * handle->RotationOfMass();
+	}
+
+	//The drift is measured once per game frame. Correcting it again in the later substeps of the frame would remove it
+	//several times over and overshoot
+	const auto bias = input->frame != corrected_frame ? input->bias / delta_seconds : 0.0;
+	corrected_frame = input->frame;
+	for (int32 iteration = 0; iteration < input->iterations; iteration++) {
+		for (const auto& constraint : input->constraints) {
+			auto& body_a = bodies[constraint.body_a];
+			auto& body_b = bodies[constraint.body_b];
+
+			auto velocity_b = constraint.linear_b ? body_b.v : body_b.w;
+			auto velocity = constraint.ratio_a * FVector::DotProduct(body_a.w, constraint.axis_a) + constraint.ratio_b * FVector::DotProduct(velocity_b, constraint.axis_b);
+			auto inv_mass_b = constraint.linear_b ? body_b.inv_mass : body_b.getAngularInvMass(constraint.axis_b);
+			auto inv_mass = constraint.ratio_a * constraint.ratio_a * body_a.getAngularInvMass(constraint.axis_a) + constraint.ratio_b * constraint.ratio_b * inv_mass_b;
+			if (inv_mass <= SMALL_NUMBER) {
+				continue;
+			}
+
+			auto impulse = -(velocity + bias * constraint.position_error) / inv_mass;
+			if (body_a.handle) {
+				body_a.applyAngularImpulse(constraint.axis_a, constraint.ratio_a * impulse);
+			}
+			if (body_b.handle && constraint.linear_b) {
+				body_b.applyLinearImpulse(constraint.axis_b, constraint.ratio_b * impulse);
+			}
+			else if (body_b.handle) {
+				body_b.applyAngularImpulse(constraint.axis_b, constraint.ratio_b * impulse);
+			}
+		}
+	}
+
+	for (const auto& body : bodies) {
+		if (body.changed) {
+			body.handle->SetV(body.v);
+			body.handle->SetW(body.w);
+		}
+	}
+}
@@ -0,0 +1,58 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Chaos/SimCallbackInput.h"
+#include "Chaos/SimCallbackObject.h"
+
+class FSingleParticlePhysicsProxy;
+
+//Velocity constraint ratio_a * w_a + ratio_b * w_b = 0 between two bodies, where w is the angular velocity about the
+//axis or, with linear_b, the velocity of body b along axis_b. Bodies index FGearCouplingInput::bodies
+struct FGearCouplingConstraint
+{
+	int32 body_a = INDEX_NONE;
+	int32 body_b = INDEX_NONE;
+	FVector axis_a = FVector::YAxisVector;
+	FVector axis_b = FVector::YAxisVector;
+	double ratio_a = 1.0;
+	double ratio_b = -1.0;
+	bool linear_b = false;
+	//How far ratio_a * angle_a + ratio_b * angle_b drifted from where the coupling started, in radians or cm
+	//times the ratios. Steered back to 0 over a few frames
+	double position_error = 0.0;
+};
+
+//Couplings of one game frame, sent right before its physics step. Bodies of the last frame are never reused,
+//a body destroyed since then would be gone from the solver
+struct FGearCouplingInput : public Chaos::FSimCallbackInput
+{
+	TArray<FSingleParticlePhysicsProxy*> bodies;
+	TArray<FGearCouplingConstraint> constraints;
+	int32 iterations = 4;
+	double bias = 0.2;
+	//Game frame the drift was measured in. Substeps of one frame share its input, only the first one corrects the drift
+	uint64 frame = 0;
+
+	void Reset()
+	{
+		bodies.Reset();
+		constraints.Reset();
+	}
+};
+
+/**
+ * Solves gear ratio couplings on the physics thread before every step, instead of leaving the ratio to tooth contacts.
+ * The constraints are solved as impulses on the body velocities with a few Gauss-Seidel iterations, plus a bias that
+ * removes the drift of the integrated angles once per game frame.
+ */
+class FGearCouplingCallback : public Chaos::TSimCallbackObject<FGearCouplingInput>
+{
+public:
+	virtual void OnPreSimulate_Internal() override;
+
+private:
+	//Physics thread only
+	uint64 corrected_frame = 0;
+};
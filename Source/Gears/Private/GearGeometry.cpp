@@ -0,0 +1,1224 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GearGeometry.h"
+#include "Math/UnitConversion.h"
+#include "HAL/IConsoleManager.h"
+
+using namespace GearGeometry;
+
+static TAutoConsoleVariable<int32> CVarGearKernelPath(
+	TEXT("gears.Kernel.Path"),
+	int32(EGearKernelPath::VectorDouble),
+	TEXT("How gear teeth are evaluated. 0: scalar, 1: SIMD in float, 2: SIMD in double."));
+
+void FGearMeshData::Reset()
+{
+	verts.Reset();
+	indices.Reset();
+	normals.Reset();
+	collision_verts.Reset();
+	collision_offsets.Reset();
+	profile_area = 0.0;
+	profile_polar_moment = 0.0;
+}
+
+SIZE_T FGearMeshData::GetAllocatedSize() const
+{
+	return verts.GetAllocatedSize() + indices.GetAllocatedSize() + normals.GetAllocatedSize()
+		+ collision_verts.GetAllocatedSize() + collision_offsets.GetAllocatedSize();
+}
+
+//Keeps the capacity of the array when the loaded data fits in it
+template<typename T>
+static void serializeArray(FArchive& ar, TArray<T>& array)
+{
+	auto num = array.Num();
+	ar << num;
+	if (ar.IsLoading()) {
+		array.SetNumUninitialized(num, false);
+	}
+	ar.Serialize(array.GetData(), int64(num) * sizeof(T));
+}
+
+void FGearMeshData::Serialize(FArchive& ar)
+{
+	serializeArray(ar, verts);
+	serializeArray(ar, indices);
+	serializeArray(ar, normals);
+	serializeArray(ar, collision_verts);
+	serializeArray(ar, collision_offsets);
+	ar << profile_area;
+	ar << profile_polar_moment;
+}
+
+int32 FGearMeshData::getCollisionShapeCount() const
+{
+	return FMath::Max(collision_offsets.Num() - 1, 0);
+}
+
+TArrayView<const FVector> FGearMeshData::getCollisionShape(int32 shape) const
+{
+	return TArrayView<const FVector>(collision_verts.GetData() + collision_offsets[shape], collision_offsets[shape + 1] - collision_offsets[shape]);
+}
+
+//Tooth profile points as separate arrays, padded to whole vector registers.
+//Every point is center + radius * (cos(angle) + scaled_t * sin(angle), sin(angle) - scaled_t * cos(angle)),
+//which covers both involute flanks and the spacing arc
+template<typename ScalarType>
+struct TGearProfileLanes
+{
+	TArray<ScalarType> angle;
+	TArray<ScalarType> scaled_t;
+	TArray<ScalarType> radius;
+	TArray<ScalarType> center_x;
+	TArray<ScalarType> center_z;
+	//Half width of the point, the top vertex is at +y and the bottom one at -y
+	TArray<ScalarType> y;
+
+	TArray<ScalarType> x;
+	TArray<ScalarType> z;
+	//Inverse length of the top and bottom vertex, they only differ in the sign of y
+	TArray<ScalarType> inv_length;
+
+	void SetNum(int32 num)
+	{
+		for (auto lane : { &angle, &scaled_t, &radius, &center_x, &center_z, &y, &x, &z, &inv_length }) {
+			lane->SetNumUninitialized(num, false);
+		}
+	}
+};
+
+//Working buffers of the kernel, reused by every build on the same thread
+struct FGearScratch
+{
+	TArray<FVector> template_verts;
+	TArray<FVector> template_normals;
+	TArray<int> tooth_indices;
+	TGearProfileLanes<float> float_lanes;
+	TGearProfileLanes<double> double_lanes;
+};
+
+static thread_local FGearScratch scratch;
+
+//Step of the spacing arc whose triangles bridge from the ring point of the tooth to the one of the next tooth.
+//Steps before it fan out from the first ring point and steps after it from the next one
+static unsigned int getMiddleSpacingStep(unsigned int spacing_steps)
+{
+	return FMath::Min(spacing_steps / 2, spacing_steps - 2);
+}
+
+//Mirrors the tooth triangle loop in generateGear
+static int32 countToothIndices(unsigned int involute_steps, unsigned int spacing_steps)
+{
+	int32 count = 6;
+	for (unsigned int involute_step = 0; involute_step + 1 < involute_steps; involute_step++) {
+		count += 24;
+		if (involute_step == involute_steps - 2) {
+			count += 6;
+		}
+	}
+	const auto middle_step = getMiddleSpacingStep(spacing_steps);
+	for (unsigned int spacing_step = 0; spacing_step + 1 < spacing_steps; spacing_step++) {
+		count += 6;
+		if (spacing_step < middle_step) {
+			count += 6;
+		}
+		else if (spacing_step == middle_step) {
+			count += 12;
+		}
+		else {
+			count += 6;
+		}
+		if (spacing_step == spacing_steps - 2) {
+			count += 24;
+		}
+	}
+	return count;
+}
+
+static FORCEINLINE VectorRegister4Float splatRegister(float value)
+{
+	return MakeVectorRegisterFloat(value, value, value, value);
+}
+
+static FORCEINLINE VectorRegister4Double splatRegister(double value)
+{
+	return MakeVectorRegisterDouble(value, value, value, value);
+}
+
+//Evaluates all profile points, four at a time
+template<typename ScalarType, typename RegisterType>
+static void evaluateProfile(TGearProfileLanes<ScalarType>& lanes)
+{
+	for (int32 point = 0; point < lanes.angle.Num(); point += 4) {
+		auto angle = VectorLoad(lanes.angle.GetData() + point);
+		auto scaled_t = VectorLoad(lanes.scaled_t.GetData() + point);
+		auto radius = VectorLoad(lanes.radius.GetData() + point);
+		auto y = VectorLoad(lanes.y.GetData() + point);
+
+		RegisterType sin_angle;
+		RegisterType cos_angle;
+		VectorSinCos(&sin_angle, &cos_angle, &angle);
+
+		auto x = VectorMultiplyAdd(radius, VectorMultiplyAdd(scaled_t, sin_angle, cos_angle), VectorLoad(lanes.center_x.GetData() + point));
+		auto z = VectorMultiplyAdd(radius, VectorNegateMultiplyAdd(scaled_t, cos_angle, sin_angle), VectorLoad(lanes.center_z.GetData() + point));
+		auto length = VectorSqrt(VectorMultiplyAdd(x, x, VectorMultiplyAdd(z, z, VectorMultiply(y, y))));
+
+		VectorStore(x, lanes.x.GetData() + point);
+		VectorStore(z, lanes.z.GetData() + point);
+		VectorStore(VectorDivide(splatRegister(ScalarType(1)), length), lanes.inv_length.GetData() + point);
+	}
+}
+
+//Writes the profile rotated by every tooth offset, four profile points at a time
+template<typename ScalarType, typename RegisterType>
+static void rotateProfile(const TGearProfileLanes<ScalarType>& lanes, unsigned int tooth_segments, unsigned int number_of_teeth, FVector* tooth_verts, FVector* tooth_normals)
+{
+	alignas(32) ScalarType rotated_x[4];
+	alignas(32) ScalarType rotated_z[4];
+	alignas(32) ScalarType normal_x[4];
+	alignas(32) ScalarType normal_z[4];
+
+	for (unsigned int current_tooth = 0; current_tooth < number_of_teeth; current_tooth++) {
+		auto offset = FMath::DegreesToRadians(current_tooth * (360.0 / number_of_teeth));
+		auto sin_offset = splatRegister(ScalarType(sin(offset)));
+		auto cos_offset = splatRegister(ScalarType(cos(offset)));
+
+		auto vert_data = tooth_verts + current_tooth * tooth_segments * 2;
+		auto normal_data = tooth_normals + current_tooth * tooth_segments * 2;
+		for (unsigned int point = 0; point < tooth_segments; point += 4) {
+			auto x = VectorLoad(lanes.x.GetData() + point);
+			auto z = VectorLoad(lanes.z.GetData() + point);
+			auto inv_length = VectorLoad(lanes.inv_length.GetData() + point);
+
+			auto x_rotated = VectorNegateMultiplyAdd(z, sin_offset, VectorMultiply(x, cos_offset));
+			auto z_rotated = VectorMultiplyAdd(z, cos_offset, VectorMultiply(x, sin_offset));
+			VectorStore(x_rotated, rotated_x);
+			VectorStore(z_rotated, rotated_z);
+			VectorStore(VectorMultiply(x_rotated, inv_length), normal_x);
+			VectorStore(VectorMultiply(z_rotated, inv_length), normal_z);
+
+			//Top and bottom vertices are interleaved in the mesh
+			auto lane_count = FMath::Min(4u, tooth_segments - point);
+			for (unsigned int lane = 0; lane < lane_count; lane++) {
+				auto y = lanes.y[point + lane];
+				auto normal_y = y * lanes.inv_length[point + lane];
+				vert_data[(point + lane) * 2] = FVector(rotated_x[lane], y, rotated_z[lane]);
+				vert_data[(point + lane) * 2 + 1] = FVector(rotated_x[lane], -y, rotated_z[lane]);
+				normal_data[(point + lane) * 2] = FVector(normal_x[lane], normal_y, normal_z[lane]);
+				normal_data[(point + lane) * 2 + 1] = FVector(normal_x[lane], -normal_y, normal_z[lane]);
+			}
+		}
+	}
+}
+
+FGearDimensions GearGeometry::computeDimensions(const FGearParams& params)
+{
+	const auto number_of_teeth = params.number_of_teeth;
+	const auto module = FUnitConversion::Convert<float>(params.module, EUnit::Millimeters, EUnit::Centimeters);
+	const auto profile_shift = FUnitConversion::Convert<float>(params.profile_shift, EUnit::Millimeters, EUnit::Centimeters);
+	const auto ref_diameter = FUnitConversion::Convert<float>(params.module * number_of_teeth, EUnit::Millimeters, EUnit::Centimeters);
+	const auto base_diameter = FUnitConversion::Convert<float>(params.module * number_of_teeth * cos(params.pressure_angle * PI / 180.0), EUnit::Millimeters, EUnit::Centimeters);
+
+	auto base_radius = base_diameter / 2.0;
+	auto tip_diameter = ref_diameter + 2 * module * (1 + profile_shift);
+	auto tip_radius = tip_diameter / 2.0;
+	auto u = sqrt((pow(tip_radius, 2) / pow(base_radius, 2)) - 1);
+	auto tip_pressure_angle = acos(base_diameter / tip_diameter) * 180.0 / PI;
+	auto inv_alpha = tan(params.pressure_angle * PI / 180.0) - params.pressure_angle * PI / 180.0;
+	auto inv_alpha_a = tan(tip_pressure_angle * PI / 180.0) - tip_pressure_angle * PI / 180.0;
+	auto top_thickness = PI / (2.0 * number_of_teeth) + inv_alpha - inv_alpha_a;
+	auto end_x = base_radius * (cos(u) + u * sin(u));
+	auto end_y = base_radius * (sin(u) - u * cos(u));
+	auto distance = sqrt(pow(base_radius - end_x, 2) + pow(end_y, 2));
+	auto cosx = (pow(base_radius, 2) + pow(tip_radius, 2) - pow(distance, 2)) / 2.0 / base_radius / tip_radius;
+	auto tooth_thickness_rad = 2.0 * top_thickness + 2.0 * acos(cosx);
+	auto spacing_arc_length = FMath::DegreesToRadians(360.0 / number_of_teeth) - tooth_thickness_rad;
+
+	FGearDimensions dimensions;
+	dimensions.module = module;
+	dimensions.width = FUnitConversion::Convert<float>(params.width, EUnit::Millimeters, EUnit::Centimeters);
+	dimensions.profile_shift = profile_shift;
+	dimensions.ref_diameter = ref_diameter;
+	dimensions.base_diameter = base_diameter;
+	dimensions.base_radius = base_radius;
+	dimensions.tip_diameter = tip_diameter;
+	dimensions.tip_radius = tip_radius;
+	dimensions.u = u;
+	dimensions.inv_alpha = inv_alpha;
+	dimensions.tooth_thickness_rad = tooth_thickness_rad;
+	dimensions.spacing_arc_length = spacing_arc_length;
+
+	//The spacing arc is centered on the base circle halfway between two teeth and dips below it.
+	//Its radius is the chord to either end of the arc
+	dimensions.root_radius = base_radius - 2.0 * base_radius * abs(sin(spacing_arc_length / 4.0));
+	return dimensions;
+}
+
+static unsigned int getCenterRings(const FGearParams& params)
+{
+	return params.lod > 0 ? 1 : CENTER_RINGS;
+}
+
+static bool isSilhouette(const FGearParams& params)
+{
+	return params.lod == LOD_COUNT - 1;
+}
+
+static unsigned int getSpacingSteps(const FGearParams& params)
+{
+	return params.spacing_steps > 0 ? params.spacing_steps : params.involute_steps;
+}
+
+//Involute parameter of a flank sample, counted from the base circle. The last sample is on the tip circle.
+//Even spacing is densest in deviation at the tip, where the flank is flattest. The chordal deviation of an
+//involute edge grows with the base radius times t * dt^2, so adaptive spacing is even in t^(3/2) instead
+static double getFlankParameter(const FGearDimensions& dimensions, unsigned int involute_steps, unsigned int sample, bool adaptive_spacing)
+{
+	auto fraction = (sample + 0.5) / (involute_steps - 0.5);
+	return dimensions.u * (adaptive_spacing ? FMath::Pow(fraction, 2.0 / 3.0) : fraction);
+}
+
+FGearMeshSizes GearGeometry::computeSizes(const FGearParams& params)
+{
+	const int32 number_of_teeth = params.number_of_teeth;
+	const int32 involute_steps = params.involute_steps;
+	const int32 spacing_steps = getSpacingSteps(params);
+	const int32 tooth_verts = (involute_steps * 2 + spacing_steps) * 2;
+	const int32 center_rings = getCenterRings(params);
+
+	FGearMeshSizes sizes;
+	if (isSilhouette(params)) {
+		const int32 outline_points = number_of_teeth * SILHOUETTE_POINTS_PER_TOOTH;
+		sizes.verts = 2 + outline_points * 2;
+		sizes.indices = outline_points * 12;
+		return sizes;
+	}
+
+	sizes.verts = 2 + center_rings * number_of_teeth * 2 + number_of_teeth * tooth_verts;
+	sizes.indices = number_of_teeth * 6 + (center_rings - 1) * number_of_teeth * 12 + number_of_teeth * countToothIndices(involute_steps, spacing_steps);
+
+	const int32 cylinder_verts = COLLISION_CIRCLE_SEGMENTS * 2;
+	const int32 tooth_hull_verts = number_of_teeth * (involute_steps * 4 + 2);
+	switch (params.collision_mode) {
+	case EGearCollisionMode::Hub:
+	case EGearCollisionMode::TipCircle:
+		sizes.collision_shapes = 1;
+		sizes.collision_verts = cylinder_verts;
+		break;
+	case EGearCollisionMode::PerTooth:
+		sizes.collision_shapes = number_of_teeth;
+		sizes.collision_verts = tooth_hull_verts;
+		break;
+	case EGearCollisionMode::MeshingWindow:
+		sizes.collision_shapes = number_of_teeth + 1;
+		sizes.collision_verts = tooth_hull_verts + cylinder_verts;
+		break;
+	default:
+		break;
+	}
+	return sizes;
+}
+
+int32 GearGeometry::getToothHullCount(const FGearParams& params)
+{
+	auto uses_tooth_hulls = params.collision_mode == EGearCollisionMode::PerTooth || params.collision_mode == EGearCollisionMode::MeshingWindow;
+	return uses_tooth_hulls ? int32(params.number_of_teeth) : 0;
+}
+
+double GearGeometry::getToothAngle(const FGearParams& params, int32 tooth)
+{
+	//Same offset the kernel rotates the tooth profile by
+	return FMath::DegreesToRadians(tooth * (360.0 / params.number_of_teeth));
+}
+
+double GearGeometry::getToothCenterAngle(const FGearDimensions& dimensions)
+{
+	//The first tooth starts on the X axis and spans the tooth thickness on the base circle
+	return dimensions.tooth_thickness_rad / 2.0;
+}
+
+FGearParams GearGeometry::getLODParams(const FGearParams& params, int32 lod)
+{
+	auto lod_params = params;
+	lod_params.lod = uint8(lod);
+	if (lod > 0) {
+		lod_params.collision_mode = EGearCollisionMode::None;
+		lod_params.involute_steps = lod == LOD_COUNT - 1 ? MIN_INVOLUTE_STEPS : FMath::Max(params.involute_steps >> lod, MIN_INVOLUTE_STEPS);
+		lod_params.spacing_steps = lod == LOD_COUNT - 1 || params.spacing_steps == 0 ? 0 : FMath::Max(params.spacing_steps >> lod, MIN_INVOLUTE_STEPS);
+	}
+	return lod_params;
+}
+
+//Points of each curve tested against the edge drawing it
+static constexpr int32 CHORDAL_ERROR_SAMPLES = 16;
+
+//Chordal errors in cm of the curves of a tooth
+struct FGearChordalErrors
+{
+	double flank = 0.0;
+	double spacing = 0.0;
+	//The edge from the last spacing arc sample to the first flank sample cuts the corner on the base circle
+	double corner = 0.0;
+	//Distance of both ends of that edge from the corner
+	double corner_flank_length = 0.0;
+	double corner_spacing_length = 0.0;
+
+	double getMax() const
+	{
+		return FMath::Max(flank, FMath::Max(spacing, corner));
+	}
+};
+
+static FGearChordalErrors measureChordalErrors(const FGearParams& params)
+{
+	const auto dimensions = computeDimensions(params);
+	const auto involute_steps = params.involute_steps;
+	const auto spacing_steps = getSpacingSteps(params);
+	const auto base_radius = dimensions.base_radius;
+	const auto tooth_thickness = dimensions.tooth_thickness_rad;
+	const auto spacing_arc_length = dimensions.spacing_arc_length;
+
+	//Falling flank of the first tooth, it starts on the base circle at the tooth thickness
+	auto flank = [&](double t) {
+		return FVector(base_radius * (cos(tooth_thickness - t) - t * sin(tooth_thickness - t)), 0.0, base_radius * (sin(tooth_thickness - t) + t * cos(tooth_thickness - t)));
+	};
+
+	//Spacing arc after it, from the end of the flank around its center on the base circle, dipping towards the
+	//gear center. Point spacing_steps + 1 is where the next tooth starts
+	const auto center_angle = tooth_thickness + spacing_arc_length / 2.0;
+	const FVector center(base_radius * cos(center_angle), 0.0, base_radius * sin(center_angle));
+	const auto corner = flank(0.0);
+	const auto arc_radius = dimensions.base_radius - dimensions.root_radius;
+	const auto arc_start = atan2(corner.Z - center.Z, corner.X - center.X);
+	const auto arc_direction = FMath::Sign(FMath::UnwindRadians(atan2(-center.Z, -center.X) - arc_start));
+	const auto arc_step = (PI - spacing_arc_length / 2.0) / (spacing_steps + 1.0);
+	auto arc = [&](double k) {
+		auto angle = arc_start + arc_direction * arc_step * k;
+		return FVector(center.X + arc_radius * cos(angle), 0.0, center.Z + arc_radius * sin(angle));
+	};
+
+	//Largest distance of a curve from the edge between two points of the mesh
+	auto measure = [](double& error, const FVector& start, const FVector& end, const auto& curve, double from, double to) {
+		for (int32 sample = 1; sample < CHORDAL_ERROR_SAMPLES; sample++) {
+			auto point = curve(FMath::Lerp(from, to, double(sample) / CHORDAL_ERROR_SAMPLES));
+			error = FMath::Max(error, FMath::PointDistToSegment(point, start, end));
+		}
+	};
+
+	//Both flanks and both ends of the arc are mirror images, so one of each is enough
+	FGearChordalErrors errors;
+	for (unsigned int sample = 0; sample + 1 < involute_steps; sample++) {
+		auto t = getFlankParameter(dimensions, involute_steps, sample, params.adaptive_spacing);
+		auto next_t = getFlankParameter(dimensions, involute_steps, sample + 1, params.adaptive_spacing);
+		measure(errors.flank, flank(t), flank(next_t), flank, t, next_t);
+	}
+	for (unsigned int sample = 1; sample < spacing_steps; sample++) {
+		measure(errors.spacing, arc(sample), arc(sample + 1.0), arc, sample, sample + 1.0);
+	}
+
+	auto first_t = getFlankParameter(dimensions, involute_steps, 0, params.adaptive_spacing);
+	measure(errors.corner, flank(first_t), arc(1.0), flank, first_t, 0.0);
+	measure(errors.corner, flank(first_t), arc(1.0), arc, 0.0, 1.0);
+	errors.corner_flank_length = FVector::Dist(flank(first_t), corner);
+	errors.corner_spacing_length = FVector::Dist(arc(1.0), corner);
+	return errors;
+}
+
+double GearGeometry::computeChordalError(const FGearParams& params)
+{
+	return FUnitConversion::Convert(measureChordalErrors(params).getMax(), EUnit::Centimeters, EUnit::Millimeters);
+}
+
+void GearGeometry::setChordalError(FGearParams& params, double max_chordal_error)
+{
+	params.adaptive_spacing = true;
+	const auto dimensions = computeDimensions(params);
+	const auto max_error = FUnitConversion::Convert(FMath::Max(max_chordal_error, 0.0), EUnit::Millimeters, EUnit::Centimeters);
+
+	//Start from the counts where an even t^(3/2) spacing of the flank and an even spacing of the arc meet the error
+	auto arc_radius = dimensions.base_radius - dimensions.root_radius;
+	auto flank_estimate = 0.5 + sqrt(dimensions.base_radius * FMath::Pow(dimensions.u, 3.0) / (18.0 * max_error));
+	auto spacing_estimate = (PI - dimensions.spacing_arc_length / 2.0) / (2.0 * acos(FMath::Max(1.0 - max_error / arc_radius, -1.0))) - 1.0;
+	params.involute_steps = uint32(FMath::Clamp(FMath::CeilToDouble(flank_estimate), double(MIN_INVOLUTE_STEPS), double(MAX_INVOLUTE_STEPS)));
+	params.spacing_steps = uint32(FMath::Clamp(FMath::CeilToDouble(spacing_estimate), double(MIN_INVOLUTE_STEPS), double(MAX_INVOLUTE_STEPS)));
+
+	//Walk each count to the fewest samples that meet the error. The corner edge shrinks with whichever curve
+	//reaches furthest into it. A curve at the cap leaves the other one refining until every curve over the error is
+	//at the cap too
+	auto errors = measureChordalErrors(params);
+	while (errors.getMax() > max_error) {
+		auto flank_first = errors.flank > max_error || (errors.corner > max_error && errors.spacing <= max_error && errors.corner_flank_length >= errors.corner_spacing_length);
+		auto refine_flank = params.involute_steps < MAX_INVOLUTE_STEPS && (errors.flank > max_error || errors.corner > max_error);
+		auto refine_spacing = params.spacing_steps < MAX_INVOLUTE_STEPS && (errors.spacing > max_error || errors.corner > max_error);
+		if (refine_flank && (flank_first || !refine_spacing)) {
+			params.involute_steps++;
+		}
+		else if (refine_spacing) {
+			params.spacing_steps++;
+		}
+		else {
+			break;
+		}
+		errors = measureChordalErrors(params);
+	}
+	for (auto steps : { &params.involute_steps, &params.spacing_steps }) {
+		while (*steps > MIN_INVOLUTE_STEPS) {
+			(*steps)--;
+			if (measureChordalErrors(params).getMax() > max_error) {
+				(*steps)++;
+				break;
+			}
+		}
+	}
+}
+
+FString GearGeometry::makeKey(const FGearParams& params)
+{
+	return FString::Printf(TEXT("%08X_%u_%08X_%08X_%08X_%u_%u_%u_%u_%u"),
+		FMath::AsUInt(params.module), params.number_of_teeth, FMath::AsUInt(params.width), FMath::AsUInt(params.profile_shift),
+		FMath::AsUInt(params.pressure_angle), params.involute_steps, uint32(params.adaptive_spacing), params.spacing_steps,
+		uint32(params.collision_mode), uint32(params.lod));
+}
+
+EGearKernelPath GearGeometry::getKernelPath()
+{
+	return EGearKernelPath(FMath::Clamp(CVarGearKernelPath.GetValueOnAnyThread(), 0, int32(EGearKernelPath::VectorDouble)));
+}
+
+void GearGeometry::generateGear(const FGearParams& params, FGearMeshData& out)
+{
+	generateGear(params, out, getKernelPath());
+}
+
+//Fills the profile lanes with the same points as the scalar loop in generateGear
+template<typename ScalarType>
+static void setupProfile(TGearProfileLanes<ScalarType>& lanes, const FGearDimensions& dimensions, unsigned int involute_steps, unsigned int spacing_steps,
+	bool adaptive_spacing, double spacing_circle_start, double spacing_circle_step, double spacing_circle_radius, const FVector2D& spacing_center_coord)
+{
+	const auto tooth_segments = involute_steps * 2 + spacing_steps;
+	lanes.SetNum(Align(tooth_segments, 4));
+
+	const auto involute_scale = dimensions.u * (1.0 + (0.5 / (involute_steps - 0.5))) / PI;
+	const auto max_width = dimensions.width / 2.0;
+	for (unsigned int segment = 0; segment < uint32(lanes.angle.Num()); segment++) {
+		//Padding repeats the last point so it stays finite
+		auto profile_segment = FMath::Min(segment, tooth_segments - 1);
+		if (profile_segment < involute_steps * 2) {
+			//acos(cos(a)) of the scalar loop folds a back into [0, PI]
+			auto folded = (profile_segment + 0.5) * PI / involute_steps;
+			auto rising = profile_segment < involute_steps;
+			auto t = adaptive_spacing
+				? getFlankParameter(dimensions, involute_steps, rising ? profile_segment : involute_steps * 2 - 1 - profile_segment, true)
+				: involute_scale * (folded <= PI ? folded : 2.0 * PI - folded);
+			lanes.angle[segment] = rising ? t : dimensions.tooth_thickness_rad - t;
+			lanes.scaled_t[segment] = rising ? t : -t;
+			lanes.radius[segment] = dimensions.base_radius;
+			lanes.center_x[segment] = 0;
+			lanes.center_z[segment] = 0;
+		}
+		else {
+			lanes.angle[segment] = spacing_circle_start - spacing_circle_step * (profile_segment - involute_steps * 2 + 1);
+			lanes.scaled_t[segment] = 0;
+			lanes.radius[segment] = spacing_circle_radius;
+			lanes.center_x[segment] = spacing_center_coord.X;
+			lanes.center_z[segment] = spacing_center_coord.Y;
+		}
+
+		//The tip of the tooth is slightly thinner
+		auto tip_scale = (profile_segment == (involute_steps - 1) || profile_segment == involute_steps) ? .8 : 1.0;
+		lanes.y[segment] = max_width * tip_scale;
+	}
+}
+
+template<typename ScalarType>
+static void copyProfile(const TGearProfileLanes<ScalarType>& lanes, unsigned int tooth_segments, TArray<FVector>& template_verts, TArray<FVector>& template_normals)
+{
+	for (unsigned int segment = 0; segment < tooth_segments; segment++) {
+		auto inv_length = lanes.inv_length[segment];
+		template_verts[segment * 2] = FVector(lanes.x[segment], lanes.y[segment], lanes.z[segment]);
+		template_verts[segment * 2 + 1] = FVector(lanes.x[segment], -lanes.y[segment], lanes.z[segment]);
+		template_normals[segment * 2] = FVector(lanes.x[segment] * inv_length, lanes.y[segment] * inv_length, lanes.z[segment] * inv_length);
+		template_normals[segment * 2 + 1] = FVector(lanes.x[segment] * inv_length, -lanes.y[segment] * inv_length, lanes.z[segment] * inv_length);
+	}
+}
+
+//Convex hulls of the collision mode. The tooth hulls are taken from the teeth in out.verts
+static void addCollision(const FGearParams& params, const FGearDimensions& dimensions, FGearMeshData& out)
+{
+	const auto& verts = out.verts;
+	auto& collision_verts = out.collision_verts;
+	auto& collision_offsets = out.collision_offsets;
+
+	const auto sizes = computeSizes(params);
+	collision_verts.Reset(sizes.collision_verts);
+	collision_offsets.Reset(sizes.collision_shapes + 1);
+	collision_offsets.Add(0);
+
+	const auto number_of_teeth = params.number_of_teeth;
+	const auto involute_steps = params.involute_steps;
+	const auto tooth_verts = (involute_steps * 2 + getSpacingSteps(params)) * 2;
+	const int32 first_tooth_vert = 2 + getCenterRings(params) * number_of_teeth * 2;
+	const auto max_width = dimensions.width / 2.0;
+	const auto min_width = dimensions.width / -2.0;
+
+	//Prism around the rotation axis, used for the hub and tip circle collision
+	auto addCylinder = [&](double radius) {
+		for (unsigned int segment = 0; segment < COLLISION_CIRCLE_SEGMENTS; segment++) {
+			auto radian = 2.0 * PI * segment / COLLISION_CIRCLE_SEGMENTS;
+			collision_verts.Add(FVector(radius * cos(radian), max_width, radius * sin(radian)));
+			collision_verts.Add(FVector(radius * cos(radian), min_width, radius * sin(radian)));
+		}
+		collision_offsets.Add(collision_verts.Num());
+	};
+
+	auto root_radius = dimensions.root_radius;
+	auto tip_radius = dimensions.tip_radius;
+	auto collision_mode = params.collision_mode;
+
+	if (collision_mode == EGearCollisionMode::Hub) {
+		addCylinder(root_radius);
+	}
+	else if (collision_mode == EGearCollisionMode::TipCircle) {
+		addCylinder(tip_radius);
+	}
+	//One hull per tooth made from both flanks and the end of the spacing arc before the tooth, which wraps around
+	//for the first one. Every hull is the first one rotated by the tooth offset, so the hull can be cooked once.
+	//Tooth hulls come first so their shape index is the tooth index
+	else if (collision_mode == EGearCollisionMode::PerTooth || collision_mode == EGearCollisionMode::MeshingWindow) {
+		for (unsigned int current_tooth = 0; current_tooth < number_of_teeth; current_tooth++) {
+			auto previous_tooth = (current_tooth > 0 ? current_tooth : number_of_teeth) - 1;
+			const auto& arc_end_vert = verts[first_tooth_vert + previous_tooth * tooth_verts + tooth_verts - 2];
+			collision_verts.Add(FVector{ arc_end_vert.X, max_width, arc_end_vert.Z });
+			collision_verts.Add(FVector{ arc_end_vert.X, min_width, arc_end_vert.Z });
+
+			auto tooth = first_tooth_vert + current_tooth * tooth_verts;
+			for (unsigned int segment = 0; segment < involute_steps * 2; segment++) {
+				const auto& top_vert = verts[tooth + segment * 2];
+				collision_verts.Add(FVector{ top_vert.X, max_width, top_vert.Z });
+				collision_verts.Add(FVector{ top_vert.X, min_width, top_vert.Z });
+			}
+			collision_offsets.Add(collision_verts.Num());
+		}
+
+		if (collision_mode == EGearCollisionMode::MeshingWindow) {
+			addCylinder(root_radius);
+		}
+	}
+}
+
+//Prism over the outline of the teeth, for gears too far away to show their flanks
+static void generateSilhouette(const FGearParams& params, FGearMeshData& out)
+{
+	auto& verts = out.verts;
+	auto& indices = out.indices;
+	auto& normals = out.normals;
+
+	const auto sizes = computeSizes(params);
+	verts.Reset(sizes.verts);
+	normals.Reset(sizes.verts);
+	indices.Reset(sizes.indices);
+	out.collision_verts.Reset();
+	out.collision_offsets.Reset();
+	out.collision_offsets.Add(0);
+
+	const auto dimensions = computeDimensions(params);
+	const auto max_width = dimensions.width / 2.0;
+	const auto min_width = dimensions.width / -2.0;
+
+	//Polar angle of the involute at the tip circle, the flanks in generateGear start at 0 and end at the tooth thickness
+	const auto tip_angle = dimensions.u - atan(dimensions.u);
+	const double point_radius[SILHOUETTE_POINTS_PER_TOOTH] = {
+		dimensions.base_radius, dimensions.tip_radius, dimensions.tip_radius, dimensions.base_radius, dimensions.root_radius };
+	const double point_angle[SILHOUETTE_POINTS_PER_TOOTH] = {
+		0.0, tip_angle, dimensions.tooth_thickness_rad - tip_angle, dimensions.tooth_thickness_rad,
+		dimensions.tooth_thickness_rad + dimensions.spacing_arc_length / 2.0 };
+
+	//Same layout as generateGear, the two centers and then top and bottom vertices interleaved
+	verts.Add(FVector(0, max_width, 0));
+	verts.Add(FVector(0, min_width, 0));
+	for (unsigned int tooth = 0; tooth < params.number_of_teeth; tooth++) {
+		auto offset = FMath::DegreesToRadians(tooth * (360.0 / params.number_of_teeth));
+		for (unsigned int point = 0; point < SILHOUETTE_POINTS_PER_TOOTH; point++) {
+			auto x = point_radius[point] * cos(point_angle[point] + offset);
+			auto z = point_radius[point] * sin(point_angle[point] + offset);
+			verts.Add(FVector(x, max_width, z));
+			verts.Add(FVector(x, min_width, z));
+		}
+	}
+	for (const auto& vert : verts) {
+		normals.Add(vert.GetSafeNormal());
+	}
+
+	const int32 outline_points = params.number_of_teeth * SILHOUETTE_POINTS_PER_TOOTH;
+	double area = 0.0;
+	double polar_moment = 0.0;
+	for (int32 point = 0; point < outline_points; point++) {
+		int32 top = 2 + point * 2;
+		int32 next_top = 2 + (point + 1) % outline_points * 2;
+
+		//The outline is star shaped around the center, so the caps are fans
+		indices.Add(0);
+		indices.Add(top);
+		indices.Add(next_top);
+
+		indices.Add(1);
+		indices.Add(next_top + 1);
+		indices.Add(top + 1);
+
+		indices.Add(top);
+		indices.Add(top + 1);
+		indices.Add(next_top);
+
+		indices.Add(next_top);
+		indices.Add(top + 1);
+		indices.Add(next_top + 1);
+
+		const auto& a = verts[top];
+		const auto& b = verts[next_top];
+		auto cross = a.X * b.Z - b.X * a.Z;
+		area += cross / 2.0;
+		polar_moment += cross * (a.X * a.X + a.X * b.X + b.X * b.X + a.Z * a.Z + a.Z * b.Z + b.Z * b.Z) / 12.0;
+	}
+	out.profile_area = abs(area);
+	out.profile_polar_moment = abs(polar_moment);
+}
+
+void GearGeometry::generateGear(const FGearParams& params, FGearMeshData& out, EGearKernelPath path)
+{
+	if (isSilhouette(params)) {
+		generateSilhouette(params, out);
+		return;
+	}
+
+	auto& verts = out.verts;
+	auto& indices = out.indices;
+	auto& normals = out.normals;
+
+	//Reset keeps the allocations, so nothing is allocated once the buffers are big enough
+	const auto sizes = computeSizes(params);
+	verts.Reset(sizes.verts);
+	normals.Reset(sizes.verts);
+	indices.Reset(sizes.indices);
+
+	const auto number_of_teeth = params.number_of_teeth;
+	const auto involute_steps = params.involute_steps;
+	const auto spacing_steps = getSpacingSteps(params);
+	const auto dimensions = computeDimensions(params);
+	const auto width = dimensions.width;
+	const auto base_radius = dimensions.base_radius;
+	const auto u = dimensions.u;
+	const auto tooth_thickness_rad = dimensions.tooth_thickness_rad;
+	const auto spacing_arc_length = dimensions.spacing_arc_length;
+
+	auto max_width = width / 2.0;
+	auto min_width = width / -2.0;
+
+	//Create Center of Gear
+	//Add Top center vertice
+	auto vert = FVector(0, max_width, 0);
+	verts.Add(vert);
+	normals.Add(vert.GetSafeNormal());
+
+	//Add bottom center vertice
+	vert = FVector(0, min_width, 0);
+	verts.Add(vert);
+	normals.Add(vert.GetSafeNormal());
+
+	auto center_radial_segments = number_of_teeth;
+	const auto center_rings = getCenterRings(params);
+	for (unsigned int ring = 0; ring < center_rings; ring++) {
+		auto ring_radius = float(ring + 1.0) / float(center_rings + 1.0) * base_radius;
+		for (unsigned int segment = 0; segment < center_radial_segments; segment++) {
+			auto radian = 2.0 * PI * (segment / float(center_radial_segments));
+			auto x = ring_radius * cos(radian);
+			auto z = ring_radius * sin(radian);
+
+			//Top ring
+			vert = FVector(x, max_width, z);
+			verts.Add(vert);
+			normals.Add(vert.GetSafeNormal());
+
+			//Bottom ring
+			vert = FVector(x, min_width, z);
+			verts.Add(vert);
+			normals.Add(vert.GetSafeNormal());
+
+			if (segment > 0) {
+				auto current_point = segment * 2 + 2;
+				if (ring == 0) {
+					//Add Top triangle around center point
+					indices.Add(0);
+					indices.Add(current_point - 2);
+					indices.Add(current_point);
+
+					//Add bottom trianlge around center point
+					indices.Add(1);
+					indices.Add(current_point + 1);
+					indices.Add(current_point - 1);
+				}
+				else {
+					//Connect Top rings
+					indices.Add(center_radial_segments * (ring - 1) * 2 + (current_point - 2));
+					indices.Add(center_radial_segments * ring * 2 + (current_point - 2));
+					indices.Add(center_radial_segments * (ring - 1) * 2 + current_point);
+
+					indices.Add(center_radial_segments * (ring - 1) * 2 + current_point);
+					indices.Add(center_radial_segments * ring * 2 + (current_point - 2));
+					indices.Add(center_radial_segments * ring * 2 + current_point);
+
+					//Connect Bottom rings
+					indices.Add(center_radial_segments * (ring - 1) * 2 + (current_point - 1));
+					indices.Add(center_radial_segments * (ring - 1) * 2 + (current_point + 1));
+					indices.Add(center_radial_segments * ring * 2 + (current_point - 1));
+
+					indices.Add(center_radial_segments * (ring - 1) * 2 + (current_point + 1));
+					indices.Add(center_radial_segments * ring * 2 + (current_point + 1));
+					indices.Add(center_radial_segments * ring * 2 + (current_point - 1));
+				}
+			}
+		}
+
+		//Complete the circle
+		auto last_vert = (ring + 1) * center_radial_segments * 2;
+		if (ring == 0) {
+			//Add top triangle around center point
+			indices.Add(0);
+			indices.Add(last_vert);
+			indices.Add(2);
+
+			//Add bottom triangle around center point
+			indices.Add(1);
+			indices.Add(3);
+			indices.Add(last_vert + 1);
+		}
+		else {
+			//Add top triangles connecting rings
+			indices.Add(center_radial_segments * ring * 2);
+			indices.Add(last_vert);
+			indices.Add(center_radial_segments * (ring - 1) * 2 + 2);
+
+			indices.Add(center_radial_segments * (ring - 1) * 2 + 2);
+			indices.Add(last_vert);
+			indices.Add(center_radial_segments * ring * 2 + 2);
+
+			//Add bottom triangles connecting rings
+			indices.Add(center_radial_segments * ring * 2 + 1);
+			indices.Add(center_radial_segments * (ring - 1) * 2 + 3);
+			indices.Add(last_vert + 1);
+
+			indices.Add(center_radial_segments * (ring - 1) * 2 + 3);
+			indices.Add(center_radial_segments * ring * 2 + 3);
+			indices.Add(last_vert + 1);
+		}
+	}
+
+	//Every tooth is the same profile rotated by its offset, so the profile and its triangles are only built once
+	const auto tooth_segments = involute_steps * 2 + spacing_steps;
+	const auto tooth_verts = tooth_segments * 2;
+
+	//Spacing arc between the tooth and the next one
+	auto spacing_arc_start_rad = tooth_thickness_rad;
+	auto spacing_arc_start_coord = FVector2D(base_radius * cos(spacing_arc_start_rad), base_radius * sin(spacing_arc_start_rad));
+	auto spacing_arc_end_rad = spacing_arc_start_rad + spacing_arc_length;
+	auto arc_end_coord = FVector2D(base_radius * cos(spacing_arc_end_rad), base_radius * sin(spacing_arc_end_rad));
+	auto spacing_center_rad = spacing_arc_start_rad + spacing_arc_length / 2.0;
+	auto spacing_center_coord = FVector2D(base_radius * cos(spacing_center_rad), base_radius * sin(spacing_center_rad));
+	auto spacing_circle_start_angle = atan2(abs(spacing_arc_start_coord.Y - spacing_center_coord.Y), abs(spacing_arc_start_coord.X - spacing_center_coord.X));
+	auto spacing_circle_end_angle = atan2(abs(arc_end_coord.Y - spacing_center_coord.Y), abs(arc_end_coord.X - spacing_center_coord.X));
+
+	double spacing_circle_start = spacing_circle_start_angle;
+	if (spacing_arc_start_coord.X > spacing_center_coord.X) {
+		if (spacing_arc_start_coord.Y < spacing_center_coord.Y) {
+			spacing_circle_start = 2 * PI - spacing_circle_start;
+		}
+	}
+	else {
+		if (spacing_arc_start_coord.Y > spacing_center_coord.Y) {
+			spacing_circle_start = PI - spacing_circle_start;
+		}
+		else {
+			spacing_circle_start += PI;
+		}
+	}
+
+	double spacing_circle_end = spacing_circle_end_angle;
+	if (arc_end_coord.X > spacing_center_coord.X) {
+		if (arc_end_coord.Y < spacing_center_coord.Y) {
+			spacing_circle_end = 2 * PI - spacing_circle_end;
+		}
+	}
+	else {
+		if (arc_end_coord.Y > spacing_center_coord.Y) {
+			spacing_circle_end = PI - spacing_circle_end;
+		}
+		else {
+			spacing_circle_end += PI;
+		}
+	}
+
+	if (spacing_circle_start < spacing_circle_end) {
+		spacing_circle_start += 2 * PI;
+	}
+
+	auto spacing_circle_radius = dimensions.base_radius - dimensions.root_radius;
+	auto spacing_circle_step = (spacing_circle_start - spacing_circle_end) / (spacing_steps + 1.0);
+
+	//Tooth profile at offset 0. Top and bottom vertices are interleaved like in the final buffer
+	auto& template_verts = scratch.template_verts;
+	auto& template_normals = scratch.template_normals;
+	template_verts.SetNumUninitialized(tooth_verts, false);
+	template_normals.SetNumUninitialized(tooth_verts, false);
+
+	if (path == EGearKernelPath::VectorFloat) {
+		setupProfile(scratch.float_lanes, dimensions, involute_steps, spacing_steps, params.adaptive_spacing, spacing_circle_start, spacing_circle_step, spacing_circle_radius, spacing_center_coord);
+		evaluateProfile<float, VectorRegister4Float>(scratch.float_lanes);
+		copyProfile(scratch.float_lanes, tooth_segments, template_verts, template_normals);
+	}
+	else if (path == EGearKernelPath::VectorDouble) {
+		setupProfile(scratch.double_lanes, dimensions, involute_steps, spacing_steps, params.adaptive_spacing, spacing_circle_start, spacing_circle_step, spacing_circle_radius, spacing_center_coord);
+		evaluateProfile<double, VectorRegister4Double>(scratch.double_lanes);
+		copyProfile(scratch.double_lanes, tooth_segments, template_verts, template_normals);
+	}
+	else {
+		for (unsigned int segment = 0; segment < tooth_segments; segment++) {
+			double x;
+			double z;
+
+			if (segment < involute_steps * 2) {
+				auto t = params.adaptive_spacing
+					? getFlankParameter(dimensions, involute_steps, segment < involute_steps ? segment : involute_steps * 2 - 1 - segment, true)
+					: u * (1.0 + (0.5 / (involute_steps - 0.5))) / PI * acos(cos((segment + 0.5) * PI / involute_steps));
+				if (segment < involute_steps) {
+					x = base_radius * (cos(t) + t * sin(t));
+					z = base_radius * (sin(t) - t * cos(t));
+				}
+				else {
+					x = base_radius * (cos(-t + tooth_thickness_rad) - t * sin(-t + tooth_thickness_rad));
+					z = base_radius * (sin(-t + tooth_thickness_rad) + t * cos(-t + tooth_thickness_rad));
+				}
+			}
+			else {
+				auto spacing_circle_radial = spacing_circle_start - spacing_circle_step * (segment - involute_steps * 2 + 1);
+				x = spacing_circle_radius * cos(spacing_circle_radial) + spacing_center_coord.X;
+				z = spacing_circle_radius * sin(spacing_circle_radial) + spacing_center_coord.Y;
+			}
+
+			//The tip of the tooth is slightly thinner
+			auto tip_scale = (segment == (involute_steps - 1) || segment == involute_steps) ? .8 : 1.0;
+
+			template_verts[segment * 2] = FVector(x, max_width * tip_scale, z);
+			template_verts[segment * 2 + 1] = FVector(x, min_width * tip_scale, z);
+			template_normals[segment * 2] = template_verts[segment * 2].GetSafeNormal();
+			template_normals[segment * 2 + 1] = template_verts[segment * 2 + 1].GetSafeNormal();
+		}
+	}
+
+	//Rotate the profile into place for every tooth
+	const auto first_tooth_vert = verts.Num();
+	verts.AddUninitialized(number_of_teeth * tooth_verts);
+	normals.AddUninitialized(number_of_teeth * tooth_verts);
+
+	if (path == EGearKernelPath::VectorFloat) {
+		rotateProfile<float, VectorRegister4Float>(scratch.float_lanes, tooth_segments, number_of_teeth, verts.GetData() + first_tooth_vert, normals.GetData() + first_tooth_vert);
+	}
+	else if (path == EGearKernelPath::VectorDouble) {
+		rotateProfile<double, VectorRegister4Double>(scratch.double_lanes, tooth_segments, number_of_teeth, verts.GetData() + first_tooth_vert, normals.GetData() + first_tooth_vert);
+	}
+	else {
+		for (unsigned int current_tooth = 0; current_tooth < number_of_teeth; current_tooth++) {
+			auto offset = FMath::DegreesToRadians(current_tooth * (360.0 / number_of_teeth));
+			auto sin_offset = sin(offset);
+			auto cos_offset = cos(offset);
+
+			auto tooth_vert_data = verts.GetData() + first_tooth_vert + current_tooth * tooth_verts;
+			auto tooth_normal_data = normals.GetData() + first_tooth_vert + current_tooth * tooth_verts;
+			for (unsigned int tooth_vert = 0; tooth_vert < tooth_verts; tooth_vert++) {
+				const auto& template_vert = template_verts[tooth_vert];
+				const auto& template_normal = template_normals[tooth_vert];
+				tooth_vert_data[tooth_vert] = FVector(
+					template_vert.X * cos_offset - template_vert.Z * sin_offset,
+					template_vert.Y,
+					template_vert.X * sin_offset + template_vert.Z * cos_offset);
+				tooth_normal_data[tooth_vert] = FVector(
+					template_normal.X * cos_offset - template_normal.Z * sin_offset,
+					template_normal.Y,
+					template_normal.X * sin_offset + template_normal.Z * cos_offset);
+			}
+		}
+	}
+
+	//Area and polar moment of the outline, integrated over one tooth pitch as triangles from the center
+	double pitch_area = 0.0;
+	double pitch_polar_moment = 0.0;
+	for (unsigned int segment = 0; segment < tooth_segments; segment++) {
+		const auto& a = template_verts[segment * 2];
+		auto b = segment + 1 < tooth_segments ? template_verts[segment * 2 + 2] : verts[first_tooth_vert + tooth_verts];
+		auto cross = a.X * b.Z - b.X * a.Z;
+		pitch_area += cross / 2.0;
+		pitch_polar_moment += cross * (a.X * a.X + a.X * b.X + b.X * b.X + a.Z * a.Z + a.Z * b.Z + b.Z * b.Z) / 12.0;
+	}
+	out.profile_area = abs(pitch_area) * number_of_teeth;
+	out.profile_polar_moment = abs(pitch_polar_moment) * number_of_teeth;
+
+	addCollision(params, dimensions, out);
+
+	//Triangles of the first tooth. They reach into the outer center ring and the first vertices of the next tooth
+	auto& tooth_indices = scratch.tooth_indices;
+	tooth_indices.Reset();
+	auto first_point = (center_rings - 1) * center_radial_segments * 2 + 2;
+	auto next_point = first_point + 2;
+	auto tooth_starting_point = first_tooth_vert;
+	auto tooth_end_point = tooth_starting_point + involute_steps * 4 - 2;
+	auto next_tooth = tooth_starting_point + tooth_verts;
+
+	//Top triangles
+	tooth_indices.Add(first_point);
+	tooth_indices.Add(tooth_starting_point);
+	tooth_indices.Add(tooth_end_point);
+
+	//Bottom triangles
+	tooth_indices.Add(first_point + 1);
+	tooth_indices.Add(tooth_end_point + 1);
+	tooth_indices.Add(tooth_starting_point + 1);
+
+	//The flanks and the spacing arc can have different sample counts, so each step only adds the triangles of
+	//the curves that still have samples left. The ends of each curve are connected after its last step
+	const auto max_steps = FMath::Max(involute_steps, spacing_steps);
+	const auto middle_spacing_step = getMiddleSpacingStep(spacing_steps);
+	for (unsigned int involute_step = 0; involute_step < (max_steps - 1); involute_step++) {
+		auto increment = involute_step * 2;
+
+		if (involute_step < (involute_steps - 1)) {
+			//Top Tooth Triangles
+			tooth_indices.Add(tooth_starting_point + increment);
+			tooth_indices.Add(tooth_starting_point + 2 + increment);
+			tooth_indices.Add(tooth_end_point - increment);
+
+			tooth_indices.Add(tooth_end_point - increment);
+			tooth_indices.Add(tooth_starting_point + 2 + increment);
+			tooth_indices.Add(tooth_end_point - 2 - increment);
+
+			//Bottom Tooth Triangles
+			tooth_indices.Add(tooth_starting_point + increment + 1);
+			tooth_indices.Add(tooth_end_point - increment + 1);
+			tooth_indices.Add(tooth_starting_point + 3 + increment);
+
+			tooth_indices.Add(tooth_end_point - increment + 1);
+			tooth_indices.Add(tooth_end_point - 1 - increment);
+			tooth_indices.Add(tooth_starting_point + 3 + increment);
+
+			//Connect Top and Bottom Teeth
+			tooth_indices.Add(tooth_starting_point + increment);
+			tooth_indices.Add(tooth_starting_point + increment + 1);
+			tooth_indices.Add(tooth_starting_point + increment + 2);
+
+			tooth_indices.Add(tooth_starting_point + increment + 2);
+			tooth_indices.Add(tooth_starting_point + increment + 1);
+			tooth_indices.Add(tooth_starting_point + increment + 3);
+
+			tooth_indices.Add(tooth_end_point - increment);
+			tooth_indices.Add(tooth_end_point - increment - 2);
+			tooth_indices.Add(tooth_end_point - increment + 1);
+
+			tooth_indices.Add(tooth_end_point - increment + 1);
+			tooth_indices.Add(tooth_end_point - increment - 2);
+			tooth_indices.Add(tooth_end_point - increment - 1);
+		}
+
+		if (involute_step < (spacing_steps - 1)) {
+			//Spacing Triangles
+			if (involute_step < middle_spacing_step) {
+				//Top
+				tooth_indices.Add(first_point);
+				tooth_indices.Add(tooth_end_point + (involute_step * 2));
+				tooth_indices.Add(tooth_end_point + (involute_step * 2) + 2);
+
+				//Bottom
+				tooth_indices.Add(first_point + 1);
+				tooth_indices.Add(tooth_end_point + (involute_step * 2) + 3);
+				tooth_indices.Add(tooth_end_point + (involute_step * 2) + 1);
+			}
+			else if (involute_step == middle_spacing_step) {
+				//Top
+				tooth_indices.Add(first_point);
+				tooth_indices.Add(tooth_end_point + (involute_step * 2));
+				tooth_indices.Add(next_point);
+
+				tooth_indices.Add(next_point);
+				tooth_indices.Add(tooth_end_point + (involute_step * 2));
+				tooth_indices.Add(tooth_end_point + (involute_step * 2) + 2);
+
+				//Bottom
+				tooth_indices.Add(first_point + 1);
+				tooth_indices.Add(next_point + 1);
+				tooth_indices.Add(tooth_end_point + (involute_step * 2) + 1);
+
+				tooth_indices.Add(next_point + 1);
+				tooth_indices.Add(tooth_end_point + (involute_step * 2) + 3);
+				tooth_indices.Add(tooth_end_point + (involute_step * 2) + 1);
+			}
+			else {
+				//Top
+				tooth_indices.Add(next_point);
+				tooth_indices.Add(tooth_end_point + (involute_step * 2));
+				tooth_indices.Add(tooth_end_point + (involute_step * 2) + 2);
+
+				//Bottom
+				tooth_indices.Add(next_point + 1);
+				tooth_indices.Add(tooth_end_point + (involute_step * 2) + 3);
+				tooth_indices.Add(tooth_end_point + (involute_step * 2) + 1);
+			}
+
+
+			//Connect top and bottom Spacing
+			tooth_indices.Add(tooth_end_point + (involute_step * 2));
+			tooth_indices.Add(tooth_end_point + (involute_step * 2) + 1);
+			tooth_indices.Add(tooth_end_point + (involute_step * 2) + 2);
+
+			tooth_indices.Add(tooth_end_point + (involute_step * 2) + 2);
+			tooth_indices.Add(tooth_end_point + (involute_step * 2) + 1);
+			tooth_indices.Add(tooth_end_point + (involute_step * 2) + 3);
+		}
+
+		////Connect gaps
+		if (involute_step == involute_steps - 2) {
+			//Connect tooth ends
+			tooth_indices.Add(tooth_starting_point + (involute_step * 2) + 2);
+			tooth_indices.Add(tooth_starting_point + (involute_step * 2) + 3);
+			tooth_indices.Add(tooth_starting_point + (involute_step * 2) + 4);
+
+			tooth_indices.Add(tooth_starting_point + (involute_step * 2) + 4);
+			tooth_indices.Add(tooth_starting_point + (involute_step * 2) + 3);
+			tooth_indices.Add(tooth_starting_point + (involute_step * 2) + 5);
+		}
+
+		if (involute_step == spacing_steps - 2) {
+			//Connect top spacing to next tooth
+			tooth_indices.Add(next_point);
+			tooth_indices.Add(tooth_end_point + (involute_step * 2) + 2);
+			tooth_indices.Add(tooth_end_point + (involute_step * 2) + 4);
+
+			tooth_indices.Add(next_point);
+			tooth_indices.Add(tooth_end_point + (involute_step * 2) + 4);
+			tooth_indices.Add(next_tooth);
+
+			//Connect bottom spacing to next tooth
+			tooth_indices.Add(next_point + 1);
+			tooth_indices.Add(tooth_end_point + (involute_step * 2) + 5);
+			tooth_indices.Add(tooth_end_point + (involute_step * 2) + 3);
+
+			tooth_indices.Add(next_point + 1);
+			tooth_indices.Add(next_tooth + 1);
+			tooth_indices.Add(tooth_end_point + (involute_step * 2) + 5);
+
+			//Connect top and bottom Spacing
+			tooth_indices.Add(tooth_end_point + (involute_step * 2) + 2);
+			tooth_indices.Add(tooth_end_point + (involute_step * 2) + 3);
+			tooth_indices.Add(tooth_end_point + (involute_step * 2) + 4);
+
+			tooth_indices.Add(tooth_end_point + (involute_step * 2) + 4);
+			tooth_indices.Add(tooth_end_point + (involute_step * 2) + 3);
+			tooth_indices.Add(tooth_end_point + (involute_step * 2) + 5);
+
+			tooth_indices.Add(tooth_end_point + (involute_step * 2) + 4);
+			tooth_indices.Add(tooth_end_point + (involute_step * 2) + 5);
+			tooth_indices.Add(next_tooth);
+
+			tooth_indices.Add(next_tooth);
+			tooth_indices.Add(tooth_end_point + (involute_step * 2) + 5);
+			tooth_indices.Add(next_tooth + 1);
+		}
+	}
+
+	//Stamp the triangles out for every tooth. Ring points advance by one segment, tooth points by one tooth
+	//and the last tooth wraps around onto the first ring point and the first tooth
+	const int ring_span = center_radial_segments * 2;
+	const int tooth_span = number_of_teeth * tooth_verts;
+	const auto first_tooth_index = indices.Num();
+	indices.AddUninitialized(number_of_teeth * tooth_indices.Num());
+	checkSlow(verts.Num() == sizes.verts && indices.Num() == sizes.indices && out.collision_verts.Num() == sizes.collision_verts);
+
+	for (unsigned int current_tooth = 0; current_tooth < number_of_teeth; current_tooth++) {
+		const int ring_offset = current_tooth * 2;
+		const int tooth_offset = current_tooth * tooth_verts;
+		auto tooth_index_data = indices.GetData() + first_tooth_index + current_tooth * tooth_indices.Num();
+
+		for (int tooth_index = 0; tooth_index < tooth_indices.Num(); tooth_index++) {
+			auto index = tooth_indices[tooth_index];
+			if (index < first_tooth_vert) {
+				index += ring_offset;
+				if (index >= first_tooth_vert) {
+					index -= ring_span;
+				}
+			}
+			else {
+				index += tooth_offset;
+				if (index >= first_tooth_vert + tooth_span) {
+					index -= tooth_span;
+				}
+			}
+			tooth_index_data[tooth_index] = index;
+		}
+	}
+}
+
+EGearChange GearGeometry::classifyChange(const FGearParams& from, const FGearParams& to)
+{
+	auto change = EGearChange::None;
+	if (from.number_of_teeth != to.number_of_teeth || from.involute_steps != to.involute_steps || from.adaptive_spacing != to.adaptive_spacing
+		|| from.spacing_steps != to.spacing_steps || from.pressure_angle != to.pressure_angle || from.profile_shift != to.profile_shift || from.lod != to.lod) {
+		change |= EGearChange::Rebuild;
+	}
+	if (from.module != to.module || from.width != to.width) {
+		change |= EGearChange::Scale;
+	}
+	if (from.collision_mode != to.collision_mode) {
+		change |= EGearChange::Collision;
+	}
+	return change;
+}
+
+//Keeps the capacity of out when the source fits in it
+template<typename T>
+static void copyArray(const TArray<T>& source, TArray<T>& out)
+{
+	out.SetNumUninitialized(source.Num(), false);
+	FMemory::Memcpy(out.GetData(), source.GetData(), source.Num() * source.GetTypeSize());
+}
+
+void GearGeometry::deriveGear(const FGearParams& source_params, const FGearMeshData& source, const FGearParams& params, FGearMeshData& out)
+{
+	const auto change = classifyChange(source_params, params);
+	check(!EnumHasAnyFlags(change, EGearChange::Rebuild) && &source != &out);
+
+	//Every radius of the profile is proportional to the module, including the profile shift, and every y to the width
+	const auto radial_scale = double(params.module) / source_params.module;
+	const auto axial_scale = double(params.width) / source_params.width;
+	const FVector scale(radial_scale, axial_scale, radial_scale);
+
+	//Normals point away from the center like in generateGear, so they follow the scaled positions
+	const auto num_verts = source.verts.Num();
+	out.verts.SetNumUninitialized(num_verts, false);
+	out.normals.SetNumUninitialized(num_verts, false);
+	for (int32 vert = 0; vert < num_verts; vert++) {
+		out.verts[vert] = source.verts[vert] * scale;
+		out.normals[vert] = out.verts[vert].GetSafeNormal();
+	}
+	copyArray(source.indices, out.indices);
+
+	out.profile_area = source.profile_area * radial_scale * radial_scale;
+	out.profile_polar_moment = source.profile_polar_moment * FMath::Pow(radial_scale, 4.0);
+
+	if (EnumHasAnyFlags(change, EGearChange::Collision)) {
+		addCollision(params, computeDimensions(params), out);
+	}
+	else {
+		copyArray(source.collision_offsets, out.collision_offsets);
+		out.collision_verts.SetNumUninitialized(source.collision_verts.Num(), false);
+		for (int32 vert = 0; vert < source.collision_verts.Num(); vert++) {
+			out.collision_verts[vert] = source.collision_verts[vert] * scale;
+		}
+	}
+}
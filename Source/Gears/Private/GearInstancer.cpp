@@ -0,0 +1,223 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GearInstancer.h"
+#include "ProceduralGear.h"
+#include "GearMeshCache.h"
+#include "GearBakedMesh.h"
+#include "GearTrainSubsystem.h"
+#include "Components/InstancedStaticMeshComponent.h"
+#include "Components/HierarchicalInstancedStaticMeshComponent.h"
+#include "Engine/StaticMesh.h"
+#include "StaticMeshResources.h"
+#include "Materials/MaterialInstance.h"
+#include "MeshDescription.h"
+
+AGearInstancer::AGearInstancer()
+{
+	//UGearTrainSubsystem updates the instances after the gears turned, so they are not a frame behind kinematic gears
+	PrimaryActorTick.bCanEverTick = false;
+
+	scene = CreateDefaultSubobject<USceneComponent>("DefaultSceneRoot");
+	SetRootComponent(scene);
+}
+
+void AGearInstancer::addGear(AProceduralGear* gear)
+{
+	if (!gear || gear_keys.Contains(gear)) {
+		return;
+	}
+
+	auto key = makeKey(gear);
+
+	//Gears baked by the GearBake commandlet already come with a mesh
+	if (auto baked_mesh = gear->getBakedMesh()) {
+		if (!baked_mesh_lookup.Contains(key.params)) {
+			baked_meshes.Add(baked_mesh);
+			baked_mesh_lookup.Add(key.params, baked_mesh);
+		}
+	}
+
+	auto& batch = findOrAddBatch(key);
+	auto transform = gear->getMeshTransform();
+	batch.gears.Add(gear);
+	batch.transforms.Add(transform);
+	batch.component->AddInstance(transform, true);
+
+	gear_keys.Add(gear, key);
+	gear_instances.Add(gear, batch.gears.Num() - 1);
+}
+
+void AGearInstancer::removeGear(AProceduralGear* gear)
+{
+	FGearInstanceKey key;
+	if (!gear_keys.RemoveAndCopyValue(gear, key)) {
+		return;
+	}
+
+	int32 index;
+	gear_instances.RemoveAndCopyValue(gear, index);
+	auto& batch = batches[key];
+	if (batch.gears.Num() == 1) {
+		batch_components.Remove(batch.component);
+		batch.component->DestroyComponent();
+		batches.Remove(key);
+		return;
+	}
+
+	//Both component types move the last instance into the removed one, the gears follow the same way
+	batch.component->RemoveInstance(index);
+	batch.gears.RemoveAtSwap(index);
+	batch.transforms.RemoveAtSwap(index);
+	if (batch.gears.IsValidIndex(index)) {
+		gear_instances[batch.gears[index]] = index;
+	}
+}
+
+void AGearInstancer::updateGear(AProceduralGear* gear)
+{
+	auto key = gear_keys.Find(gear);
+	if (!key || *key == makeKey(gear)) {
+		return;
+	}
+
+	removeGear(gear);
+	addGear(gear);
+}
+
+void AGearInstancer::updateInstanceTransforms()
+{
+	for (auto& batch_pair : batches) {
+		auto& batch = batch_pair.Value;
+
+		auto changed = false;
+		for (int32 index = 0; index < batch.gears.Num(); index++) {
+			auto transform = batch.gears[index]->getMeshTransform();
+			if (!transform.Equals(batch.transforms[index])) {
+				batch.transforms[index] = transform;
+				changed = true;
+			}
+		}
+
+		if (changed) {
+			batch.component->BatchUpdateInstancesTransforms(0, batch.transforms, true, true, true);
+		}
+	}
+}
+
+int32 AGearInstancer::getBatchCount() const
+{
+	return batches.Num();
+}
+
+int32 AGearInstancer::getInstanceCount() const
+{
+	return gear_keys.Num();
+}
+
+int32 AGearInstancer::getBatchInstanceCount(const AProceduralGear* gear) const
+{
+	auto key = gear_keys.Find(gear);
+	if (!key) {
+		return 0;
+	}
+	return batches[*key].component->GetInstanceCount();
+}
+
+bool AGearInstancer::getInstanceTransform(const AProceduralGear* gear, FTransform& transform) const
+{
+	auto key = gear_keys.Find(gear);
+	if (!key) {
+		return false;
+	}
+
+	return batches[*key].component->GetInstanceTransform(gear_instances[gear], transform, true);
+}
+
+const UStaticMesh* AGearInstancer::getBakedMesh(const FGearParams& params) const
+{
+	auto static_mesh = baked_mesh_lookup.Find(params);
+	return static_mesh ? *static_mesh : nullptr;
+}
+
+void AGearInstancer::BeginPlay()
+{
+	Super::BeginPlay();
+
+	GetWorld()->GetSubsystem<UGearTrainSubsystem>()->addInstancer(this);
+}
+
+void AGearInstancer::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (auto gear_train = GetWorld()->GetSubsystem<UGearTrainSubsystem>()) {
+		gear_train->removeInstancer(this);
+	}
+
+	batches.Empty();
+	gear_keys.Empty();
+	gear_instances.Empty();
+
+	Super::EndPlay(EndPlayReason);
+}
+
+UStaticMesh* AGearInstancer::bakeMesh(const FGearParams& params)
+{
+	if (auto static_mesh = baked_mesh_lookup.Find(params)) {
+		return *static_mesh;
+	}
+
+	//Instances switch LODs at the same screen sizes as UGearMeshComponent
+	TArray<FMeshDescription> mesh_descriptions;
+	mesh_descriptions.SetNum(GearGeometry::LOD_COUNT);
+	TArray<const FMeshDescription*> mesh_description_pointers;
+	for (int32 lod = 0; lod < GearGeometry::LOD_COUNT; lod++) {
+		auto geometry = FGearMeshCache::Get().getGeometry(GearGeometry::getLODParams(params, lod));
+		GearBakedMesh::buildMeshDescription(*geometry, mesh_descriptions[lod]);
+		mesh_description_pointers.Add(&mesh_descriptions[lod]);
+	}
+
+	auto static_mesh = NewObject<UStaticMesh>(this, NAME_None, RF_Transient);
+	static_mesh->GetStaticMaterials().Add(FStaticMaterial(nullptr, FName("Gear")));
+
+	UStaticMesh::FBuildMeshDescriptionsParams build_params;
+	build_params.bBuildSimpleCollision = false;
+	build_params.bFastBuild = true;
+	static_mesh->BuildFromMeshDescriptions(mesh_description_pointers, build_params);
+	for (int32 lod = 0; lod < GearGeometry::LOD_COUNT; lod++) {
+		static_mesh->GetRenderData()->ScreenSize[lod].Default = GearGeometry::LOD_SCREEN_SIZES[lod];
+	}
+
+	baked_meshes.Add(static_mesh);
+	baked_mesh_lookup.Add(params, static_mesh);
+	return static_mesh;
+}
+
+AGearInstancer::FBatch& AGearInstancer::findOrAddBatch(const FGearInstanceKey& key)
+{
+	if (auto batch = batches.Find(key)) {
+		return *batch;
+	}
+
+	auto component_class = _hierarchical ? UHierarchicalInstancedStaticMeshComponent::StaticClass() : UInstancedStaticMeshComponent::StaticClass();
+	auto component = NewObject<UInstancedStaticMeshComponent>(this, component_class);
+	component->SetupAttachment(scene);
+	component->SetMobility(EComponentMobility::Movable);
+	component->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+	component->bSupportRemoveAtSwap = true;
+	component->SetStaticMesh(bakeMesh(key.params));
+	component->SetMaterial(0, key.material);
+	component->RegisterComponent();
+	batch_components.Add(component);
+
+	auto& batch = batches.Add(key);
+	batch.component = component;
+	return batch;
+}
+
+FGearInstanceKey AGearInstancer::makeKey(const AProceduralGear* gear)
+{
+	FGearInstanceKey key;
+	key.params = gear->getParams();
+	key.material = const_cast<UMaterialInstance*>(gear->getMaterial());
+	return key;
+}
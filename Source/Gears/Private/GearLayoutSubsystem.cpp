@@ -0,0 +1,291 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GearLayoutSubsystem.h"
+#include "GearGeometry.h"
+#include "ProceduralGear.h"
+#include "EngineUtils.h"
+#include "HAL/IConsoleManager.h"
+
+static TAutoConsoleVariable<float> CVarGearLayoutDistanceTolerance(
+	TEXT("gears.Layout.DistanceTolerance"),
+	0.05f,
+	TEXT("Centre distance error of meshing gears, as a fraction of their module, above which they interfere or have backlash."));
+
+static TAutoConsoleVariable<float> CVarGearLayoutPhaseTolerance(
+	TEXT("gears.Layout.PhaseTolerance"),
+	0.05f,
+	TEXT("Phase error of meshing gears, as a fraction of their tooth pitch, above which their teeth do not interlock."));
+
+//Cosine of the largest angle between the axes of meshing gears
+static constexpr double AXIS_TOLERANCE = 0.99985;
+
+void UGearLayoutSubsystem::updateLayout()
+{
+	entries.Reset();
+	entry_indices.Reset();
+	cells.Reset();
+	cell_entries.Reset();
+
+	//Partners are at most a cell apart along every world axis when a cell holds the largest gear pair
+	auto largest = 0.0;
+	for (TActorIterator<AProceduralGear> it(GetWorld()); it; ++it) {
+		const auto& entry = entries.Add_GetRef(makeEntry(*it));
+		entry_indices.Add(entry.gear, entries.Num() - 1);
+		largest = FMath::Max(largest, FMath::Sqrt(4.0 * entry.tip_radius * entry.tip_radius + entry.width * entry.width));
+	}
+	cell_size = FMath::Max(largest, KINDA_SMALL_NUMBER);
+
+	//Counting sort of the entries by cell, so every cell is one range of cell_entries
+	TArray<FIntVector> entry_cells;
+	entry_cells.SetNumUninitialized(entries.Num());
+	cells.Reserve(entries.Num());
+	for (int32 index = 0; index < entries.Num(); index++) {
+		entry_cells[index] = getCell(entries[index].center);
+		cells.FindOrAdd(entry_cells[index], FIntPoint::ZeroValue).Y++;
+	}
+
+	int32 start = 0;
+	for (auto& cell : cells) {
+		cell.Value.X = start;
+		start += cell.Value.Y;
+		cell.Value.Y = 0;
+	}
+
+	cell_entries.SetNumUninitialized(entries.Num());
+	for (int32 index = 0; index < entries.Num(); index++) {
+		auto& cell = cells[entry_cells[index]];
+		cell_entries[cell.X + cell.Y++] = index;
+	}
+}
+
+int32 UGearLayoutSubsystem::getGearCount() const
+{
+	return entries.Num();
+}
+
+void UGearLayoutSubsystem::findMeshings(TArray<FGearMeshing>& out) const
+{
+	out.Reset();
+	for (int32 index = 0; index < entries.Num(); index++) {
+		auto cell = getCell(entries[index].center);
+		for (int32 z = -1; z <= 1; z++) {
+			for (int32 y = -1; y <= 1; y++) {
+				for (int32 x = -1; x <= 1; x++) {
+					auto neighbour = cells.Find(cell + FIntVector(x, y, z));
+					if (!neighbour) {
+						continue;
+					}
+
+					//Every pair is measured once, from its first entry
+					for (int32 slot = neighbour->X; slot < neighbour->X + neighbour->Y; slot++) {
+						auto other = cell_entries[slot];
+						FGearMeshing meshing;
+						if (other > index && measureMeshing(entries[index], entries[other], meshing)) {
+							out.Add(meshing);
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+bool UGearLayoutSubsystem::measureMeshing(AProceduralGear* gear_a, AProceduralGear* gear_b, FGearMeshing& out)
+{
+	return measureMeshing(makeEntry(gear_a), makeEntry(gear_b), out);
+}
+
+int32 UGearLayoutSubsystem::connectMeshingGears()
+{
+	TArray<FGearMeshing> meshings;
+	findMeshings(meshings);
+
+	auto isConnected = [](const AProceduralGear* gear, AProceduralGear* partner) {
+		return gear->getMeshingGears().Contains(TSoftObjectPtr<AProceduralGear>(partner));
+	};
+
+	int32 added = 0;
+	for (const auto& meshing : meshings) {
+		if (EnumHasAnyFlags(meshing.problems, EGearMeshingProblem::Incompatible)) {
+			continue;
+		}
+		if (isConnected(meshing.gear_a, meshing.gear_b) && isConnected(meshing.gear_b, meshing.gear_a)) {
+			continue;
+		}
+
+		meshing.gear_a->addMeshingGear(meshing.gear_b);
+		meshing.gear_b->addMeshingGear(meshing.gear_a);
+		added++;
+	}
+	return added;
+}
+
+void UGearLayoutSubsystem::snapGear(AProceduralGear* gear, AProceduralGear* partner)
+{
+	auto entry = makeEntry(gear);
+	snapEntry(entry, makeEntry(partner));
+}
+
+int32 UGearLayoutSubsystem::snapLayout()
+{
+	updateLayout();
+	TArray<FGearMeshing> meshings;
+	findMeshings(meshings);
+
+	TArray<TArray<int32, TInlineAllocator<4>>> partners;
+	partners.SetNum(entries.Num());
+	for (const auto& meshing : meshings) {
+		if (EnumHasAnyFlags(meshing.problems, EGearMeshingProblem::Incompatible)) {
+			continue;
+		}
+
+		auto index_a = entry_indices[meshing.gear_a];
+		auto index_b = entry_indices[meshing.gear_b];
+		partners[index_a].Add(index_b);
+		partners[index_b].Add(index_a);
+	}
+
+	//Breadth first from the first gear of every group, so every gear is snapped to one that is already in place
+	TArray<bool> visited;
+	visited.SetNumZeroed(entries.Num());
+	TArray<int32> queue;
+	int32 snapped = 0;
+	for (int32 root = 0; root < entries.Num(); root++) {
+		if (visited[root]) {
+			continue;
+		}
+
+		visited[root] = true;
+		queue.Reset();
+		queue.Add(root);
+		for (int32 head = 0; head < queue.Num(); head++) {
+			auto current = queue[head];
+			for (auto partner : partners[current]) {
+				if (visited[partner]) {
+					continue;
+				}
+
+				visited[partner] = true;
+				snapEntry(entries[partner], entries[current]);
+				queue.Add(partner);
+				snapped++;
+			}
+		}
+	}
+
+	//Hash the gears where they were moved to
+	updateLayout();
+	return snapped;
+}
+
+FIntVector UGearLayoutSubsystem::getCell(const FVector& location) const
+{
+	return FIntVector(
+		FMath::FloorToInt32(location.X / cell_size),
+		FMath::FloorToInt32(location.Y / cell_size),
+		FMath::FloorToInt32(location.Z / cell_size));
+}
+
+UGearLayoutSubsystem::FLayoutEntry UGearLayoutSubsystem::makeEntry(AProceduralGear* gear)
+{
+	const auto transform = gear->getMeshTransform();
+	const auto& dimensions = gear->getDimensions();
+
+	FLayoutEntry entry;
+	entry.gear = gear;
+	entry.center = transform.GetLocation();
+	entry.axis = transform.GetUnitAxis(EAxis::Y);
+	entry.x_axis = transform.GetUnitAxis(EAxis::X);
+	entry.z_axis = transform.GetUnitAxis(EAxis::Z);
+	entry.ref_radius = dimensions.ref_diameter / 2.0;
+	entry.tip_radius = dimensions.tip_radius;
+	entry.width = dimensions.width;
+	entry.module = dimensions.module;
+	entry.pressure_angle = FMath::DegreesToRadians(gear->getPressureAngle());
+	entry.tooth_center_angle = GearGeometry::getToothCenterAngle(dimensions);
+	entry.teeth = gear->getNumberOfTeeth();
+	return entry;
+}
+
+bool UGearLayoutSubsystem::measureMeshing(const FLayoutEntry& a, const FLayoutEntry& b, FGearMeshing& out)
+{
+	auto parallel = FVector::DotProduct(a.axis, b.axis);
+	if (FMath::Abs(parallel) < AXIS_TOLERANCE) {
+		return false;
+	}
+
+	//Gears on the same axis share a shaft instead of meshing
+	auto offset = b.center - a.center;
+	auto axial = FVector::DotProduct(offset, a.axis);
+	auto radial = offset - axial * a.axis;
+	auto center_distance = radial.Size();
+	if (FMath::Abs(axial) >= (a.width + b.width) / 2.0 || center_distance >= a.tip_radius + b.tip_radius || center_distance < KINDA_SMALL_NUMBER) {
+		return false;
+	}
+
+	out.gear_a = a.gear;
+	out.gear_b = b.gear;
+	out.center_distance = center_distance;
+	out.ideal_center_distance = a.ref_radius + b.ref_radius;
+	//Moving the centres apart opens a gap on both flanks along the line of action
+	out.backlash = 2.0 * (center_distance - out.ideal_center_distance) * FMath::Tan(a.pressure_angle);
+	out.phase_error = 0.0;
+	out.problems = EGearMeshingProblem::None;
+
+	if (!FMath::IsNearlyEqual(a.module, b.module, KINDA_SMALL_NUMBER) || !FMath::IsNearlyEqual(a.pressure_angle, b.pressure_angle, KINDA_SMALL_NUMBER)) {
+		out.problems = EGearMeshingProblem::Incompatible;
+		return true;
+	}
+
+	auto distance_tolerance = CVarGearLayoutDistanceTolerance.GetValueOnAnyThread() * a.module;
+	if (center_distance < out.ideal_center_distance - distance_tolerance) {
+		out.problems |= EGearMeshingProblem::Interference;
+	}
+	else if (center_distance > out.ideal_center_distance + distance_tolerance) {
+		out.problems |= EGearMeshingProblem::Backlash;
+	}
+
+	//A tooth of one gear faces a gap of the other when their pitch fractions on the line of centres add up to half
+	//a pitch. Gears facing the other way count their angles the other way around
+	auto direction = radial / center_distance;
+	auto sign = parallel < 0.0 ? -1.0 : 1.0;
+	auto phase_error = getPitchFraction(a, direction) + sign * getPitchFraction(b, -direction) - 0.5;
+	out.phase_error = phase_error - FMath::RoundToDouble(phase_error);
+	if (FMath::Abs(out.phase_error) > CVarGearLayoutPhaseTolerance.GetValueOnAnyThread()) {
+		out.problems |= EGearMeshingProblem::Phase;
+	}
+	return true;
+}
+
+double UGearLayoutSubsystem::getPitchFraction(const FLayoutEntry& entry, const FVector& direction)
+{
+	auto angle = FMath::Atan2(FVector::DotProduct(direction, entry.z_axis), FVector::DotProduct(direction, entry.x_axis));
+	auto fraction = entry.teeth * (angle - entry.tooth_center_angle) / (2.0 * PI);
+	return fraction - FMath::FloorToDouble(fraction);
+}
+
+void UGearLayoutSubsystem::snapEntry(FLayoutEntry& entry, const FLayoutEntry& partner)
+{
+	//Keep the axial offset and the side of the partner the gear is on
+	auto offset = entry.center - partner.center;
+	auto axial = FVector::DotProduct(offset, partner.axis);
+	auto direction = (offset - axial * partner.axis).GetSafeNormal();
+	if (direction.IsZero()) {
+		direction = partner.x_axis;
+	}
+	auto center = partner.center + axial * partner.axis + direction * (entry.ref_radius + partner.ref_radius);
+
+	//Turning the gear by an angle from its X axis towards its Z axis lowers its pitch fraction by teeth * angle / 2pi
+	auto sign = FVector::DotProduct(entry.axis, partner.axis) < 0.0 ? -1.0 : 1.0;
+	auto phase_error = getPitchFraction(partner, direction) + sign * getPitchFraction(entry, -direction) - 0.5;
+	phase_error -= FMath::RoundToDouble(phase_error);
+	auto angle = sign * phase_error * 2.0 * PI / entry.teeth;
+	auto rotation = FQuat(entry.axis, -angle);
+
+	//Turn about the mesh centre, the actor origin may be elsewhere
+	auto gear = entry.gear;
+	auto location = center + rotation.RotateVector(gear->GetActorLocation() - entry.center);
+	gear->SetActorLocationAndRotation(location, rotation * gear->GetActorQuat(), false, nullptr, ETeleportType::TeleportPhysics);
+	entry = makeEntry(gear);
+}
@@ -0,0 +1,614 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GearMeshCache.h"
+#include "Gears.h"
+#include "Async/ParallelFor.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/IConsoleManager.h"
+#include "PhysicsEngine/BodySetup.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+#if WITH_EDITOR
+#include "DerivedDataCacheInterface.h"
+#endif // WITH_EDITOR
+
+static TAutoConsoleVariable<int32> CVarGearMeshCacheBudgetMB(
+	TEXT("gears.MeshCache.BudgetMB"),
+	64,
+	TEXT("Memory budget in MB for shared gear geometry and cooked collision. Least recently used entries no gear uses anymore are evicted above it."));
+
+static TAutoConsoleVariable<bool> CVarGearMeshCacheUseDDC(
+	TEXT("gears.MeshCache.UseDDC"),
+	true,
+	TEXT("Load gear geometry from the derived data cache and store new builds in it. Editor only."));
+
+static FAutoConsoleCommand GearMeshCacheStatsCommand(
+	TEXT("gears.MeshCache.Stats"),
+	TEXT("Logs the gear mesh cache hit, miss and eviction counters."),
+	FConsoleCommandDelegate::CreateLambda([]() {
+		auto stats = FGearMeshCache::Get().getStats();
+		UE_LOG(LogGears, Display, TEXT("Gear mesh cache: %d entries, %.2f / %.2f MB, %llu hits, %llu misses, %llu evictions, %llu derived, %llu collision hits, %llu collision misses, %llu collision scaled, %llu background cooks, %llu joined, %d pending (peak %d), %llu DDC hits, %llu DDC misses"),
+			stats.entries, stats.resident_bytes / (1024.0 * 1024.0), stats.budget_bytes / (1024.0 * 1024.0),
+			stats.hits, stats.misses, stats.evictions, stats.derived, stats.collision_hits, stats.collision_misses, stats.collision_scaled,
+			stats.collision_async_cooks, stats.collision_joined, stats.collision_pending, stats.collision_peak_pending, stats.ddc_hits, stats.ddc_misses);
+	}));
+
+//Spare buffers kept for reuse. One per gear being edited at the same time is enough
+static constexpr int32 MAX_SPARE_GEOMETRY = 4;
+
+#if WITH_EDITOR
+static FString makeDerivedDataCacheKey(const FGearParams& params)
+{
+	return FDerivedDataCacheInterface::BuildCacheKey(TEXT("GEARMESH"), *FString::Printf(TEXT("%u"), GearGeometry::VERSION), *GearGeometry::makeKey(params));
+}
+#endif // WITH_EDITOR
+
+static bool loadDerivedData(const FGearParams& params, FGearMeshData& geometry)
+{
+#if WITH_EDITOR
+	auto ddc = GetDerivedDataCache();
+	if (!ddc || !CVarGearMeshCacheUseDDC.GetValueOnAnyThread()) {
+		return false;
+	}
+
+	TArray<uint8> data;
+	if (!ddc->GetSynchronous(*makeDerivedDataCacheKey(params), data, TEXT("ProceduralGear"))) {
+		return false;
+	}
+
+	FMemoryReader reader(data);
+	geometry.Serialize(reader);
+	return !reader.IsError();
+#else
+	return false;
+#endif // WITH_EDITOR
+}
+
+static void storeDerivedData(const FGearParams& params, FGearMeshData& geometry)
+{
+#if WITH_EDITOR
+	auto ddc = GetDerivedDataCache();
+	if (!ddc || !CVarGearMeshCacheUseDDC.GetValueOnAnyThread()) {
+		return;
+	}
+
+	TArray<uint8> data;
+	data.Reserve(geometry.GetAllocatedSize() + 64);
+	FMemoryWriter writer(data);
+	geometry.Serialize(writer);
+	ddc->Put(*makeDerivedDataCacheKey(params), data, TEXT("ProceduralGear"));
+#endif // WITH_EDITOR
+}
+
+static UBodySetup* newBodySetup()
+{
+	auto body_setup = NewObject<UBodySetup>(GetTransientPackage(), NAME_None, RF_Transient);
+	body_setup->bGenerateMirroredCollision = false;
+	body_setup->bDoubleSidedGeometry = true;
+	body_setup->CollisionTraceFlag = CTF_UseDefault;
+	return body_setup;
+}
+
+static void addConvexElem(UBodySetup* body_setup, TArrayView<const FVector> hull)
+{
+	auto& convex_elem = body_setup->AggGeom.ConvexElems.AddDefaulted_GetRef();
+	convex_elem.VertexData.Append(hull.GetData(), hull.Num());
+	convex_elem.UpdateElemBox();
+}
+
+//Adds an elem placed by transform that shares the cooked convex of source
+static void addSharedConvexElem(UBodySetup* body_setup, const FKConvexElem& source, const FTransform& transform)
+{
+	auto& convex_elem = body_setup->AggGeom.ConvexElems.AddDefaulted_GetRef();
+	convex_elem.VertexData = source.VertexData;
+	convex_elem.ElemBox = source.ElemBox;
+	convex_elem.SetTransform(transform);
+	auto chaos_convex = source.GetChaosConvexMesh();
+	convex_elem.SetChaosConvexMesh(MoveTemp(chaos_convex));
+}
+
+//Every tooth hull is the first one rotated, so only the first one and the shapes after the teeth are cooked
+UBodySetup* FGearMeshCache::prepareCollision(const FGearParams& params, const FGearMeshData& geometry)
+{
+	const auto tooth_hulls = GearGeometry::getToothHullCount(params);
+
+	auto cooked = newBodySetup();
+	//The cooked convex meshes are cached on disk by this guid, so it has to be the same for the same hulls
+	cooked->BodySetupGuid = FGuid::NewDeterministicGuid(GearGeometry::makeKey(params), GearGeometry::VERSION);
+	for (int32 shape = 0; shape < geometry.getCollisionShapeCount(); shape++) {
+		if (shape == 0 || shape >= tooth_hulls) {
+			addConvexElem(cooked, geometry.getCollisionShape(shape));
+		}
+	}
+	return cooked;
+}
+
+//The teeth share the convex of the first tooth with their rotation as the elem transform
+UBodySetup* FGearMeshCache::finishCollision(const FGearParams& params, UBodySetup* cooked, UBodySetup* body_setup)
+{
+	const auto tooth_hulls = GearGeometry::getToothHullCount(params);
+	if (tooth_hulls == 0 && !body_setup) {
+		return cooked;
+	}
+
+	//Keeps its own guid, recooking it would cook every elem
+	if (!body_setup) {
+		body_setup = newBodySetup();
+	}
+	const auto& cooked_elems = cooked->AggGeom.ConvexElems;
+	for (int32 tooth = 0; tooth < tooth_hulls; tooth++) {
+		addSharedConvexElem(body_setup, cooked_elems[0], FTransform(FQuat(FVector::YAxisVector, -GearGeometry::getToothAngle(params, tooth))));
+	}
+	for (int32 elem = tooth_hulls > 0 ? 1 : 0; elem < cooked_elems.Num(); elem++) {
+		addSharedConvexElem(body_setup, cooked_elems[elem], FTransform::Identity);
+	}
+
+	//Nothing left to cook, the elems keep the convexes alive after the cooked body setup is collected
+	body_setup->bCreatedPhysicsMeshes = true;
+	return body_setup;
+}
+
+static UBodySetup* cookCollision(const FGearParams& params, const FGearMeshData& geometry)
+{
+	auto cooked = FGearMeshCache::prepareCollision(params, geometry);
+	cooked->CreatePhysicsMeshes();
+	return FGearMeshCache::finishCollision(params, cooked);
+}
+
+void FGearMeshCache::shareToothConvex(const FGearParams& params, UBodySetup* body_setup)
+{
+	const auto tooth_hulls = GearGeometry::getToothHullCount(params);
+	auto& convex_elems = body_setup->AggGeom.ConvexElems;
+	if (tooth_hulls < 2 || convex_elems.Num() < tooth_hulls || !convex_elems[0].GetChaosConvexMesh()) {
+		return;
+	}
+
+	//Frees the convexes the other teeth were loaded with
+	for (int32 tooth = 1; tooth < tooth_hulls; tooth++) {
+		auto chaos_convex = convex_elems[0].GetChaosConvexMesh();
+		convex_elems[tooth].SetChaosConvexMesh(MoveTemp(chaos_convex));
+	}
+}
+
+FGearMeshCache& FGearMeshCache::Get()
+{
+	static FGearMeshCache cache;
+	return cache;
+}
+
+//Shares the cooked hulls of source, the physics shapes apply the scale on top of the scale source already has.
+//The scale is the same in every direction around the axis, so it keeps the tooth rotations
+static UBodySetup* scaleCollision(const FGearParams& source_params, const UBodySetup* source, const FGearParams& params)
+{
+	const auto radial_scale = double(params.module) / source_params.module;
+	const FVector scale(radial_scale, double(params.width) / source_params.width, radial_scale);
+
+	auto body_setup = newBodySetup();
+	for (const auto& source_elem : source->AggGeom.ConvexElems) {
+		const auto& source_transform = source_elem.GetTransform();
+		addSharedConvexElem(body_setup, source_elem, FTransform(source_transform.GetRotation(), FVector::ZeroVector, source_transform.GetScale3D() * scale));
+	}
+
+	//Nothing left to cook
+	body_setup->bCreatedPhysicsMeshes = true;
+	return body_setup;
+}
+
+TSharedRef<const FGearMeshData> FGearMeshCache::getGeometry(const FGearParams& params)
+{
+	return findOrBuildGeometry(params, nullptr, nullptr);
+}
+
+TSharedRef<const FGearMeshData> FGearMeshCache::getGeometry(const FGearParams& params, const FGearParams& source_params, const TSharedPtr<const FGearMeshData>& source)
+{
+	return findOrBuildGeometry(params, &source_params, source.Get());
+}
+
+TSharedRef<const FGearMeshData> FGearMeshCache::findOrBuildGeometry(const FGearParams& params, const FGearParams* source_params, const FGearMeshData* source)
+{
+	{
+		FScopeLock scope_lock(&lock);
+		if (auto entry = findEntry(params)) {
+			touchEntry(*entry);
+			stats.hits++;
+			return entry->geometry.ToSharedRef();
+		}
+	}
+
+	TSharedPtr<FGearMeshData> geometry;
+	{
+		FScopeLock scope_lock(&lock);
+		if (!spare_geometry.IsEmpty()) {
+			geometry = spare_geometry.Pop(false);
+		}
+	}
+	if (!geometry) {
+		geometry = MakeShared<FGearMeshData>();
+	}
+
+	//Generate outside of the lock so different gears can be built in parallel. Transforming the source
+	//is cheaper than the kernel and than loading from disk
+	auto derived = source && !EnumHasAnyFlags(GearGeometry::classifyChange(*source_params, params), EGearChange::Rebuild);
+	auto loaded = false;
+	if (derived) {
+		GearGeometry::deriveGear(*source_params, *source, params, *geometry);
+	}
+	else {
+		loaded = loadDerivedData(params, *geometry);
+		if (!loaded) {
+			GearGeometry::generateGear(params, *geometry);
+			storeDerivedData(params, *geometry);
+		}
+	}
+
+	FScopeLock scope_lock(&lock);
+	if (derived) {
+		stats.derived++;
+	}
+	else if (loaded) {
+		stats.ddc_hits++;
+	}
+	else {
+		stats.ddc_misses++;
+	}
+	auto& entry = findOrAddEntry(params);
+	if (entry.geometry) {
+		//Another thread finished the same gear first
+		stats.hits++;
+		recycleGeometry(MoveTemp(geometry));
+		return entry.geometry.ToSharedRef();
+	}
+
+	stats.misses++;
+	entry.geometry = geometry;
+	entry.size += geometry->GetAllocatedSize();
+	resident_bytes += geometry->GetAllocatedSize();
+	evictToBudget(params);
+
+	return geometry.ToSharedRef();
+}
+
+void FGearMeshCache::getGeometry(TArrayView<const FGearParams> params, TArray<TSharedPtr<const FGearMeshData>>& geometry, int32 max_workers)
+{
+	geometry.Reset();
+	geometry.SetNum(params.Num());
+
+	//Every worker takes a strided share of the params
+	const auto workers = max_workers > 0 ? FMath::Min(max_workers, params.Num()) : params.Num();
+	ParallelFor(workers, [this, params, workers, &geometry](int32 worker) {
+		for (int32 index = worker; index < params.Num(); index += workers) {
+			geometry[index] = getGeometry(params[index]);
+		}
+	}, workers <= 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None);
+}
+
+void FGearMeshCache::getLODs(const FGearParams& params, const FGearParams& source_params, TArrayView<const TSharedPtr<const FGearMeshData>> source, FGearLODGeometry& lods)
+{
+	lods.Reset();
+	for (int32 lod = 0; lod < GearGeometry::LOD_COUNT; lod++) {
+		auto source_lod = source.IsValidIndex(lod) ? source[lod] : nullptr;
+		lods.Add(getGeometry(GearGeometry::getLODParams(params, lod), GearGeometry::getLODParams(source_params, lod), source_lod));
+	}
+}
+
+void FGearMeshCache::releaseGeometry(const FGearParams& params, TSharedPtr<const FGearMeshData>& geometry)
+{
+	FScopeLock scope_lock(&lock);
+	geometry.Reset();
+
+	auto entry = findEntry(params);
+	if (entry && entry->geometry.IsUnique()) {
+		removeEntry(params);
+	}
+}
+
+void FGearMeshCache::releaseLODs(const FGearParams& params, FGearLODGeometry& lods)
+{
+	for (int32 lod = 0; lod < lods.Num(); lod++) {
+		releaseGeometry(GearGeometry::getLODParams(params, lod), lods[lod]);
+	}
+	lods.Reset();
+}
+
+UBodySetup* FGearMeshCache::getCollision(const FGearParams& params)
+{
+	return findOrCookCollision(params, nullptr, nullptr, nullptr);
+}
+
+UBodySetup* FGearMeshCache::getCollision(const FGearParams& params, const FGearParams& source_params, const TSharedPtr<const FGearMeshData>& geometry)
+{
+	return findOrCookCollision(params, &source_params, geometry, nullptr);
+}
+
+UBodySetup* FGearMeshCache::getCollisionAsync(const FGearParams& params, const FGearParams& source_params, const TSharedPtr<const FGearMeshData>& geometry, FOnGearCollisionCooked&& on_cooked)
+{
+	return findOrCookCollision(params, &source_params, geometry, &on_cooked);
+}
+
+bool FGearMeshCache::isCollisionPending(const FGearParams& params) const
+{
+	FScopeLock scope_lock(&lock);
+	return pending_cooks.Contains(params);
+}
+
+void FGearMeshCache::flushCollision()
+{
+	check(IsInGameThread());
+
+	//The cooks finish in game thread tasks
+	while (true) {
+		{
+			FScopeLock scope_lock(&lock);
+			if (pending_cooks.IsEmpty()) {
+				break;
+			}
+		}
+		FTaskGraphInterface::Get().ProcessThreadUntilIdle(ENamedThreads::GameThread);
+		FPlatformProcess::Sleep(0.0f);
+	}
+}
+
+UBodySetup* FGearMeshCache::findOrCookCollision(const FGearParams& params, const FGearParams* source_params, const TSharedPtr<const FGearMeshData>& geometry, FOnGearCollisionCooked* on_cooked)
+{
+	check(IsInGameThread());
+
+	if (params.collision_mode == EGearCollisionMode::None) {
+		return nullptr;
+	}
+
+	UBodySetup* source_body_setup = nullptr;
+	{
+		FScopeLock scope_lock(&lock);
+		auto entry = findEntry(params);
+		if (entry && entry->body_setup) {
+			touchEntry(*entry);
+			stats.collision_hits++;
+			return entry->body_setup;
+		}
+
+		//Hulls of the same shape at another scale can be shared instead of cooked again
+		auto source_entry = source_params ? findEntry(*source_params) : nullptr;
+		if (source_entry && source_entry->body_setup && GearGeometry::classifyChange(*source_params, params) == EGearChange::Scale) {
+			source_body_setup = source_entry->body_setup;
+		}
+
+		//Gears with the same params wait for the same cook
+		auto pending_cook = source_body_setup ? nullptr : pending_cooks.Find(params);
+		if (pending_cook && on_cooked) {
+			pending_cook->waiting.Add(MoveTemp(*on_cooked));
+			stats.collision_joined++;
+			return nullptr;
+		}
+	}
+
+	//Only a miss needs the geometry, built here when the caller does not hold it
+	auto hull_geometry = geometry ? geometry.ToSharedRef() : getGeometry(params);
+	if (source_body_setup) {
+		auto body_setup = scaleCollision(*source_params, source_body_setup, params);
+		storeCollision(params, hull_geometry, body_setup, true);
+		return body_setup;
+	}
+
+	if (on_cooked) {
+		startCook(params, hull_geometry, MoveTemp(*on_cooked));
+		return nullptr;
+	}
+
+	//A cook of the same params may be in flight. Waiting for it would pump game thread tasks, and this is reached from
+	//inside them, so the hulls are cooked here and the background cook hands this body setup to its waiters instead
+	auto body_setup = cookCollision(params, *hull_geometry);
+	storeCollision(params, hull_geometry, body_setup, false);
+	return body_setup;
+}
+
+void FGearMeshCache::startCook(const FGearParams& params, const TSharedRef<const FGearMeshData>& geometry, FOnGearCollisionCooked&& on_cooked)
+{
+	auto cooked = prepareCollision(params, *geometry);
+	{
+		FScopeLock scope_lock(&lock);
+		auto& pending_cook = pending_cooks.Add(params);
+		pending_cook.geometry = geometry;
+		pending_cook.cooked = cooked;
+		pending_cook.waiting.Add(MoveTemp(on_cooked));
+		stats.collision_async_cooks++;
+		stats.collision_peak_pending = FMath::Max(stats.collision_peak_pending, pending_cooks.Num());
+	}
+
+	//Finishes on the game thread, right away when there is nothing to cook
+	cooked->CreatePhysicsMeshesAsync(FOnAsyncPhysicsCookFinished::CreateRaw(this, &FGearMeshCache::finishCook, params));
+}
+
+void FGearMeshCache::finishCook(bool success, FGearParams params)
+{
+	FPendingCook pending_cook;
+	UBodySetup* cached_body_setup = nullptr;
+	{
+		FScopeLock scope_lock(&lock);
+		if (!pending_cooks.RemoveAndCopyValue(params, pending_cook)) {
+			return;
+		}
+		auto entry = findEntry(params);
+		cached_body_setup = entry ? entry->body_setup : nullptr;
+	}
+
+	//A synchronous request cooked the params meanwhile, every gear shares that body setup
+	if (cached_body_setup) {
+		for (auto& on_cooked : pending_cook.waiting) {
+			on_cooked.ExecuteIfBound(cached_body_setup);
+		}
+		return;
+	}
+
+	//Cooking in the background is not available everywhere, the hulls are cooked or loaded here instead
+	if (!success) {
+		pending_cook.cooked->CreatePhysicsMeshes();
+	}
+
+	auto body_setup = finishCollision(params, pending_cook.cooked);
+	storeCollision(params, pending_cook.geometry.ToSharedRef(), body_setup, false);
+	for (auto& on_cooked : pending_cook.waiting) {
+		on_cooked.ExecuteIfBound(body_setup);
+	}
+}
+
+void FGearMeshCache::storeCollision(const FGearParams& params, const TSharedRef<const FGearMeshData>& geometry, UBodySetup* body_setup, bool scaled)
+{
+	auto body_setup_size = body_setup->GetResourceSizeBytes(EResourceSizeMode::EstimatedTotal);
+
+	FScopeLock scope_lock(&lock);
+	stats.collision_misses++;
+	if (scaled) {
+		stats.collision_scaled++;
+	}
+	auto& entry = findOrAddEntry(params);
+	if (!entry.geometry) {
+		//Evicted while cooking. The geometry came out of this cache, so it is safe to own it mutably again
+		entry.geometry = ConstCastSharedRef<FGearMeshData>(geometry);
+		entry.size += geometry->GetAllocatedSize();
+		resident_bytes += geometry->GetAllocatedSize();
+	}
+	entry.body_setup = body_setup;
+	entry.size += body_setup_size;
+	resident_bytes += body_setup_size;
+	evictToBudget(params);
+}
+
+FGearMeshCache::FStats FGearMeshCache::getStats() const
+{
+	FScopeLock scope_lock(&lock);
+	auto current = stats;
+	current.entries = entries.Num();
+	current.resident_bytes = resident_bytes;
+	current.collision_pending = pending_cooks.Num();
+	current.budget_bytes = SIZE_T(FMath::Max(CVarGearMeshCacheBudgetMB.GetValueOnAnyThread(), 0)) * 1024 * 1024;
+	return current;
+}
+
+void FGearMeshCache::resetStats()
+{
+	FScopeLock scope_lock(&lock);
+	stats = FStats();
+}
+
+void FGearMeshCache::Empty()
+{
+	//Cooks in flight are kept, they still finish into the cache
+	FScopeLock scope_lock(&lock);
+	entries.Empty();
+	least_recent = nullptr;
+	most_recent = nullptr;
+	spare_geometry.Empty();
+	resident_bytes = 0;
+}
+
+void FGearMeshCache::AddReferencedObjects(FReferenceCollector& Collector)
+{
+	FScopeLock scope_lock(&lock);
+	for (auto& entry : entries) {
+		Collector.AddReferencedObject(entry.Value->body_setup);
+	}
+	for (auto& pending_cook : pending_cooks) {
+		Collector.AddReferencedObject(pending_cook.Value.cooked);
+	}
+}
+
+FString FGearMeshCache::GetReferencerName() const
+{
+	return TEXT("FGearMeshCache");
+}
+
+FGearMeshCache::FEntry* FGearMeshCache::findEntry(const FGearParams& params) const
+{
+	auto entry = entries.Find(params);
+	return entry ? entry->Get() : nullptr;
+}
+
+FGearMeshCache::FEntry& FGearMeshCache::findOrAddEntry(const FGearParams& params)
+{
+	auto& entry = entries.FindOrAdd(params);
+	if (!entry) {
+		entry = MakeUnique<FEntry>();
+		entry->params = params;
+	}
+	touchEntry(*entry);
+	return *entry;
+}
+
+void FGearMeshCache::touchEntry(FEntry& entry)
+{
+	if (most_recent == &entry) {
+		return;
+	}
+
+	unlinkEntry(entry);
+	entry.older = most_recent;
+	if (most_recent) {
+		most_recent->newer = &entry;
+	}
+	most_recent = &entry;
+	if (!least_recent) {
+		least_recent = &entry;
+	}
+}
+
+void FGearMeshCache::unlinkEntry(FEntry& entry)
+{
+	if (entry.older) {
+		entry.older->newer = entry.newer;
+	}
+	else if (least_recent == &entry) {
+		least_recent = entry.newer;
+	}
+	if (entry.newer) {
+		entry.newer->older = entry.older;
+	}
+	else if (most_recent == &entry) {
+		most_recent = entry.older;
+	}
+	entry.older = nullptr;
+	entry.newer = nullptr;
+}
+
+void FGearMeshCache::evictToBudget(const FGearParams& keep)
+{
+	auto budget = SIZE_T(FMath::Max(CVarGearMeshCacheBudgetMB.GetValueOnAnyThread(), 0)) * 1024 * 1024;
+
+	//Geometry a gear still references would stay alive and be built again by the next gear with the same params, so
+	//only entries nobody uses are evicted. Gears hold the geometry of the params they collide with, which covers their
+	//body setup too. Cooks in flight hold their geometry as well
+	auto entry = least_recent;
+	while (entry && resident_bytes > budget) {
+		auto newer = entry->newer;
+		if (entry->params != keep && (!entry->geometry || entry->geometry.IsUnique())) {
+			removeEntry(entry->params);
+			stats.evictions++;
+		}
+		entry = newer;
+	}
+}
+
+void FGearMeshCache::removeEntry(const FGearParams& params)
+{
+	auto found = entries.Find(params);
+	if (!found) {
+		return;
+	}
+
+	//params may be the key of the entry itself, it is removed from the map last
+	auto entry = MoveTemp(*found);
+	unlinkEntry(*entry);
+	resident_bytes -= entry->size;
+	recycleGeometry(MoveTemp(entry->geometry));
+	entries.Remove(entry->params);
+}
+
+void FGearMeshCache::recycleGeometry(TSharedPtr<FGearMeshData>&& geometry)
+{
+	//Geometry still used by a gear cannot be written to
+	if (geometry.IsUnique() && spare_geometry.Num() < MAX_SPARE_GEOMETRY) {
+		spare_geometry.Add(MoveTemp(geometry));
+	}
+	geometry.Reset();
+}
@@ -0,0 +1,492 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GearMeshComponent.h"
+#include "PhysicsEngine/BodySetup.h"
+#include "Physics/PhysicsInterfaceCore.h"
+#include "PrimitiveSceneProxy.h"
+#include "SceneManagement.h"
+#include "StaticMeshResources.h"
+#include "LocalVertexFactory.h"
+#include "RawIndexBuffer.h"
+#include "RenderingThread.h"
+#include "Engine/Engine.h"
+#include "Materials/Material.h"
+#include "Materials/MaterialRenderProxy.h"
+#include "MaterialDomain.h"
+#include "HAL/IConsoleManager.h"
+
+static TAutoConsoleVariable<int32> CVarGearForceLOD(
+	TEXT("gears.LOD.Force"),
+	-1,
+	TEXT("Draws every gear mesh with this LOD. -1 picks the LOD from the screen size."),
+	ECVF_RenderThreadSafe);
+
+using FGearTangentDatum = TStaticMeshVertexTangentDatum<EStaticMeshVertexTangentBasisType::Default>;
+
+//Vertex data in the layout of the render buffers, built on the game thread
+struct FGearVertexData
+{
+	TArray<FVector3f> positions;
+	TArray<FGearTangentDatum> tangents;
+
+	explicit FGearVertexData(const FGearMeshData& geometry)
+	{
+		auto num_verts = geometry.verts.Num();
+		positions.SetNumUninitialized(num_verts);
+		tangents.SetNumUninitialized(num_verts);
+
+		//Gears have no normal maps. The tangent runs around the gear axis, faces looking along the axis take the X axis
+		const FVector3f axis(0.0f, 1.0f, 0.0f);
+		for (int32 i = 0; i < num_verts; i++) {
+			positions[i] = FVector3f(geometry.verts[i]);
+			auto normal = FVector3f(geometry.normals[i]);
+			auto tangent_x = (axis ^ normal).GetSafeNormal();
+			if (tangent_x.IsZero()) {
+				tangent_x = FVector3f(1.0f, 0.0f, 0.0f);
+			}
+			tangents[i].SetTangents(tangent_x, normal ^ tangent_x, normal);
+		}
+	}
+};
+
+//Vertex buffer with a shader resource view for manual vertex fetch. Buffers that are rewritten in place are created
+//dynamic, locking a static buffer for writing is slow or unsupported on some RHIs
+template<typename ElementType>
+class TGearVertexBuffer final : public FVertexBuffer
+{
+public:
+	FShaderResourceViewRHIRef srv;
+
+	TGearVertexBuffer(bool dynamic, uint32 srv_stride, EPixelFormat srv_format)
+		: dynamic(dynamic)
+		, srv_stride(srv_stride)
+		, srv_format(srv_format)
+	{
+	}
+
+	//Initial contents, handed to the RHI when the resource initializes
+	void setData(const TArray<ElementType>& data)
+	{
+		initial_data.Reset();
+		initial_data.Append(data.GetData(), data.Num());
+		size = data.Num() * sizeof(ElementType);
+	}
+
+	uint32 getSize() const
+	{
+		return size;
+	}
+
+	virtual void InitRHI() override
+	{
+		FRHIResourceCreateInfo create_info(TEXT("FGearMeshVertexBuffer"), &initial_data);
+		VertexBufferRHI = RHICreateVertexBuffer(size, (dynamic ? BUF_Dynamic : BUF_Static) | BUF_ShaderResource, create_info);
+		if (VertexBufferRHI && RHISupportsManualVertexFetch(GMaxRHIShaderPlatform)) {
+			srv = RHICreateShaderResourceView(VertexBufferRHI, srv_stride, uint8(srv_format));
+		}
+	}
+
+	virtual void ReleaseRHI() override
+	{
+		srv.SafeRelease();
+		FVertexBuffer::ReleaseRHI();
+	}
+
+	void write_RenderThread(const TArray<ElementType>& data)
+	{
+		check(dynamic && uint32(data.Num() * sizeof(ElementType)) == size);
+		auto buffer = RHILockBuffer(VertexBufferRHI, 0, size, RLM_WriteOnly);
+		FMemory::Memcpy(buffer, data.GetData(), size);
+		RHIUnlockBuffer(VertexBufferRHI);
+	}
+
+private:
+	//Emptied by the RHI once it is uploaded
+	TResourceArray<ElementType, VERTEXBUFFER_ALIGNMENT> initial_data;
+	uint32 size = 0;
+	bool dynamic;
+	uint32 srv_stride;
+	EPixelFormat srv_format;
+};
+
+//Render buffers of one LOD
+struct FGearMeshLODResources
+{
+	TGearVertexBuffer<FVector3f> position_buffer;
+	TGearVertexBuffer<FGearTangentDatum> tangent_buffer;
+	TGearVertexBuffer<FVector2DHalf> uv_buffer;
+	FLocalVertexFactory vertex_factory;
+	FRawStaticIndexBuffer index_buffer;
+	int32 num_verts = 0;
+	int32 num_indices = 0;
+
+	FGearMeshLODResources(ERHIFeatureLevel::Type feature_level)
+		: position_buffer(true, sizeof(float), PF_R32_FLOAT)
+		, tangent_buffer(true, sizeof(FPackedNormal), PF_R8G8B8A8_SNORM)
+		, uv_buffer(false, sizeof(FVector2DHalf), PF_G16R16F)
+		, vertex_factory(feature_level, "FGearMeshSceneProxy")
+		, index_buffer(false)
+	{
+	}
+
+	//Fills the buffers and queues their upload. Returns their size
+	SIZE_T init(const FGearMeshData& geometry)
+	{
+		FGearVertexData vertex_data(geometry);
+		num_verts = vertex_data.positions.Num();
+
+		position_buffer.setData(vertex_data.positions);
+		tangent_buffer.setData(vertex_data.tangents);
+		TArray<FVector2DHalf> uvs;
+		uvs.SetNumZeroed(num_verts);
+		uv_buffer.setData(uvs);
+
+		TArray<uint32> indices(reinterpret_cast<const uint32*>(geometry.indices.GetData()), geometry.indices.Num());
+		index_buffer.SetIndices(indices, num_verts <= MAX_uint16 + 1 ? EIndexBufferStride::Force16Bit : EIndexBufferStride::Force32Bit);
+		num_indices = indices.Num();
+
+		auto buffer_size = position_buffer.getSize() + tangent_buffer.getSize() + uv_buffer.getSize() + index_buffer.GetIndexDataSize();
+
+		ENQUEUE_RENDER_COMMAND(InitGearMeshBuffers)(
+			[this](FRHICommandListImmediate& RHICmdList) {
+				position_buffer.InitResource();
+				tangent_buffer.InitResource();
+				uv_buffer.InitResource();
+
+				FLocalVertexFactory::FDataType data;
+				data.PositionComponent = FVertexStreamComponent(&position_buffer, 0, sizeof(FVector3f), VET_Float3);
+				data.PositionComponentSRV = position_buffer.srv;
+				data.TangentBasisComponents[0] = FVertexStreamComponent(&tangent_buffer, STRUCT_OFFSET(FGearTangentDatum, TangentX), sizeof(FGearTangentDatum), VET_PackedNormal);
+				data.TangentBasisComponents[1] = FVertexStreamComponent(&tangent_buffer, STRUCT_OFFSET(FGearTangentDatum, TangentZ), sizeof(FGearTangentDatum), VET_PackedNormal);
+				data.TangentsSRV = tangent_buffer.srv;
+				data.TextureCoordinates.Add(FVertexStreamComponent(&uv_buffer, 0, sizeof(FVector2DHalf), VET_Half2));
+				data.TextureCoordinatesSRV = uv_buffer.srv;
+				data.LightMapCoordinateComponent = data.TextureCoordinates[0];
+				data.LightMapCoordinateIndex = 0;
+				data.NumTexCoords = 1;
+				//Gears are not vertex colored, every vertex reads the same white
+				FColorVertexBuffer::BindDefaultColorVertexBuffer(&vertex_factory, data, FColorVertexBuffer::NullBindStride::ZeroForDefaultBufferBind);
+				vertex_factory.SetData(data);
+				vertex_factory.InitResource();
+
+				index_buffer.InitResource();
+			});
+
+		return buffer_size;
+	}
+
+	void release()
+	{
+		position_buffer.ReleaseResource();
+		tangent_buffer.ReleaseResource();
+		uv_buffer.ReleaseResource();
+		vertex_factory.ReleaseResource();
+		index_buffer.ReleaseResource();
+	}
+
+	//Only valid for vertex data with the topology the buffers were created with
+	void updateVertices_RenderThread(const FGearVertexData& vertex_data)
+	{
+		check(IsInRenderingThread());
+		check(vertex_data.positions.Num() == num_verts);
+
+		position_buffer.write_RenderThread(vertex_data.positions);
+		tangent_buffer.write_RenderThread(vertex_data.tangents);
+	}
+};
+
+class FGearMeshSceneProxy final : public FPrimitiveSceneProxy
+{
+public:
+	FGearMeshSceneProxy(UGearMeshComponent* component)
+		: FPrimitiveSceneProxy(component)
+		, material_relevance(component->GetMaterialRelevance(GetScene().GetFeatureLevel()))
+	{
+		for (const auto& lod_geometry : component->getLODs()) {
+			auto& lod = lods.Emplace_GetRef(MakeUnique<FGearMeshLODResources>(GetScene().GetFeatureLevel()));
+			buffer_size += lod->init(*lod_geometry);
+		}
+
+		material = component->GetMaterial(0);
+		if (!material) {
+			material = UMaterial::GetDefaultMaterial(MD_Surface);
+		}
+	}
+
+	virtual ~FGearMeshSceneProxy()
+	{
+		for (auto& lod : lods) {
+			lod->release();
+		}
+	}
+
+	SIZE_T getBufferSize() const
+	{
+		return buffer_size;
+	}
+
+	//One vertex data per LOD, with the topology the buffers were created with
+	void updateVertices_RenderThread(const TArray<FGearVertexData>& lod_vertex_data)
+	{
+		check(lod_vertex_data.Num() == lods.Num());
+		for (int32 lod = 0; lod < lods.Num(); lod++) {
+			lods[lod]->updateVertices_RenderThread(lod_vertex_data[lod]);
+		}
+	}
+
+	int32 getLOD(const FSceneView& view) const
+	{
+		auto forced_lod = CVarGearForceLOD.GetValueOnRenderThread();
+		if (forced_lod >= 0) {
+			return FMath::Min(forced_lod, lods.Num() - 1);
+		}
+
+		const auto& bounds = GetBounds();
+		return FMath::Min(UGearMeshComponent::selectLOD(ComputeBoundsScreenSize(bounds.Origin, bounds.SphereRadius, view)), lods.Num() - 1);
+	}
+
+	virtual void GetDynamicMeshElements(const TArray<const FSceneView*>& Views, const FSceneViewFamily& ViewFamily, uint32 VisibilityMap, FMeshElementCollector& Collector) const override
+	{
+		auto wireframe = AllowDebugViewmodes() && ViewFamily.EngineShowFlags.Wireframe;
+
+		auto material_proxy = material->GetRenderProxy();
+		if (wireframe) {
+			auto wireframe_material = new FColoredMaterialRenderProxy(GEngine->WireframeMaterial ? GEngine->WireframeMaterial->GetRenderProxy() : nullptr, FLinearColor(0, 0.5f, 1.f));
+			Collector.RegisterOneFrameMaterialProxy(wireframe_material);
+			material_proxy = wireframe_material;
+		}
+
+		for (int32 view_index = 0; view_index < Views.Num(); view_index++) {
+			if (!(VisibilityMap & (1 << view_index))) {
+				continue;
+			}
+
+			const auto& lod = *lods[getLOD(*Views[view_index])];
+			auto& mesh_batch = Collector.AllocateMesh();
+			mesh_batch.bWireframe = wireframe;
+			mesh_batch.VertexFactory = &lod.vertex_factory;
+			mesh_batch.MaterialRenderProxy = material_proxy;
+
+			bool has_precomputed_volumetric_lightmap;
+			FMatrix previous_local_to_world;
+			int32 single_capture_index;
+			bool output_velocity;
+			GetScene().GetPrimitiveUniformShaderParameters_RenderThread(GetPrimitiveSceneInfo(), has_precomputed_volumetric_lightmap, previous_local_to_world, single_capture_index, output_velocity);
+			output_velocity |= AlwaysHasVelocity();
+
+			auto& uniform_buffer = Collector.AllocateOneFrameResource<FDynamicPrimitiveUniformBuffer>();
+			uniform_buffer.Set(GetLocalToWorld(), previous_local_to_world, GetBounds(), GetLocalBounds(), GetLocalBounds(), true, has_precomputed_volumetric_lightmap, output_velocity, GetCustomPrimitiveData());
+
+			auto& batch_element = mesh_batch.Elements[0];
+			batch_element.PrimitiveUniformBufferResource = &uniform_buffer.UniformBuffer;
+			batch_element.IndexBuffer = &lod.index_buffer;
+			batch_element.FirstIndex = 0;
+			batch_element.NumPrimitives = lod.num_indices / 3;
+			batch_element.MinVertexIndex = 0;
+			batch_element.MaxVertexIndex = lod.num_verts - 1;
+			mesh_batch.ReverseCulling = IsLocalToWorldDeterminantNegative();
+			mesh_batch.Type = PT_TriangleList;
+			mesh_batch.DepthPriorityGroup = SDPG_World;
+			mesh_batch.bCanApplyViewModeOverrides = false;
+			Collector.AddMesh(view_index, mesh_batch);
+		}
+	}
+
+	virtual FPrimitiveViewRelevance GetViewRelevance(const FSceneView* View) const override
+	{
+		FPrimitiveViewRelevance result;
+		result.bDrawRelevance = IsShown(View);
+		result.bShadowRelevance = IsShadowCast(View);
+		result.bDynamicRelevance = true;
+		result.bRenderInMainPass = ShouldRenderInMainPass();
+		result.bUsesLightingChannels = GetLightingChannelMask() != GetDefaultLightingChannelMask();
+		result.bRenderCustomDepth = ShouldRenderCustomDepth();
+		result.bTranslucentSelfShadow = bCastVolumetricTranslucentShadow;
+		material_relevance.SetPrimitiveViewRelevance(result);
+		result.bVelocityRelevance = DrawsVelocity() && result.bOpaque && result.bRenderInMainPass;
+		return result;
+	}
+
+	virtual bool CanBeOccluded() const override
+	{
+		return !material_relevance.bDisableDepthTest;
+	}
+
+	virtual uint32 GetMemoryFootprint() const override
+	{
+		return sizeof(*this) + GetAllocatedSize();
+	}
+
+	virtual SIZE_T GetTypeHash() const override
+	{
+		static size_t unique_pointer;
+		return reinterpret_cast<size_t>(&unique_pointer);
+	}
+
+private:
+	TArray<TUniquePtr<FGearMeshLODResources>, TInlineAllocator<GearGeometry::LOD_COUNT>> lods;
+	SIZE_T buffer_size = 0;
+
+	UMaterialInterface* material = nullptr;
+	FMaterialRelevance material_relevance;
+};
+
+void UGearMeshComponent::setGeometry(const FGearLODGeometry& new_lods)
+{
+	if (lods == new_lods) {
+		return;
+	}
+
+	//Rebuilding a gear with other dimensions keeps the vertex and index counts, only the positions and normals move
+	auto same_topology = lods.Num() > 0 && lods.Num() == new_lods.Num();
+	for (int32 lod = 0; same_topology && lod < lods.Num(); lod++) {
+		same_topology = lods[lod]->verts.Num() == new_lods[lod]->verts.Num() && lods[lod]->indices == new_lods[lod]->indices;
+	}
+
+	lods = new_lods;
+	local_box = lods.Num() > 0 ? FBox(lods[0]->verts) : FBox(ForceInit);
+
+	if (same_topology && SceneProxy && !IsRenderStateDirty()) {
+		TArray<FGearVertexData> lod_vertex_data;
+		for (const auto& lod_geometry : lods) {
+			lod_vertex_data.Emplace(*lod_geometry);
+		}
+
+		ENQUEUE_RENDER_COMMAND(UpdateGearMeshVertices)(
+			[proxy = static_cast<FGearMeshSceneProxy*>(SceneProxy), lod_vertex_data = MoveTemp(lod_vertex_data)](FRHICommandListImmediate& RHICmdList) {
+				proxy->updateVertices_RenderThread(lod_vertex_data);
+			});
+
+		UpdateBounds();
+		MarkRenderTransformDirty();
+	}
+	else {
+		MarkRenderStateDirty();
+	}
+}
+
+TSharedPtr<const FGearMeshData> UGearMeshComponent::getGeometry() const
+{
+	return lods.Num() > 0 ? lods[0] : nullptr;
+}
+
+const FGearLODGeometry& UGearMeshComponent::getLODs() const
+{
+	return lods;
+}
+
+int32 UGearMeshComponent::selectLOD(float screen_size)
+{
+	int32 lod = 0;
+	while (lod + 1 < GearGeometry::LOD_COUNT && screen_size < GearGeometry::LOD_SCREEN_SIZES[lod + 1]) {
+		lod++;
+	}
+	return lod;
+}
+
+void UGearMeshComponent::setSharedBodySetup(UBodySetup* body_setup)
+{
+	if (shared_body_setup == body_setup) {
+		return;
+	}
+
+	shared_body_setup = body_setup;
+	RecreatePhysicsState();
+}
+
+UBodySetup* UGearMeshComponent::getSharedBodySetup() const
+{
+	return shared_body_setup;
+}
+
+void UGearMeshComponent::setMassProperties(float mass_kg, const FVector& mass_inertia)
+{
+	has_mass_properties = true;
+	mass = mass_kg;
+	inertia = mass_inertia;
+	BodyInstance.SetMassOverride(mass, true);
+	applyMassProperties();
+}
+
+uint32 UGearMeshComponent::getPhysicsStateSerial() const
+{
+	return physics_state_serial;
+}
+
+SIZE_T UGearMeshComponent::getGPUMemory() const
+{
+	return gpu_memory;
+}
+
+uint32 UGearMeshComponent::getRenderBufferSerial() const
+{
+	return render_buffer_serial;
+}
+
+FPrimitiveSceneProxy* UGearMeshComponent::CreateSceneProxy()
+{
+	gpu_memory = 0;
+	if (lods.Num() == 0 || lods[0]->indices.Num() == 0) {
+		return nullptr;
+	}
+
+	auto proxy = new FGearMeshSceneProxy(this);
+	gpu_memory = proxy->getBufferSize();
+	render_buffer_serial++;
+	return proxy;
+}
+
+FBoxSphereBounds UGearMeshComponent::CalcBounds(const FTransform& LocalToWorld) const
+{
+	if (!local_box.IsValid) {
+		return FBoxSphereBounds(LocalToWorld.GetLocation(), FVector::ZeroVector, 0.0f);
+	}
+	return FBoxSphereBounds(local_box).TransformBy(LocalToWorld);
+}
+
+int32 UGearMeshComponent::GetNumMaterials() const
+{
+	return 1;
+}
+
+UBodySetup* UGearMeshComponent::GetBodySetup()
+{
+	return shared_body_setup;
+}
+
+void UGearMeshComponent::GetResourceSizeEx(FResourceSizeEx& CumulativeResourceSize)
+{
+	Super::GetResourceSizeEx(CumulativeResourceSize);
+
+	CumulativeResourceSize.AddDedicatedSystemMemoryBytes(lods.GetAllocatedSize());
+	//The geometry is shared with the mesh cache and other gears, so only the total counts it
+	if (CumulativeResourceSize.GetResourceSizeMode() == EResourceSizeMode::EstimatedTotal) {
+		for (const auto& lod_geometry : lods) {
+			CumulativeResourceSize.AddDedicatedSystemMemoryBytes(lod_geometry->GetAllocatedSize());
+		}
+	}
+	CumulativeResourceSize.AddDedicatedVideoMemoryBytes(gpu_memory);
+}
+
+void UGearMeshComponent::OnCreatePhysicsState()
+{
+	Super::OnCreatePhysicsState();
+
+	physics_state_serial++;
+	applyMassProperties();
+}
+
+void UGearMeshComponent::applyMassProperties()
+{
+	if (!has_mass_properties || !BodyInstance.IsValidBodyInstance()) {
+		return;
+	}
+
+	//The gear is symmetric around its axis, so the center of mass stays at the origin
+	FPhysicsCommand::ExecuteWrite(BodyInstance.ActorHandle, [this](const FPhysicsActorHandle& actor) {
+		FPhysicsInterface::SetMass_AssumesLocked(actor, mass);
+		FPhysicsInterface::SetMassSpaceInertiaTensor_AssumesLocked(actor, inertia);
+		FPhysicsInterface::SetComLocalPose_AssumesLocked(actor, FTransform::Identity);
+	});
+}
@@ -0,0 +1,131 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GearTrain.h"
+#include "Async/ParallelFor.h"
+
+int32 FGearTrain::addGear(unsigned int teeth_count, double start_phase)
+{
+	teeth.Add(teeth_count);
+	angular_velocity.Add(0.0);
+	phase.Add(start_phase);
+	driven.Add(false);
+	return connections.AddDefaulted();
+}
+
+void FGearTrain::addMesh(int32 gear_a, int32 gear_b)
+{
+	connect(gear_a, gear_b, -double(teeth[gear_a]) / double(teeth[gear_b]));
+}
+
+void FGearTrain::addShaft(int32 gear_a, int32 gear_b)
+{
+	connect(gear_a, gear_b, 1.0);
+}
+
+void FGearTrain::setDriver(int32 gear, double rpm)
+{
+	for (auto& driver : drivers) {
+		if (driver.Key == gear) {
+			driver.Value = rpm;
+			return;
+		}
+	}
+	drivers.Emplace(gear, rpm);
+}
+
+void FGearTrain::clearDrivers()
+{
+	drivers.Reset();
+}
+
+void FGearTrain::Reset()
+{
+	teeth.Reset();
+	angular_velocity.Reset();
+	phase.Reset();
+	driven.Reset();
+	connections.Reset();
+	drivers.Reset();
+}
+
+bool FGearTrain::solve()
+{
+	for (int32 gear = 0; gear < Num(); gear++) {
+		angular_velocity[gear] = 0.0;
+		driven[gear] = false;
+	}
+
+	auto consistent = true;
+	TArray<int32> queue;
+	queue.Reserve(Num());
+
+	for (const auto& driver : drivers) {
+		auto driver_velocity = driver.Value / 60.0 * 2.0 * PI;
+		if (driven[driver.Key]) {
+			consistent &= FMath::IsNearlyEqual(angular_velocity[driver.Key], driver_velocity, KINDA_SMALL_NUMBER * FMath::Max(1.0, FMath::Abs(driver_velocity)));
+			continue;
+		}
+
+		angular_velocity[driver.Key] = driver_velocity;
+		driven[driver.Key] = true;
+		queue.Reset();
+		queue.Add(driver.Key);
+
+		//Breadth first through every gear connected to this driver
+		for (int32 next = 0; next < queue.Num(); next++) {
+			auto gear = queue[next];
+			for (const auto& connection : connections[gear]) {
+				auto velocity = angular_velocity[gear] * connection.ratio;
+				if (driven[connection.gear]) {
+					consistent &= FMath::IsNearlyEqual(angular_velocity[connection.gear], velocity, KINDA_SMALL_NUMBER * FMath::Max(1.0, FMath::Abs(velocity)));
+					continue;
+				}
+
+				angular_velocity[connection.gear] = velocity;
+				driven[connection.gear] = true;
+				queue.Add(connection.gear);
+			}
+		}
+	}
+
+	return consistent;
+}
+
+void FGearTrain::advance(double delta_seconds, bool parallel)
+{
+	ParallelFor(Num(), [this, delta_seconds](int32 gear) {
+		phase[gear] = FMath::Fmod(phase[gear] + angular_velocity[gear] * delta_seconds, 2.0 * PI);
+	}, !parallel);
+}
+
+int32 FGearTrain::Num() const
+{
+	return connections.Num();
+}
+
+double FGearTrain::getAngularVelocity(int32 gear) const
+{
+	return angular_velocity[gear];
+}
+
+double FGearTrain::getRPM(int32 gear) const
+{
+	return angular_velocity[gear] * 60.0 / (2.0 * PI);
+}
+
+double FGearTrain::getPhase(int32 gear) const
+{
+	return phase[gear];
+}
+
+bool FGearTrain::isDriven(int32 gear) const
+{
+	return driven[gear];
+}
+
+void FGearTrain::connect(int32 gear_a, int32 gear_b, double ratio)
+{
+	connections[gear_a].Add({ gear_b, ratio });
+	connections[gear_b].Add({ gear_a, 1.0 / ratio });
+}
@@ -0,0 +1,522 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GearTrainSubsystem.h"
+#include "Gears.h"
+#include "GearCoupling.h"
+#include "GearAssembly.h"
+#include "GearInstancer.h"
+#include "ProceduralGear.h"
+#include "Async/ParallelFor.h"
+#include "Components/PrimitiveComponent.h"
+#include "EngineUtils.h"
+#include "HAL/IConsoleManager.h"
+#include "PBDRigidsSolver.h"
+#include "Physics/Experimental/PhysScene_Chaos.h"
+
+static TAutoConsoleVariable<int32> CVarGearTrainParallelThreshold(
+	TEXT("gears.Train.ParallelThreshold"),
+	4096,
+	TEXT("Number of gears above which the gear train phases are advanced with ParallelFor. 0 disables the parallel path."));
+
+static TAutoConsoleVariable<int32> CVarGearCouplingIterations(
+	TEXT("gears.Coupling.Iterations"),
+	4,
+	TEXT("Iterations over all gear ratio couplings in every physics step."));
+
+static TAutoConsoleVariable<float> CVarGearCouplingBias(
+	TEXT("gears.Coupling.Bias"),
+	0.2f,
+	TEXT("Fraction of the angle drift of coupled gears removed every frame, in its first physics substep."));
+
+void UGearTrainSubsystem::addGear(AProceduralGear* gear)
+{
+	if (!gear || gear_indices.Contains(gear)) {
+		return;
+	}
+
+	auto index = gears.Add(gear);
+	rpms.Add(gear->getRPM());
+	drive_strengths.Add(gear->getVelocityStrength());
+	driving_flags.Add(gear->hasRotationApplied());
+	kinematic_flags.Add(gear->getDriveMode() == EGearDriveMode::Kinematic);
+	coupled_flags.Add(gear->getDriveMode() == EGearDriveMode::Coupled);
+	drive_dirty_flags.Add(!kinematic_flags[index]);
+	windowed_flags.Add(gear->usesMeshingWindow());
+	rotations.Add(FQuat::Identity);
+	gear_indices.Add(gear, index);
+
+	//Physics drives are set up right away, the same as when gears configured them in BeginPlay
+	any_drive_dirty |= drive_dirty_flags[index];
+	applyPhysicsDrives();
+	dirty = true;
+}
+
+void UGearTrainSubsystem::removeGear(AProceduralGear* gear)
+{
+	int32 index;
+	if (!gear_indices.RemoveAndCopyValue(gear, index)) {
+		return;
+	}
+
+	gears.RemoveAtSwap(index);
+	rpms.RemoveAtSwap(index);
+	drive_strengths.RemoveAtSwap(index);
+	driving_flags.RemoveAtSwap(index);
+	kinematic_flags.RemoveAtSwap(index);
+	coupled_flags.RemoveAtSwap(index);
+	drive_dirty_flags.RemoveAtSwap(index);
+	windowed_flags.RemoveAtSwap(index);
+	rotations.RemoveAtSwap(index);
+	if (gears.IsValidIndex(index)) {
+		gear_indices[gears[index]] = index;
+	}
+	dirty = true;
+}
+
+void UGearTrainSubsystem::markDirty()
+{
+	dirty = true;
+}
+
+void UGearTrainSubsystem::setRPM(const AProceduralGear* gear, float rpm)
+{
+	auto index = getGearIndex(gear);
+	if (index == INDEX_NONE) {
+		return;
+	}
+
+	rpms[index] = rpm;
+	drivers_dirty |= kinematic_flags[index];
+	drive_dirty_flags[index] = !kinematic_flags[index];
+	any_drive_dirty |= drive_dirty_flags[index];
+}
+
+void UGearTrainSubsystem::setDriveStrength(const AProceduralGear* gear, float strength)
+{
+	auto index = getGearIndex(gear);
+	if (index == INDEX_NONE) {
+		return;
+	}
+
+	drive_strengths[index] = strength;
+	drive_dirty_flags[index] = !kinematic_flags[index];
+	any_drive_dirty |= drive_dirty_flags[index];
+}
+
+void UGearTrainSubsystem::setDriving(const AProceduralGear* gear, bool driving)
+{
+	auto index = getGearIndex(gear);
+	if (index == INDEX_NONE) {
+		return;
+	}
+
+	driving_flags[index] = driving;
+	drivers_dirty |= kinematic_flags[index];
+	drive_dirty_flags[index] = !kinematic_flags[index];
+	any_drive_dirty |= drive_dirty_flags[index];
+}
+
+void UGearTrainSubsystem::setMeshingWindow(const AProceduralGear* gear, bool enabled)
+{
+	auto index = getGearIndex(gear);
+	if (index != INDEX_NONE) {
+		windowed_flags[index] = enabled;
+	}
+}
+
+void UGearTrainSubsystem::addRack(const AProceduralGear* gear, UPrimitiveComponent* rack, const FVector& direction)
+{
+	removeRack(gear, rack);
+	racks.Add({ gear, rack, direction.GetSafeNormal() });
+	dirty = true;
+}
+
+void UGearTrainSubsystem::removeRack(const AProceduralGear* gear, UPrimitiveComponent* rack)
+{
+	if (racks.RemoveAll([gear, rack](const FRack& existing) { return existing.gear == gear && existing.rack == rack; }) > 0) {
+		dirty = true;
+	}
+}
+
+int32 UGearTrainSubsystem::getCouplingCount() const
+{
+	return couplings.Num();
+}
+
+void UGearTrainSubsystem::requestRebuild(AProceduralGear* gear)
+{
+	pending_rebuilds.Add(gear);
+}
+
+void UGearTrainSubsystem::flushRebuilds()
+{
+	//Rebuilding can queue more gears, for example when the collision mode follows a new meshing partner
+	TArray<AProceduralGear*> rebuilds;
+	while (!pending_rebuilds.IsEmpty()) {
+		rebuilds.Reset();
+		for (const auto& pending_rebuild : pending_rebuilds) {
+			if (auto gear = pending_rebuild.Get()) {
+				rebuilds.Add(gear);
+			}
+		}
+		pending_rebuilds.Reset();
+
+		AProceduralGear::generateGears(rebuilds);
+	}
+}
+
+void UGearTrainSubsystem::addAssembly(AGearAssembly* assembly)
+{
+	assemblies.AddUnique(assembly);
+}
+
+void UGearTrainSubsystem::removeAssembly(AGearAssembly* assembly)
+{
+	assemblies.Remove(assembly);
+}
+
+void UGearTrainSubsystem::addInstancer(AGearInstancer* instancer)
+{
+	instancers.AddUnique(instancer);
+}
+
+void UGearTrainSubsystem::removeInstancer(AGearInstancer* instancer)
+{
+	instancers.Remove(instancer);
+}
+
+void UGearTrainSubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	TArray<AProceduralGear*> level_gears;
+	for (TActorIterator<AProceduralGear> gear(&InWorld); gear; ++gear) {
+		level_gears.Add(*gear);
+	}
+	AProceduralGear::generateGears(level_gears);
+
+	//Couplings go to the solver right before every step, once the game thread is done changing bodies for the frame
+	if (auto physics_scene = InWorld.GetPhysicsScene()) {
+		coupling_callback = physics_scene->GetSolver()->CreateAndRegisterSimCallbackObject_External<FGearCouplingCallback>();
+		physics_pre_tick_handle = physics_scene->OnPhysScenePreTick.AddUObject(this, &UGearTrainSubsystem::pushCouplings);
+	}
+}
+
+void UGearTrainSubsystem::Deinitialize()
+{
+	if (auto physics_scene = GetWorld()->GetPhysicsScene()) {
+		physics_scene->OnPhysScenePreTick.Remove(physics_pre_tick_handle);
+		if (coupling_callback) {
+			physics_scene->GetSolver()->UnregisterAndFreeSimCallbackObject_External(coupling_callback);
+		}
+	}
+	coupling_callback = nullptr;
+
+	Super::Deinitialize();
+}
+
+void UGearTrainSubsystem::updateGears(float delta_seconds)
+{
+	if (dirty) {
+		rebuildTrain();
+	}
+	else if (drivers_dirty) {
+		updateDrivers();
+	}
+
+	applyPhysicsDrives();
+
+	auto parallel_threshold = CVarGearTrainParallelThreshold.GetValueOnGameThread();
+	auto parallel = parallel_threshold > 0 && gears.Num() > parallel_threshold;
+	train.advance(delta_seconds, parallel);
+
+	ParallelFor(gears.Num(), [this](int32 index) {
+		rotations[index] = FQuat(FVector::YAxisVector, train.getPhase(index));
+	}, !parallel);
+
+	//Components can only be moved on the game thread
+	for (int32 index = 0; index < gears.Num(); index++) {
+		if (kinematic_flags[index]) {
+			gears[index]->setKinematicRotation(rotations[index]);
+		}
+		if (windowed_flags[index]) {
+			gears[index]->updateMeshingWindow();
+		}
+	}
+
+	updateRenderers();
+}
+
+const FGearTrain& UGearTrainSubsystem::getTrain() const
+{
+	return train;
+}
+
+int32 UGearTrainSubsystem::getGearIndex(const AProceduralGear* gear) const
+{
+	auto index = gear_indices.Find(gear);
+	return index ? *index : INDEX_NONE;
+}
+
+void UGearTrainSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	flushRebuilds();
+	updateGears(DeltaTime);
+}
+
+TStatId UGearTrainSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UGearTrainSubsystem, STATGROUP_Tickables);
+}
+
+void UGearTrainSubsystem::rebuildTrain()
+{
+	dirty = false;
+
+	//Keep the current phases, gear indices change when gears are removed
+	TMap<const AProceduralGear*, double> phases;
+	for (int32 index = 0; index < train_gears.Num(); index++) {
+		phases.Add(train_gears[index], train.getPhase(index));
+	}
+	train_gears = gears;
+
+	train.Reset();
+	for (auto gear : gears) {
+		auto phase = phases.Find(gear);
+		train.addGear(gear->getNumberOfTeeth(), phase ? *phase : 0.0);
+	}
+
+	//Only kinematic gears take part in the train. Partners can list each other, so connect every pair once
+	TSet<TPair<int32, int32>> meshes;
+	TSet<TPair<int32, int32>> shafts;
+	for (int32 index = 0; index < gears.Num(); index++) {
+		if (!kinematic_flags[index]) {
+			continue;
+		}
+
+		for (const auto& partner : gears[index]->getMeshingGears()) {
+			auto partner_index = getGearIndex(partner.Get());
+			if (partner_index != INDEX_NONE && partner_index != index && kinematic_flags[partner_index]) {
+				meshes.Add(TPair<int32, int32>(FMath::Min(index, partner_index), FMath::Max(index, partner_index)));
+			}
+		}
+		for (const auto& partner : gears[index]->getShaftGears()) {
+			auto partner_index = getGearIndex(partner.Get());
+			if (partner_index != INDEX_NONE && partner_index != index && kinematic_flags[partner_index]) {
+				shafts.Add(TPair<int32, int32>(FMath::Min(index, partner_index), FMath::Max(index, partner_index)));
+			}
+		}
+	}
+
+	for (const auto& mesh : meshes) {
+		train.addMesh(mesh.Key, mesh.Value);
+	}
+	for (const auto& shaft : shafts) {
+		train.addShaft(shaft.Key, shaft.Value);
+	}
+
+	rebuildCouplings();
+	updateDrivers();
+}
+
+void UGearTrainSubsystem::rebuildCouplings()
+{
+	//Coupled pairs follow the same rules as the kinematic train: z_a * w_a + z_b * w_b = 0 when meshing, w_a = w_b on a shaft
+	TSet<TPair<int32, int32>> meshes;
+	TSet<TPair<int32, int32>> shafts;
+	for (int32 index = 0; index < gears.Num(); index++) {
+		if (!coupled_flags[index]) {
+			continue;
+		}
+
+		for (const auto& partner : gears[index]->getMeshingGears()) {
+			auto partner_index = getGearIndex(partner.Get());
+			if (partner_index != INDEX_NONE && partner_index != index && coupled_flags[partner_index]) {
+				meshes.Add(TPair<int32, int32>(FMath::Min(index, partner_index), FMath::Max(index, partner_index)));
+			}
+		}
+		for (const auto& partner : gears[index]->getShaftGears()) {
+			auto partner_index = getGearIndex(partner.Get());
+			if (partner_index != INDEX_NONE && partner_index != index && coupled_flags[partner_index]) {
+				shafts.Add(TPair<int32, int32>(FMath::Min(index, partner_index), FMath::Max(index, partner_index)));
+			}
+		}
+	}
+
+	//Drift is measured from the angles the couplings start at
+	couplings.Reset();
+	for (const auto& mesh : meshes) {
+		auto& coupling = couplings.AddDefaulted_GetRef();
+		coupling.gear_a = mesh.Key;
+		coupling.gear_b = mesh.Value;
+		coupling.ratio_a = gears[mesh.Key]->getNumberOfTeeth();
+		coupling.ratio_b = gears[mesh.Value]->getNumberOfTeeth();
+	}
+	for (const auto& shaft : shafts) {
+		auto& coupling = couplings.AddDefaulted_GetRef();
+		coupling.gear_a = shaft.Key;
+		coupling.gear_b = shaft.Value;
+	}
+
+	//Rack travel is the arc the reference circle rolls, v = w * r
+	for (int32 rack = 0; rack < racks.Num(); rack++) {
+		auto gear_index = getGearIndex(racks[rack].gear);
+		if (gear_index == INDEX_NONE || !coupled_flags[gear_index]) {
+			continue;
+		}
+
+		auto& coupling = couplings.AddDefaulted_GetRef();
+		coupling.gear_a = gear_index;
+		coupling.rack = rack;
+		coupling.ratio_a = gears[gear_index]->getRefDiameter() / 2.0;
+	}
+}
+
+//Angle of the mesh of a gear about its axis, relative to the actor
+static double getGearTwist(const AProceduralGear* gear)
+{
+	auto relative = gear->GetActorQuat().Inverse() * gear->getMeshTransform().GetRotation();
+	return 2.0 * FMath::Atan2(relative.Y, relative.W);
+}
+
+void UGearTrainSubsystem::pushCouplings(FPhysScene_Chaos* physics_scene, float delta_seconds)
+{
+	//Gears removed since the last update left the coupling indices behind
+	if (dirty) {
+		rebuildTrain();
+	}
+	if (!coupling_callback || couplings.IsEmpty()) {
+		return;
+	}
+
+	auto input = coupling_callback->GetProducerInputData_External();
+	input->Reset();
+	input->iterations = FMath::Max(CVarGearCouplingIterations.GetValueOnGameThread(), 1);
+	input->bias = FMath::Clamp(CVarGearCouplingBias.GetValueOnGameThread(), 0.0f, 1.0f);
+	input->frame = ++coupling_frame;
+	coupling_body_indices.Reset();
+
+	auto addBody = [&](UPrimitiveComponent* component) {
+		auto body_instance = component ? component->GetBodyInstance() : nullptr;
+		if (!body_instance || !body_instance->IsValidBodyInstance()) {
+			return INDEX_NONE;
+		}
+
+		auto proxy = body_instance->ActorHandle;
+		if (auto index = coupling_body_indices.Find(proxy)) {
+			return *index;
+		}
+		auto index = input->bodies.Add(proxy);
+		coupling_body_indices.Add(proxy, index);
+		return index;
+	};
+
+	//Each twist is at most a turn away from the one of the last frame
+	auto unwrap = [](double twist, double& last_twist, double& angle) {
+		angle += FMath::UnwindRadians(twist - last_twist);
+		last_twist = twist;
+	};
+
+	for (auto& coupling : couplings) {
+		auto gear_a = gears[coupling.gear_a];
+		auto rack = coupling.rack != INDEX_NONE ? racks[coupling.rack].rack.Get() : nullptr;
+		auto gear_b = coupling.gear_b != INDEX_NONE ? gears[coupling.gear_b] : nullptr;
+		auto body_a = addBody(gear_a->getMesh());
+		auto body_b = addBody(gear_b ? gear_b->getMesh() : rack);
+		if (body_a == INDEX_NONE || body_b == INDEX_NONE) {
+			continue;
+		}
+
+		auto& constraint = input->constraints.AddDefaulted_GetRef();
+		constraint.body_a = body_a;
+		constraint.body_b = body_b;
+		constraint.axis_a = gear_a->getMeshTransform().GetUnitAxis(EAxis::Y);
+		constraint.ratio_a = coupling.ratio_a;
+		constraint.ratio_b = coupling.ratio_b;
+
+		auto twist_a = getGearTwist(gear_a);
+		double twist_b = 0.0;
+		if (gear_b) {
+			//Both angles are about the axis of gear a, gears facing the other way turn the other way around it
+			constraint.axis_b = gear_b->getMeshTransform().GetUnitAxis(EAxis::Y);
+			auto axis_sign = FVector::DotProduct(constraint.axis_a, constraint.axis_b) < 0.0 ? -1.0 : 1.0;
+			constraint.ratio_b *= axis_sign;
+			twist_b = getGearTwist(gear_b);
+		}
+		else {
+			constraint.axis_b = racks[coupling.rack].direction;
+			constraint.linear_b = true;
+			twist_b = FVector::DotProduct(rack->GetComponentLocation(), constraint.axis_b);
+		}
+
+		if (!coupling.started) {
+			coupling.twist_a = coupling.angle_a = twist_a;
+			coupling.twist_b = coupling.angle_b = twist_b;
+		}
+		unwrap(twist_a, coupling.twist_a, coupling.angle_a);
+		if (constraint.linear_b) {
+			coupling.angle_b = twist_b;
+		}
+		else {
+			unwrap(twist_b, coupling.twist_b, coupling.angle_b);
+		}
+
+		auto position = constraint.ratio_a * coupling.angle_a + constraint.ratio_b * coupling.angle_b;
+		if (!coupling.started) {
+			coupling.start_position = position;
+			coupling.started = true;
+		}
+		constraint.position_error = position - coupling.start_position;
+	}
+}
+
+void UGearTrainSubsystem::updateRenderers()
+{
+	//Actors tick before this, so merged shafts and instances read the gears here to be drawn where the gears turned
+	//to this frame
+	for (const auto& assembly_pointer : assemblies) {
+		if (auto assembly = assembly_pointer.Get()) {
+			assembly->flushShafts();
+			assembly->updateShaftTransforms();
+		}
+	}
+	for (const auto& instancer_pointer : instancers) {
+		if (auto instancer = instancer_pointer.Get()) {
+			instancer->updateInstanceTransforms();
+		}
+	}
+}
+
+void UGearTrainSubsystem::updateDrivers()
+{
+	drivers_dirty = false;
+
+	train.clearDrivers();
+	for (int32 index = 0; index < gears.Num(); index++) {
+		if (kinematic_flags[index] && driving_flags[index]) {
+			train.setDriver(index, rpms[index]);
+		}
+	}
+
+	if (!train.solve()) {
+		UE_LOG(LogGears, Warning, TEXT("Gear train in %s is inconsistent. Check for odd loops of meshing gears or conflicting drivers"), *GetWorld()->GetName());
+	}
+}
+
+void UGearTrainSubsystem::applyPhysicsDrives()
+{
+	if (!any_drive_dirty) {
+		return;
+	}
+	any_drive_dirty = false;
+
+	for (int32 index = 0; index < gears.Num(); index++) {
+		if (drive_dirty_flags[index]) {
+			drive_dirty_flags[index] = false;
+			gears[index]->applyPhysicsDrive(driving_flags[index], rpms[index], drive_strengths[index]);
+		}
+	}
+}
@@ -2,22 +2,48 @@
 
 
 #include "ProceduralGear.h"
-#include "ProceduralMeshComponent.h"
+#include "GearMeshComponent.h"
+#include "GearMeshCache.h"
+#include "GearBakedMesh.h"
+#include "GearInstancer.h"
+#include "GearAssembly.h"
+#include "GearTrainSubsystem.h"
 #include "PhysicsEngine/PhysicsConstraintComponent.h"
+#include "Components/StaticMeshComponent.h"
+#include "Engine/StaticMesh.h"
 #include "Math/UnitConversion.h"
+#include "Async/Async.h"
+#include "Containers/Ticker.h"
 
-// Sets default values
+#if WITH_EDITOR
+//Involute steps of the preview shown while a slider is dragged
+static constexpr unsigned int PREVIEW_INVOLUTE_STEPS = 4;
+#endif // WITH_EDITOR
+
+//Params of every render LOD of the given gears, so a prefetch builds all of them
+static TArray<FGearParams> getLODParams(const TSet<FGearParams>& unique_params)
+{
+	TArray<FGearParams> lod_params;
+	lod_params.Reserve(unique_params.Num() * GearGeometry::LOD_COUNT);
+	for (const auto& params : unique_params) {
+		for (int32 lod = 0; lod < GearGeometry::LOD_COUNT; lod++) {
+			lod_params.Add(GearGeometry::getLODParams(params, lod));
+		}
+	}
+	return lod_params;
+}
+
+// Sets default values. Geometry is built in OnConstruction, BeginPlay or PostLoad in the editor, never here
 AProceduralGear::AProceduralGear()
 {
-	// Set this actor to call Tick() every frame.  You can turn this off to improve performance if you don't need it.
-	PrimaryActorTick.bCanEverTick = true;
+	//Rotation is driven by UGearTrainSubsystem for all gears at once
+	PrimaryActorTick.bCanEverTick = false;
 
 	scene = CreateDefaultSubobject<USceneComponent>("DefaultSceneRoot");
 	SetRootComponent(scene);
 
-	mesh = CreateDefaultSubobject<UProceduralMeshComponent>("Gear Mesh");
+	mesh = CreateDefaultSubobject<UGearMeshComponent>("Gear Mesh");
 	mesh->SetupAttachment(scene);
-	mesh->bUseComplexAsSimpleCollision = false;
 	mesh->SetSimulatePhysics(true);
 
 	constraint = CreateDefaultSubobject<UPhysicsConstraintComponent>("PhysicsConstraint");
@@ -30,606 +56,337 @@ AProceduralGear::AProceduralGear()
 	constraint->SetAngularTwistLimit(EAngularConstraintMotion::ACM_Locked, 0);
 	constraint->ConstraintActor1 = this;
 	constraint->ComponentName1 = FConstrainComponentPropName{ mesh->GetFName() };
-
-	Initialize();
 }
 
 void AProceduralGear::Initialize()
 {
+	//The class default object and archetypes are never drawn, so they never build
+	if (IsTemplate()) {
+		return;
+	}
+
 	constraint->ConstraintActor2 = join_to.Get();
 	constraint->ComponentName2 = join_to_component_name;
 
-	generateGear();
-	mesh->SetMaterial(0, _material);
+	//Only the first call builds. Later ones only apply pending changes
+	if (!geometry && !pending_generation.IsValid()) {
+		dirty_flags |= EGearDirtyFlags::Geometry | EGearDirtyFlags::Material;
+	}
+	flushUpdate();
 }
 
-// Called when the game starts or when spawned
-void AProceduralGear::BeginPlay()
+TArray<AProceduralGear*> AProceduralGear::spawnGears(UWorld* world, TArrayView<const FTransform> transforms, TArrayView<const FGearParams> params, UMaterialInstance* material)
 {
-	Super::BeginPlay();
+	check(params.Num() == 1 || params.Num() == transforms.Num());
+
+	//Updates stay open until the gears are constructed, so nothing is built while setting them up
+	TArray<AProceduralGear*> gears;
+	TArray<int32> transform_indices;
+	gears.Reserve(transforms.Num());
+	transform_indices.Reserve(transforms.Num());
+	TSet<FGearParams> unique_params;
+	for (int32 index = 0; index < transforms.Num(); index++) {
+		auto gear = world->SpawnActorDeferred<AProceduralGear>(AProceduralGear::StaticClass(), transforms[index]);
+		if (!gear) {
+			continue;
+		}
 
-	if (_apply_rotation) {
-		constraint->SetAngularDriveMode(EAngularDriveMode::TwistAndSwing);
-		constraint->SetAngularVelocityTarget(FVector(0, _rpm/60.0, 0));
-		constraint->SetAngularVelocityDrive(true, false);
-		constraint->SetAngularDriveParams(0, _velocity_strength, 0);
+		gear->beginUpdate();
+		gear->setParams(params.Num() == 1 ? params[0] : params[index]);
+		if (material) {
+			gear->setMaterial(material);
+		}
+		unique_params.Add(gear->getParams());
+		gears.Add(gear);
+		transform_indices.Add(index);
 	}
 
-	if (lock_rotation) {
-		constraint->SetAngularSwing2Limit(EAngularConstraintMotion::ACM_Locked, 0);
+	//Construction only hits the cache afterwards. Collision of each distinct params is cooked once, in the background
+	//unless the gears cook synchronously
+	TArray<TSharedPtr<const FGearMeshData>> prefetched;
+	FGearMeshCache::Get().getGeometry(getLODParams(unique_params), prefetched);
+
+	for (int32 index = 0; index < gears.Num(); index++) {
+		gears[index]->FinishSpawning(transforms[transform_indices[index]]);
+		gears[index]->endUpdate();
 	}
+	return gears;
 }
 
-void AProceduralGear::generateGear()
+void AProceduralGear::generateGears(TArrayView<AProceduralGear* const> gears, int32 max_workers)
 {
-	TArray<FVector>verts;
-	TArray<int>indices;
-	TArray<FVector>normals;
-
-	TArray<FVector>collision_verts;
-	TArray<TArray<FVector>>collision_shapes;
-
-	auto base_radius = getBaseRadius();
-	auto tip_diameter = getRefDiameter() + 2 * getModule() * (1 + getProfileShift());
-	auto tip_radius = tip_diameter / 2.0;
-	auto u = sqrt((pow(tip_radius, 2) / pow(base_radius, 2)) - 1);
-	auto tip_pressure_angle = acos(getBaseDiameter() / tip_diameter) * 180.0 / PI;
-	auto inv_alpha = tan(getPressureAngle() * PI / 180.0) - getPressureAngle() * PI / 180.0;
-	auto inv_alpha_a = tan(tip_pressure_angle * PI / 180.0) - tip_pressure_angle * PI / 180.0;
-	auto top_thickness = PI / (2.0 * getNumberOfTeeth()) + inv_alpha - inv_alpha_a;
-	auto end_x = base_radius * (cos(u) + u * sin(u));
-	auto end_y = base_radius * (sin(u) - u * cos(u));
-	auto distance = sqrt(pow(base_radius - end_x, 2) + pow(end_y, 2));
-	auto cosx = (pow(base_radius, 2) + pow(tip_radius, 2) - pow(distance, 2)) / 2.0 / base_radius / tip_radius;
-	auto tooth_thickness_rad = 2.0 * top_thickness + 2.0 * acos(cosx);
-	auto spacing_arc_length = FMath::DegreesToRadians(360.0 / getNumberOfTeeth()) - tooth_thickness_rad;
-
-	auto max_width = getWidth() / 2.0;
-	auto min_width = getWidth() / -2.0;
-
-	int radial_segments = getNumberOfTeeth() * _involute_steps * SECTIONS_PER_TOOTH;
-
-	mesh->ClearMeshSection(0);
-	mesh->ClearCollisionConvexMeshes();
-
-	//Create Center of Gear
-	//Add Top center vertice
-	auto vert = FVector(0, max_width, 0);
-	verts.Add(vert);
-	normals.Add(vert.GetSafeNormal());
-
-	//Add bottom center vertice
-	vert = FVector(0, min_width, 0);
-	verts.Add(vert);
-	normals.Add(vert.GetSafeNormal());
-
-	auto center_radial_segments = getNumberOfTeeth();
-	for (unsigned int ring = 0; ring < CENTER_RINGS; ring++) {
-		auto ring_radius = float(ring + 1.0) / float(CENTER_RINGS + 1.0) * base_radius;
-		for (unsigned int segment = 0; segment < center_radial_segments; segment++) {
-			auto radian = 2.0 * PI * (segment / float(center_radial_segments));
-			auto x = ring_radius * cos(radian);
-			auto z = ring_radius * sin(radian);
-
-			//Top ring
-			vert = FVector(x, max_width, z);
-			verts.Add(vert);
-			normals.Add(vert.GetSafeNormal());
-
-			//Bottom ring
-			vert = FVector(x, min_width, z);
-			verts.Add(vert);
-			normals.Add(vert.GetSafeNormal());
-
-			if (segment > 0) {
-				auto current_point = segment * 2 + 2;
-				if (ring == 0) {
-					//Add Top triangle around center point
-					indices.Add(0);
-					indices.Add(current_point - 2);
-					indices.Add(current_point);
-
-					//Add bottom trianlge around center point
-					indices.Add(1);
-					indices.Add(current_point + 1);
-					indices.Add(current_point - 1);
-				}
-				else {
-					//Connect Top rings
-					indices.Add(center_radial_segments * (ring - 1) * 2 + (current_point - 2));
-					indices.Add(center_radial_segments * ring * 2 + (current_point - 2));
-					indices.Add(center_radial_segments * (ring - 1) * 2 + current_point);
-
-					indices.Add(center_radial_segments * (ring - 1) * 2 + current_point);
-					indices.Add(center_radial_segments * ring * 2 + (current_point - 2));
-					indices.Add(center_radial_segments * ring * 2 + current_point);
-
-					//Connect Bottom rings
-					indices.Add(center_radial_segments * (ring - 1) * 2 + (current_point - 1));
-					indices.Add(center_radial_segments * (ring - 1) * 2 + (current_point + 1));
-					indices.Add(center_radial_segments * ring * 2 + (current_point - 1));
-
-					indices.Add(center_radial_segments * (ring - 1) * 2 + (current_point + 1));
-					indices.Add(center_radial_segments * ring * 2 + (current_point + 1));
-					indices.Add(center_radial_segments * ring * 2 + (current_point - 1));
-				}
-			}
+	check(IsInGameThread());
+
+	TSet<FGearParams> unique_params;
+	for (auto gear : gears) {
+		if (!gear || gear->IsTemplate()) {
+			continue;
 		}
 
-		//Complete the circle
-		auto last_vert = (ring + 1) * center_radial_segments * 2;
-		if (ring == 0) {
-			//Add top triangle around center point
-			indices.Add(0);
-			indices.Add(last_vert);
-			indices.Add(2);
-
-			//Add bottom triangle around center point
-			indices.Add(1);
-			indices.Add(3);
-			indices.Add(last_vert + 1);
+		auto built = gear->geometry || gear->pending_generation.IsValid();
+		if (built && !EnumHasAnyFlags(gear->dirty_flags, EGearDirtyFlags::Geometry)) {
+			continue;
+		}
+
+		auto params = gear->getParams();
+		if (!GearBakedMesh::findBakeData(gear->_baked_mesh, params)) {
+			unique_params.Add(params);
+		}
+	}
+
+	//Held until the gears are committed so none of it is evicted in between
+	TArray<TSharedPtr<const FGearMeshData>> prefetched;
+	FGearMeshCache::Get().getGeometry(getLODParams(unique_params), prefetched, max_workers);
+
+	for (auto gear : gears) {
+		if (!gear || gear->IsTemplate()) {
+			continue;
+		}
+
+		if (!gear->geometry && !gear->pending_generation.IsValid()) {
+			gear->Initialize();
 		}
 		else {
-			//Add top triangles connecting rings
-			indices.Add(center_radial_segments * ring * 2);
-			indices.Add(last_vert);
-			indices.Add(center_radial_segments * (ring - 1) * 2 + 2);
-
-			indices.Add(center_radial_segments * (ring - 1) * 2 + 2);
-			indices.Add(last_vert);
-			indices.Add(center_radial_segments * ring * 2 + 2);
-
-			//Add bottom triangles connecting rings
-			indices.Add(center_radial_segments * ring * 2 + 1);
-			indices.Add(center_radial_segments * (ring - 1) * 2 + 3);
-			indices.Add(last_vert + 1);
-
-			indices.Add(center_radial_segments * (ring - 1) * 2 + 3);
-			indices.Add(center_radial_segments * ring * 2 + 3);
-			indices.Add(last_vert + 1);
+			gear->flushUpdate();
 		}
 	}
+}
 
-	for (unsigned int current_tooth = 0; current_tooth < getNumberOfTeeth(); current_tooth++) {
-		for (unsigned int segment = 0; segment < (_involute_steps * SECTIONS_PER_TOOTH); segment++) {
-			auto t = u * (1.0 + (0.5 / (_involute_steps - 0.5))) / PI * acos(cos((segment + 0.5) * PI / _involute_steps));
-			auto x = base_radius;
-			auto z = base_radius;
-			auto offset = FMath::DegreesToRadians(current_tooth * (360.0 / getNumberOfTeeth()));
+//Gears loaded in the editor, built together on the next tick
+static TArray<TWeakObjectPtr<AProceduralGear>> loaded_gears;
 
-			if (segment < _involute_steps) {
-				x *= (cos(t + offset) + t * sin(t + offset));
-				z *= (sin(t + offset) - t * cos(t + offset));
-			}
-			else if (segment < (_involute_steps * 2)) {
-				x *= (cos(-t + offset + tooth_thickness_rad) - t * sin(-t + offset + tooth_thickness_rad));
-				z *= (sin(-t + offset + tooth_thickness_rad) + t * cos(-t + offset + tooth_thickness_rad));
-			}
-			else {
-				auto spacing_arc_start_rad = tooth_thickness_rad + offset;
-				auto spacing_arc_start_coord = FVector2f(x * cos(spacing_arc_start_rad), z * sin(spacing_arc_start_rad));
-				auto spacing_arc_end_rad = spacing_arc_start_rad + spacing_arc_length;
-				auto arc_end_coord = FVector2f(x * cos(spacing_arc_end_rad), z * sin(spacing_arc_end_rad));
-				auto spacing_center_rad = spacing_arc_start_rad + spacing_arc_length / 2.0;
-				auto spacing_center_coord = FVector2f(x * cos(spacing_center_rad), z * sin(spacing_center_rad));
-				auto spacing_circle_start_angle = atan2(abs(spacing_arc_start_coord.Y - spacing_center_coord.Y), abs(spacing_arc_start_coord.X - spacing_center_coord.X));
-				auto spacing_circle_end_angle = atan2(abs(arc_end_coord.Y - spacing_center_coord.Y), abs(arc_end_coord.X - spacing_center_coord.X));
-
-				double spacing_circle_start = spacing_circle_start_angle;
-				if (spacing_arc_start_coord.X > spacing_center_coord.X) {
-					if (spacing_arc_start_coord.Y < spacing_center_coord.Y) {
-						spacing_circle_start = 2 * PI - spacing_circle_start;
-					}
-				}
-				else {
-					if (spacing_arc_start_coord.Y > spacing_center_coord.Y) {
-						spacing_circle_start = PI - spacing_circle_start;
-					}
-					else {
-						spacing_circle_start += PI;
-					}
+static void queueLoadedGear(AProceduralGear* gear)
+{
+	if (loaded_gears.IsEmpty()) {
+		FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([](float) {
+			TArray<AProceduralGear*> gears;
+			for (const auto& loaded_gear : loaded_gears) {
+				if (auto gear = loaded_gear.Get()) {
+					gears.Add(gear);
 				}
+			}
+			loaded_gears.Reset();
 
-				double spacing_circle_end = spacing_circle_end_angle;
-				if (arc_end_coord.X > spacing_center_coord.X) {
-					if (arc_end_coord.Y < spacing_center_coord.Y) {
-						spacing_circle_end = 2 * PI - spacing_circle_end;
-					}
-				}
-				else {
-					if (arc_end_coord.Y > spacing_center_coord.Y) {
-						spacing_circle_end = PI - spacing_circle_end;
-					}
-					else {
-						spacing_circle_end += PI;
-					}
-				}
+			AProceduralGear::generateGears(gears);
+			return false;
+		}));
+	}
+	loaded_gears.Add(gear);
+}
 
-				if (spacing_circle_start < spacing_circle_end) {
-					spacing_circle_start += 2 * PI;
-				}
+void AProceduralGear::OnConstruction(const FTransform& Transform)
+{
+	Super::OnConstruction(Transform);
 
-				auto spacing_circle_radius = sqrt(pow(spacing_center_coord.X - spacing_arc_start_coord.X, 2) + pow(spacing_center_coord.Y - spacing_arc_start_coord.Y, 2));
-				auto spacing_circle_step = (spacing_circle_start - spacing_circle_end) / (_involute_steps + 1.0);
-				auto spacing_circle_radial = spacing_circle_start - spacing_circle_step * (segment % _involute_steps + 1);
-				x = spacing_circle_radius * cos(spacing_circle_radial) + spacing_center_coord.X;
-				z = spacing_circle_radius * sin(spacing_circle_radial) + spacing_center_coord.Y;
+	Initialize();
+}
 
-				if (!collision_verts.IsEmpty()) {
-					collision_shapes.Add(collision_verts);
-					collision_verts.Empty();
-				}
-			}
+// Called when the game starts or when spawned
+void AProceduralGear::BeginPlay()
+{
+	//Gears loaded with a level are not constructed again, they build here. The body and the joined actor
+	//have to be in place before the constraint initializes in Super::BeginPlay
+	Initialize();
 
-			if (segment == (_involute_steps - 1) || segment == _involute_steps) {
-				//Add top vert
-				vert = FVector(x, max_width * .8, z);
-				verts.Add(vert);
-				normals.Add(vert.GetSafeNormal());
+	Super::BeginPlay();
 
-				//Add bottom vert
-				vert = FVector(x, min_width * .8, z);
-				verts.Add(vert);
-				normals.Add(vert.GetSafeNormal());
-			}
-			else {
-				//Add top vert
-				vert = FVector(x, max_width, z);
-				verts.Add(vert);
-				normals.Add(vert.GetSafeNormal());
-
-				//Add bottom vert
-				vert = FVector(x, min_width, z);
-				verts.Add(vert);
-				normals.Add(vert.GetSafeNormal());
-			}
+	if (auto assembly = _assembly.Get()) {
+		assembly->addGear(this);
+		mesh->SetVisibility(false, true);
+	}
+	else if (auto instancer = _instancer.Get()) {
+		instancer->addGear(this);
+		mesh->SetVisibility(false, true);
+	}
 
-			if (_enable_collision) {
-				collision_verts.Add(FVector{ x,max_width,z });
-				collision_verts.Add(FVector{ x,min_width,z });
-			}
-		}
+	if (_drive_mode == EGearDriveMode::Kinematic) {
+		mesh->SetSimulatePhysics(false);
+	}
+	GetWorld()->GetSubsystem<UGearTrainSubsystem>()->addGear(this);
 
-		if (current_tooth > 0) {
-			auto first_point = (CENTER_RINGS - 1) * center_radial_segments * 2 + (2 * current_tooth);
-			auto tooth_starting_point = (current_tooth - 1) * _involute_steps * SECTIONS_PER_TOOTH * 2 + (CENTER_RINGS * center_radial_segments * 2) + 2;
-			auto tooth_end_point = tooth_starting_point + _involute_steps * 4 - 2;
-
-			//Top triangles
-			indices.Add(first_point);
-			indices.Add(tooth_starting_point);
-			indices.Add(tooth_end_point);
-
-			//Bottom triangles
-			indices.Add(first_point + 1);
-			indices.Add(tooth_end_point + 1);
-			indices.Add(tooth_starting_point + 1);
-
-			for (unsigned int involute_step = 0; involute_step < (_involute_steps - 1); involute_step++) {
-				auto increment = involute_step * 2;
-
-				//Top Tooth Triangles
-				indices.Add(tooth_starting_point + increment);
-				indices.Add(tooth_starting_point + 2 + increment);
-				indices.Add(tooth_end_point - increment);
-
-				indices.Add(tooth_end_point - increment);
-				indices.Add(tooth_starting_point + 2 + increment);
-				indices.Add(tooth_end_point - 2 - increment);
-
-				//Bottom Tooth Triangles
-				indices.Add(tooth_starting_point + increment + 1);
-				indices.Add(tooth_end_point - increment + 1);
-				indices.Add(tooth_starting_point + 3 + increment);
-
-				indices.Add(tooth_end_point - increment + 1);
-				indices.Add(tooth_end_point - 1 - increment);
-				indices.Add(tooth_starting_point + 3 + increment);
-
-				//Connect Top and Bottom Teeth
-				indices.Add(tooth_starting_point + increment);
-				indices.Add(tooth_starting_point + increment + 1);
-				indices.Add(tooth_starting_point + increment + 2);
-
-				indices.Add(tooth_starting_point + increment + 2);
-				indices.Add(tooth_starting_point + increment + 1);
-				indices.Add(tooth_starting_point + increment + 3);
-
-				indices.Add(tooth_end_point - increment);
-				indices.Add(tooth_end_point - increment - 2);
-				indices.Add(tooth_end_point - increment + 1);
-
-				indices.Add(tooth_end_point - increment + 1);
-				indices.Add(tooth_end_point - increment - 2);
-				indices.Add(tooth_end_point - increment - 1);
-
-				//Spacing Triangles
-				if (involute_step < (_involute_steps / 2.0 - 0.5)) {
-					//Top
-					indices.Add(first_point);
-					indices.Add(tooth_end_point + (involute_step * 2));
-					indices.Add(tooth_end_point + (involute_step * 2) + 2);
-
-					//Bottom
-					indices.Add(first_point + 1);
-					indices.Add(tooth_end_point + (involute_step * 2) + 3);
-					indices.Add(tooth_end_point + (involute_step * 2) + 1);
-				}
-				else if (involute_step <= (_involute_steps / 2.0)) {
-					//Top
-					indices.Add(first_point);
-					indices.Add(tooth_end_point + (involute_step * 2));
-					indices.Add(first_point + 2);
-
-					indices.Add(first_point + 2);
-					indices.Add(tooth_end_point + (involute_step * 2));
-					indices.Add(tooth_end_point + (involute_step * 2) + 2);
-
-					//Bottom
-					indices.Add(first_point + 1);
-					indices.Add(first_point + 3);
-					indices.Add(tooth_end_point + (involute_step * 2) + 1);
-
-					indices.Add(first_point + 3);
-					indices.Add(tooth_end_point + (involute_step * 2) + 3);
-					indices.Add(tooth_end_point + (involute_step * 2) + 1);
-				}
-				else {
-					//Top
-					indices.Add(first_point + 2);
-					indices.Add(tooth_end_point + (involute_step * 2));
-					indices.Add(tooth_end_point + (involute_step * 2) + 2);
-
-					//Bottom
-					indices.Add(first_point + 3);
-					indices.Add(tooth_end_point + (involute_step * 2) + 3);
-					indices.Add(tooth_end_point + (involute_step * 2) + 1);
-				}
+	if (lock_rotation) {
+		constraint->SetAngularSwing2Limit(EAngularConstraintMotion::ACM_Locked, 0);
+	}
+}
 
+void AProceduralGear::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (auto gear_train = GetWorld()->GetSubsystem<UGearTrainSubsystem>()) {
+		gear_train->removeGear(this);
+	}
 
-				//Connect top and bottom Spacing
-				indices.Add(tooth_end_point + (involute_step * 2));
-				indices.Add(tooth_end_point + (involute_step * 2) + 1);
-				indices.Add(tooth_end_point + (involute_step * 2) + 2);
-
-				indices.Add(tooth_end_point + (involute_step * 2) + 2);
-				indices.Add(tooth_end_point + (involute_step * 2) + 1);
-				indices.Add(tooth_end_point + (involute_step * 2) + 3);
-
-				////Connect gaps
-				if (involute_step == _involute_steps - 2) {
-					//Connect tooth ends
-					indices.Add(tooth_starting_point + (involute_step * 2) + 2);
-					indices.Add(tooth_starting_point + (involute_step * 2) + 3);
-					indices.Add(tooth_starting_point + (involute_step * 2) + 4);
-
-					indices.Add(tooth_starting_point + (involute_step * 2) + 4);
-					indices.Add(tooth_starting_point + (involute_step * 2) + 3);
-					indices.Add(tooth_starting_point + (involute_step * 2) + 5);
-
-					//Connect top spacing to next tooth
-					indices.Add(first_point + 2);
-					indices.Add(tooth_end_point + (involute_step * 2) + 2);
-					indices.Add(tooth_end_point + (involute_step * 2) + 4);
-
-					indices.Add(first_point + 2);
-					indices.Add(tooth_end_point + (involute_step * 2) + 4);
-					indices.Add(tooth_end_point + (involute_step * 2) + 6);
-
-					//Connect bottom spacing to next tooth
-					indices.Add(first_point + 3);
-					indices.Add(tooth_end_point + (involute_step * 2) + 5);
-					indices.Add(tooth_end_point + (involute_step * 2) + 3);
-
-					indices.Add(first_point + 3);
-					indices.Add(tooth_end_point + (involute_step * 2) + 7);
-					indices.Add(tooth_end_point + (involute_step * 2) + 5);
-
-					//Connect top and bottom Spacing
-					indices.Add(tooth_end_point + (involute_step * 2) + 2);
-					indices.Add(tooth_end_point + (involute_step * 2) + 3);
-					indices.Add(tooth_end_point + (involute_step * 2) + 4);
-
-					indices.Add(tooth_end_point + (involute_step * 2) + 4);
-					indices.Add(tooth_end_point + (involute_step * 2) + 3);
-					indices.Add(tooth_end_point + (involute_step * 2) + 5);
-
-					indices.Add(tooth_end_point + (involute_step * 2) + 4);
-					indices.Add(tooth_end_point + (involute_step * 2) + 5);
-					indices.Add(tooth_end_point + (involute_step * 2) + 6);
-
-					indices.Add(tooth_end_point + (involute_step * 2) + 6);
-					indices.Add(tooth_end_point + (involute_step * 2) + 5);
-					indices.Add(tooth_end_point + (involute_step * 2) + 7);
-				}
-			}
-		}
+	if (auto instancer = _instancer.Get()) {
+		instancer->removeGear(this);
+	}
 
-		//Add Last Tooth
-		if (current_tooth == getNumberOfTeeth() - 1) {
-			auto first_point = (CENTER_RINGS - 1) * center_radial_segments * 2 + (2 * (current_tooth + 1));
-			auto next_point = (CENTER_RINGS - 1) * center_radial_segments * 2 + 2;
-			auto tooth_starting_point = current_tooth * _involute_steps * SECTIONS_PER_TOOTH * 2 + (CENTER_RINGS * center_radial_segments * 2) + 2;
-			auto tooth_end_point = tooth_starting_point + _involute_steps * 4 - 2;
-			auto next_tooth = CENTER_RINGS * center_radial_segments * 2 + 2;
-
-			//Top triangles
-			indices.Add(first_point);
-			indices.Add(tooth_starting_point);
-			indices.Add(tooth_end_point);
-
-			//Bottom triangles
-			indices.Add(first_point + 1);
-			indices.Add(tooth_end_point + 1);
-			indices.Add(tooth_starting_point + 1);
-
-			for (unsigned int involute_step = 0; involute_step < (_involute_steps - 1); involute_step++) {
-				auto increment = involute_step * 2;
-
-				//Top Tooth Triangles
-				indices.Add(tooth_starting_point + increment);
-				indices.Add(tooth_starting_point + 2 + increment);
-				indices.Add(tooth_end_point - increment);
-
-				indices.Add(tooth_end_point - increment);
-				indices.Add(tooth_starting_point + 2 + increment);
-				indices.Add(tooth_end_point - 2 - increment);
-
-				//Bottom Tooth Triangles
-				indices.Add(tooth_starting_point + increment + 1);
-				indices.Add(tooth_end_point - increment + 1);
-				indices.Add(tooth_starting_point + 3 + increment);
-
-				indices.Add(tooth_end_point - increment + 1);
-				indices.Add(tooth_end_point - 1 - increment);
-				indices.Add(tooth_starting_point + 3 + increment);
-
-				//Connect Top and Bottom Teeth
-				indices.Add(tooth_starting_point + increment);
-				indices.Add(tooth_starting_point + increment + 1);
-				indices.Add(tooth_starting_point + increment + 2);
-
-				indices.Add(tooth_starting_point + increment + 2);
-				indices.Add(tooth_starting_point + increment + 1);
-				indices.Add(tooth_starting_point + increment + 3);
-
-				indices.Add(tooth_end_point - increment);
-				indices.Add(tooth_end_point - increment - 2);
-				indices.Add(tooth_end_point - increment + 1);
-
-				indices.Add(tooth_end_point - increment + 1);
-				indices.Add(tooth_end_point - increment - 2);
-				indices.Add(tooth_end_point - increment - 1);
-
-				//Spacing Triangles
-				if (involute_step < (_involute_steps / 2.0 - 0.5)) {
-					//Top
-					indices.Add(first_point);
-					indices.Add(tooth_end_point + (involute_step * 2));
-					indices.Add(tooth_end_point + (involute_step * 2) + 2);
-
-					//Bottom
-					indices.Add(first_point + 1);
-					indices.Add(tooth_end_point + (involute_step * 2) + 3);
-					indices.Add(tooth_end_point + (involute_step * 2) + 1);
-				}
-				else if (involute_step <= (_involute_steps / 2.0)) {
-					//Top
-					indices.Add(first_point);
-					indices.Add(tooth_end_point + (involute_step * 2));
-					indices.Add(next_point);
-
-					indices.Add(next_point);
-					indices.Add(tooth_end_point + (involute_step * 2));
-					indices.Add(tooth_end_point + (involute_step * 2) + 2);
-
-					//Bottom
-					indices.Add(first_point + 1);
-					indices.Add(next_point + 1);
-					indices.Add(tooth_end_point + (involute_step * 2) + 1);
-
-					indices.Add(next_point + 1);
-					indices.Add(tooth_end_point + (involute_step * 2) + 3);
-					indices.Add(tooth_end_point + (involute_step * 2) + 1);
-				}
-				else {
-					//Top
-					indices.Add(next_point);
-					indices.Add(tooth_end_point + (involute_step * 2));
-					indices.Add(tooth_end_point + (involute_step * 2) + 2);
-
-					//Bottom
-					indices.Add(next_point + 1);
-					indices.Add(tooth_end_point + (involute_step * 2) + 3);
-					indices.Add(tooth_end_point + (involute_step * 2) + 1);
-				}
+	if (auto assembly = _assembly.Get()) {
+		assembly->removeGear(this);
+	}
 
+	Super::EndPlay(EndPlayReason);
+}
 
-				//Connect top and bottom Spacing
-				indices.Add(tooth_end_point + (involute_step * 2));
-				indices.Add(tooth_end_point + (involute_step * 2) + 1);
-				indices.Add(tooth_end_point + (involute_step * 2) + 2);
-
-				indices.Add(tooth_end_point + (involute_step * 2) + 2);
-				indices.Add(tooth_end_point + (involute_step * 2) + 1);
-				indices.Add(tooth_end_point + (involute_step * 2) + 3);
-
-				////Connect gaps
-				if (involute_step == _involute_steps - 2) {
-					//Connect tooth ends
-					indices.Add(tooth_starting_point + (involute_step * 2) + 2);
-					indices.Add(tooth_starting_point + (involute_step * 2) + 3);
-					indices.Add(tooth_starting_point + (involute_step * 2) + 4);
-
-					indices.Add(tooth_starting_point + (involute_step * 2) + 4);
-					indices.Add(tooth_starting_point + (involute_step * 2) + 3);
-					indices.Add(tooth_starting_point + (involute_step * 2) + 5);
-
-					//Connect top spacing to next tooth
-					indices.Add(next_point);
-					indices.Add(tooth_end_point + (involute_step * 2) + 2);
-					indices.Add(tooth_end_point + (involute_step * 2) + 4);
-
-					indices.Add(next_point);
-					indices.Add(tooth_end_point + (involute_step * 2) + 4);
-					indices.Add(next_tooth);
-
-					//Connect bottom spacing to next tooth
-					indices.Add(next_point + 1);
-					indices.Add(tooth_end_point + (involute_step * 2) + 5);
-					indices.Add(tooth_end_point + (involute_step * 2) + 3);
-
-					indices.Add(next_point + 1);
-					indices.Add(next_tooth + 1);
-					indices.Add(tooth_end_point + (involute_step * 2) + 5);
-
-					//Connect top and bottom Spacing
-					indices.Add(tooth_end_point + (involute_step * 2) + 2);
-					indices.Add(tooth_end_point + (involute_step * 2) + 3);
-					indices.Add(tooth_end_point + (involute_step * 2) + 4);
-
-					indices.Add(tooth_end_point + (involute_step * 2) + 4);
-					indices.Add(tooth_end_point + (involute_step * 2) + 3);
-					indices.Add(tooth_end_point + (involute_step * 2) + 5);
-
-					indices.Add(tooth_end_point + (involute_step * 2) + 4);
-					indices.Add(tooth_end_point + (involute_step * 2) + 5);
-					indices.Add(next_tooth);
-
-					indices.Add(next_tooth);
-					indices.Add(tooth_end_point + (involute_step * 2) + 5);
-					indices.Add(next_tooth + 1);
-				}
+void AProceduralGear::generateGear()
+{
+	auto params = getParams();
+	auto serial = ++generation_serial;
+
+	//Baked gears skip the kernel and collision cooking, only the mass properties are needed
+	if (auto bake_data = GearBakedMesh::findBakeData(_baked_mesh, params)) {
+		pending_generation = {};
+		auto baked_geometry = MakeShared<FGearMeshData>();
+		baked_geometry->profile_area = bake_data->profile_area;
+		baked_geometry->profile_polar_moment = bake_data->profile_polar_moment;
+		applyGeometry({ baked_geometry }, params);
+		return;
+	}
+
+	//The mesh holds the last LODs that were built, a change of scale or collision mode is derived from them
+	const auto& source = mesh->getLODs();
+	//The full build after a preview is left to a worker so releasing the slider does not stall the editor
+	if (!_async_generation && !showing_preview) {
+		pending_generation = {};
+		FGearLODGeometry built_lods;
+		FGearMeshCache::Get().getLODs(params, applied_params, source, built_lods);
+		applyGeometry(built_lods, params);
+		return;
+	}
+
+	//Any build still in flight is left to finish and its result is dropped
+	pending_params = params;
+	pending_generation = UE::Tasks::Launch(UE_SOURCE_LOCATION, [weak_this = TWeakObjectPtr<AProceduralGear>(this), params, serial, source_params = applied_params, source]() {
+		FGearLODGeometry built_lods;
+		FGearMeshCache::Get().getLODs(params, source_params, source, built_lods);
+
+		AsyncTask(ENamedThreads::GameThread, [weak_this, serial]() {
+			if (auto gear = weak_this.Get()) {
+				gear->finishGeneration(serial);
 			}
+		});
+
+		return built_lods;
+	});
+}
+
+#if WITH_EDITOR
+void AProceduralGear::generatePreview(bool reduce_steps)
+{
+	auto params = getParams();
+	if (reduce_steps) {
+		params.involute_steps = FMath::Min(params.involute_steps, PREVIEW_INVOLUTE_STEPS);
+		if (params.spacing_steps > 0) {
+			params.spacing_steps = FMath::Min(params.spacing_steps, PREVIEW_INVOLUTE_STEPS);
 		}
 	}
+	params.collision_mode = EGearCollisionMode::None;
 
-	mesh->CreateMeshSection(
-		0,
-		verts,
-		indices,
-		normals,
-		TArray<FVector2D>(),
-		TArray<FColor>(),
-		TArray<FProcMeshTangent>(),
-		false);
+	//Drops any full build still in flight, the drag already moved past it. Only LOD 0 is built while dragging
+	++generation_serial;
+	pending_generation = {};
+	applyGeometry({ FGearMeshCache::Get().getGeometry(params, applied_params, mesh->getGeometry()) }, params);
+	showing_preview = true;
+}
+#endif // WITH_EDITOR
 
-	for (auto collision_shape : collision_shapes) {
-		mesh->AddCollisionConvexMesh(collision_shape);
+void AProceduralGear::finishGeneration(uint32 serial)
+{
+	//Stale, or already committed by waitForGeneration()
+	if (serial != generation_serial || !pending_generation.IsValid()) {
+		return;
 	}
+
+	auto built_lods = pending_generation.GetResult();
+	pending_generation = {};
+	applyGeometry(built_lods, pending_params);
 }
 
-// Called every frame
-void AProceduralGear::Tick(float DeltaTime)
+void AProceduralGear::finishCollision(UBodySetup* body_setup, uint32 serial)
 {
-	Super::Tick(DeltaTime);
+	//Stale, the gear asked for other collision since
+	if (serial != collision_serial) {
+		return;
+	}
+
+	collision_pending = false;
+	mesh->setSharedBodySetup(body_setup);
+}
+
+void AProceduralGear::applyGeometry(const FGearLODGeometry& built_lods, const FGearParams& params)
+{
+	auto previous_lods = mesh->getLODs();
+	geometry = built_lods[0];
+	showing_preview = false;
+
+	auto baked = GearBakedMesh::findBakeData(_baked_mesh, params) != nullptr;
+	showBakedMesh(baked);
+	if (baked) {
+		++collision_serial;
+		collision_pending = false;
+		//Collision was cooked with the asset, one convex per elem
+		mesh->setGeometry({});
+		auto body_setup = params.collision_mode != EGearCollisionMode::None ? _baked_mesh->GetBodySetup() : nullptr;
+		if (body_setup) {
+			FGearMeshCache::shareToothConvex(params, body_setup);
+		}
+		mesh->setSharedBodySetup(body_setup);
+	}
+	else {
+		//The mesh draws the shared geometry without copying it
+		mesh->setGeometry(built_lods);
+
+		//Hull buffers come with the geometry, cooked collision is shared through the cache. A rescaled gear shares the
+		//hulls cooked for its previous params, others may wait for a background cook
+		auto& cache = FGearMeshCache::Get();
+		auto serial = ++collision_serial;
+		if (_collision_cooking == EGearCollisionCooking::Synchronous) {
+			collision_pending = false;
+			mesh->setSharedBodySetup(cache.getCollision(params, applied_params, built_lods[0]));
+		}
+		else {
+			//Cleared by finishCollision, which runs right away when there is nothing to cook
+			collision_pending = params.collision_mode != EGearCollisionMode::None;
+			auto body_setup = cache.getCollisionAsync(params, applied_params, built_lods[0], FOnGearCollisionCooked::CreateUObject(this, &AProceduralGear::finishCollision, serial));
+			if (body_setup || params.collision_mode == EGearCollisionMode::None) {
+				collision_pending = false;
+				mesh->setSharedBodySetup(body_setup);
+			}
+			else if (collision_pending && _collision_cooking == EGearCollisionCooking::DisableUntilReady) {
+				mesh->setSharedBodySetup(nullptr);
+			}
+		}
+	}
+
+	//Hand the previous LODs back once the mesh dropped them too, so their buffers can be reused if no other gear shares them
+	if (applied_params != params) {
+		FGearMeshCache::Get().releaseLODs(applied_params, previous_lods);
+	}
+	applied_params = params;
+	_vertex_count = GearGeometry::computeSizes(params).verts;
+	_chordal_error = GearGeometry::computeChordalError(params);
+	applyMassProperties();
+
+	if (auto gear_train = getGearTrain()) {
+		gear_train->setMeshingWindow(this, usesMeshingWindow());
+	}
+
+	if (auto instancer = _instancer.Get()) {
+		instancer->updateGear(this);
+	}
+
+	if (auto assembly = _assembly.Get()) {
+		assembly->updateGear(this);
+	}
 }
 
 void AProceduralGear::PostLoad()
 {
 	Super::PostLoad();
 
-	Initialize();
+	//Editor viewports show loaded gears without playing, a level full of them is built in one batch.
+	//Games build them when the world begins play
+	if (GIsEditor && !IsTemplate()) {
+		queueLoadedGear(this);
+	}
 }
 
 #if WITH_EDITOR  
@@ -646,7 +403,7 @@ void AProceduralGear::PostEditChangeProperty(FPropertyChangedEvent& PropertyChan
 		updateBaseDiameter();
 	}
 	else if (property_name == "_width") {
-		//Nothing special to do. Gear will be regenerated
+		//Nothing special to do. The previous geometry and collision will be rescaled
 	}
 	else if (property_name == "_profile_shift") {
 		//Nothing special to do. Gear will be regenerated
@@ -654,14 +411,37 @@ void AProceduralGear::PostEditChangeProperty(FPropertyChangedEvent& PropertyChan
 	else if (property_name == "_involute_steps") {
 		//Nothing special to do. Gear will be regenerated
 	}
-	else if (property_name == "material") {
-		mesh->SetMaterial(0, _material);
+	else if (property_name == "_max_chordal_error") {
+		//Nothing special to do. Gear will be regenerated with the sample counts picked for the error
+	}
+	else if (property_name == "_material") {
+		markDirty(EGearDirtyFlags::Material);
 		regenerate_gear = false;
 	}
 	else if (property_name == "_enable_collision") {
 		//Nothing special to do. Gear will be regenerated
 		//mesh->SetSimulatePhysics(_enable_collision);
 	}
+	else if (property_name == "_collision_cooking") {
+		//Applies to the next build
+		regenerate_gear = false;
+	}
+	else if (property_name == "_meshing_window_teeth") {
+		regenerate_gear = false;
+	}
+	else if (property_name == "_density") {
+		applyMassProperties();
+		regenerate_gear = false;
+	}
+	else if (property_name == "_async_generation") {
+		regenerate_gear = false;
+	}
+	else if (property_name == "_instancer") {
+		regenerate_gear = false;
+	}
+	else if (property_name == "_assembly") {
+		regenerate_gear = false;
+	}
 	else if (property_name == "join_to") {
 		constraint->ConstraintActor2 = join_to.Get();
 		regenerate_gear = false;
@@ -680,7 +460,16 @@ void AProceduralGear::PostEditChangeProperty(FPropertyChangedEvent& PropertyChan
 	}
 
 	if (regenerate_gear) {
-		generateGear();
+		dimensions_dirty = true;
+		tessellation_dirty = true;
+		//Dragging a slider sends a change every frame. Those only show a preview without collision, with fewer
+		//involute steps unless the steps are what is being dragged. The final value gets the full build
+		if (PropertyChangedEvent.ChangeType == EPropertyChangeType::Interactive) {
+			generatePreview(property_name != "_involute_steps" && property_name != "_max_chordal_error");
+		}
+		else {
+			generateGear();
+		}
 	}
 
 	Super::PostEditChangeProperty(PropertyChangedEvent);
@@ -689,7 +478,7 @@ void AProceduralGear::PostEditChangeProperty(FPropertyChangedEvent& PropertyChan
 
 float AProceduralGear::getModule() const
 {
-	return FUnitConversion::Convert<float>(_module, EUnit::Millimeters, EUnit::Centimeters);
+	return getDimensions().module;
 }
 
 unsigned int AProceduralGear::getNumberOfTeeth() const
@@ -699,12 +488,12 @@ unsigned int AProceduralGear::getNumberOfTeeth() const
 
 float AProceduralGear::getWidth() const
 {
-	return FUnitConversion::Convert<float>(_width, EUnit::Millimeters, EUnit::Centimeters);
+	return getDimensions().width;
 }
 
 float AProceduralGear::getProfileShift() const
 {
-	return FUnitConversion::Convert<float>(_profile_shift, EUnit::Millimeters, EUnit::Centimeters);
+	return getDimensions().profile_shift;
 }
 
 float AProceduralGear::getPressureAngle() const
@@ -714,17 +503,17 @@ float AProceduralGear::getPressureAngle() const
 
 float AProceduralGear::getRefDiameter() const
 {
-	return FUnitConversion::Convert<float>(_reference_diameter, EUnit::Millimeters, EUnit::Centimeters);
+	return getDimensions().ref_diameter;
 }
 
 float AProceduralGear::getBaseDiameter() const
 {
-	return FUnitConversion::Convert<float>(_base_diameter, EUnit::Millimeters, EUnit::Centimeters);
+	return getDimensions().base_diameter;
 }
 
 float AProceduralGear::getBaseRadius() const
 {
-	return FUnitConversion::Convert<float>(_base_radius, EUnit::Millimeters, EUnit::Centimeters);
+	return getDimensions().base_radius;
 }
 
 bool AProceduralGear::hasRotationApplied() const
@@ -772,50 +561,263 @@ unsigned int AProceduralGear::getInvoluteSteps() const
 	return _involute_steps;
 }
 
+float AProceduralGear::getMaxChordalError() const
+{
+	return _max_chordal_error;
+}
+
+int32 AProceduralGear::getVertexCount() const
+{
+	return _vertex_count;
+}
+
+float AProceduralGear::getChordalError() const
+{
+	return _chordal_error;
+}
+
 bool AProceduralGear::isCollisionEnabled() const
 {
 	return _enable_collision;
 }
 
+EGearCollisionMode AProceduralGear::getCollisionMode() const
+{
+	return _collision_mode;
+}
+
+EGearCollisionMode AProceduralGear::getResolvedCollisionMode() const
+{
+	if (!_enable_collision) {
+		return EGearCollisionMode::None;
+	}
+	if (_collision_mode != EGearCollisionMode::Auto) {
+		return _collision_mode;
+	}
+
+	//Kinematic gears never rely on tooth contacts
+	if (_drive_mode == EGearDriveMode::Kinematic) {
+		return EGearCollisionMode::TipCircle;
+	}
+	//Coupled gears only need their root circles, the teeth of partners pass between them
+	if (_drive_mode == EGearDriveMode::Coupled) {
+		return EGearCollisionMode::Hub;
+	}
+	return _meshes_with.IsEmpty() ? EGearCollisionMode::PerTooth : EGearCollisionMode::MeshingWindow;
+}
+
+EGearCollisionCooking AProceduralGear::getCollisionCooking() const
+{
+	return _collision_cooking;
+}
+
+bool AProceduralGear::isCollisionPending() const
+{
+	return collision_pending;
+}
+
+unsigned int AProceduralGear::getMeshingWindowTeeth() const
+{
+	return _meshing_window_teeth;
+}
+
+float AProceduralGear::getDensity() const
+{
+	return _density;
+}
+
+float AProceduralGear::getMass() const
+{
+	//Density is in g/cm^3, the profile in cm
+	return geometry ? _density / 1000.0 * geometry->profile_area * getWidth() : 0.0f;
+}
+
+bool AProceduralGear::isAsyncGenerationEnabled() const
+{
+	return _async_generation;
+}
+
+bool AProceduralGear::isGenerationPending() const
+{
+	return pending_generation.IsValid();
+}
+
+bool AProceduralGear::isShowingPreview() const
+{
+	return showing_preview;
+}
+
+uint32 AProceduralGear::getGenerationSerial() const
+{
+	return generation_serial;
+}
+
+const TSoftObjectPtr<AGearInstancer>& AProceduralGear::getInstancer() const
+{
+	return _instancer;
+}
+
+const TSoftObjectPtr<AGearAssembly>& AProceduralGear::getAssembly() const
+{
+	return _assembly;
+}
+
+UStaticMesh* AProceduralGear::getBakedMesh() const
+{
+	return GearBakedMesh::findBakeData(_baked_mesh, getParams()) ? _baked_mesh : nullptr;
+}
+
+FTransform AProceduralGear::getMeshTransform() const
+{
+	return mesh->GetComponentTransform();
+}
+
+UPrimitiveComponent* AProceduralGear::getMesh() const
+{
+	return mesh;
+}
+
+EGearDriveMode AProceduralGear::getDriveMode() const
+{
+	return _drive_mode;
+}
+
+const TArray<TSoftObjectPtr<AProceduralGear>>& AProceduralGear::getMeshingGears() const
+{
+	return _meshes_with;
+}
+
+const TArray<TSoftObjectPtr<AProceduralGear>>& AProceduralGear::getShaftGears() const
+{
+	return _shaft_with;
+}
+
+const FGearDimensions& AProceduralGear::getDimensions() const
+{
+	if (dimensions_dirty) {
+		dimensions = GearGeometry::computeDimensions(getParams());
+		dimensions_dirty = false;
+	}
+	return dimensions;
+}
+
+FGearParams AProceduralGear::getParams() const
+{
+	FGearParams params;
+	params.module = _module;
+	params.number_of_teeth = _number_of_teeth;
+	params.width = _width;
+	params.profile_shift = _profile_shift;
+	params.pressure_angle = _pressure_angle;
+	params.involute_steps = _involute_steps;
+	params.collision_mode = getResolvedCollisionMode();
+
+	//Picking the sample counts measures the gear several times, so it only runs again after a change
+	if (_max_chordal_error > 0.0f) {
+		if (tessellation_dirty) {
+			tessellation = params;
+			GearGeometry::setChordalError(tessellation, _max_chordal_error);
+			tessellation_dirty = false;
+		}
+		params.involute_steps = tessellation.involute_steps;
+		params.spacing_steps = tessellation.spacing_steps;
+		params.adaptive_spacing = true;
+	}
+	return params;
+}
+
+void AProceduralGear::beginUpdate()
+{
+	update_depth++;
+}
+
+void AProceduralGear::endUpdate()
+{
+	check(update_depth > 0);
+	if (--update_depth == 0 && dirty_flags != EGearDirtyFlags::None) {
+		requestRebuild();
+	}
+}
+
+void AProceduralGear::setParams(const FGearParams& params)
+{
+	beginUpdate();
+	if (params.module != _module) {
+		setModule(params.module);
+	}
+	if (params.number_of_teeth != _number_of_teeth) {
+		setNumberOfTeeth(params.number_of_teeth);
+	}
+	if (params.width != _width) {
+		setWidth(params.width);
+	}
+	if (params.profile_shift != _profile_shift) {
+		_profile_shift = params.profile_shift;
+		markDirty(EGearDirtyFlags::Dimensions);
+	}
+	if (params.pressure_angle != _pressure_angle) {
+		setPressureAngle(params.pressure_angle);
+	}
+	if (!params.adaptive_spacing && params.involute_steps != _involute_steps) {
+		setInvoluteSteps(params.involute_steps);
+	}
+
+	auto collision_enabled = params.collision_mode != EGearCollisionMode::None;
+	if (collision_enabled != _enable_collision) {
+		enableCollision(collision_enabled);
+	}
+	if (collision_enabled && params.collision_mode != _collision_mode) {
+		setCollisionMode(params.collision_mode);
+	}
+	endUpdate();
+}
+
 void AProceduralGear::setModule(float module_value)
 {
 	_module = module_value;
-	updateReferenceDiameter();
-	generateGear();
+	markDirty(EGearDirtyFlags::Dimensions);
 }
 
 void AProceduralGear::setNumberOfTeeth(unsigned int num)
 {
 	_number_of_teeth = num;
-	updateReferenceDiameter();
-	generateGear();
+	markDirty(EGearDirtyFlags::Dimensions);
 }
 
 void AProceduralGear::setWidth(float width)
 {
 	_width = width;
-	generateGear();
+	markDirty(EGearDirtyFlags::Dimensions);
 }
 
 void AProceduralGear::setPressureAngle(float angle)
 {
 	_pressure_angle = angle;
-	generateGear();
+	markDirty(EGearDirtyFlags::Dimensions);
 }
 
 void AProceduralGear::ApplyRotation(bool value)
 {
 	_apply_rotation = value;
+	if (auto gear_train = getGearTrain()) {
+		gear_train->setDriving(this, value);
+	}
 }
 
 void AProceduralGear::setRPM(float rpm)
 {
 	_rpm = rpm;
+	if (auto gear_train = getGearTrain()) {
+		gear_train->setRPM(this, rpm);
+	}
 }
 
 void AProceduralGear::setVelocityStrength(float strength)
 {
 	_velocity_strength = strength;
+	if (auto gear_train = getGearTrain()) {
+		gear_train->setDriveStrength(this, strength);
+	}
 }
 
 void AProceduralGear::setJoinedActor(AActor* actor)
@@ -844,19 +846,331 @@ void AProceduralGear::disableJoinedCollision(bool value)
 void AProceduralGear::setMaterial(UMaterialInstance* material)
 {
 	_material = material;
-	generateGear();
+	markDirty(EGearDirtyFlags::Material);
 }
 
 void AProceduralGear::setInvoluteSteps(unsigned int steps)
 {
 	_involute_steps = steps;
-	generateGear();
+	markDirty(EGearDirtyFlags::InvoluteSteps);
+}
+
+void AProceduralGear::setMaxChordalError(float max_chordal_error)
+{
+	_max_chordal_error = FMath::Max(max_chordal_error, 0.0f);
+	tessellation_dirty = true;
+	markDirty(EGearDirtyFlags::InvoluteSteps);
 }
 
 void AProceduralGear::enableCollision(bool value)
 {
 	_enable_collision = value;
-	generateGear();
+	markDirty(EGearDirtyFlags::Collision);
+}
+
+void AProceduralGear::setCollisionMode(EGearCollisionMode mode)
+{
+	_collision_mode = mode;
+	updateCollisionMode();
+}
+
+void AProceduralGear::setCollisionCooking(EGearCollisionCooking cooking)
+{
+	_collision_cooking = cooking;
+}
+
+void AProceduralGear::setMeshingWindowTeeth(unsigned int teeth)
+{
+	_meshing_window_teeth = teeth;
+}
+
+void AProceduralGear::setDensity(float density)
+{
+	_density = density;
+	applyMassProperties();
+}
+
+void AProceduralGear::enableAsyncGeneration(bool value)
+{
+	_async_generation = value;
+}
+
+void AProceduralGear::setInstancer(AGearInstancer* instancer)
+{
+	//Gears of an assembly join the instancer once they leave the assembly
+	if (HasActorBegunPlay() && !_assembly.Get()) {
+		if (auto previous_instancer = _instancer.Get()) {
+			previous_instancer->removeGear(this);
+		}
+		if (instancer) {
+			instancer->addGear(this);
+		}
+		mesh->SetVisibility(instancer == nullptr, true);
+	}
+
+	_instancer = instancer;
+}
+
+void AProceduralGear::setAssembly(AGearAssembly* assembly)
+{
+	if (HasActorBegunPlay()) {
+		if (auto previous_assembly = _assembly.Get()) {
+			previous_assembly->removeGear(this);
+		}
+
+		auto instancer = _instancer.Get();
+		if (assembly) {
+			if (instancer) {
+				instancer->removeGear(this);
+			}
+			assembly->addGear(this);
+		}
+		else if (instancer) {
+			instancer->addGear(this);
+		}
+		mesh->SetVisibility(assembly == nullptr && instancer == nullptr, true);
+	}
+
+	_assembly = assembly;
+}
+
+void AProceduralGear::setBakedMesh(UStaticMesh* static_mesh)
+{
+	if (static_mesh == _baked_mesh) {
+		return;
+	}
+
+	_baked_mesh = static_mesh;
+	if (geometry || pending_generation.IsValid()) {
+		markDirty(EGearDirtyFlags::Geometry);
+	}
+}
+
+void AProceduralGear::setDriveMode(EGearDriveMode mode)
+{
+	auto gear_train = getGearTrain();
+	if (!gear_train || mode == _drive_mode) {
+		_drive_mode = mode;
+		return;
+	}
+
+	//Register again so the subsystem picks up the new mode and sets up or drops the constraint drive
+	gear_train->removeGear(this);
+	_drive_mode = mode;
+	if (mode == EGearDriveMode::Kinematic) {
+		applyPhysicsDrive(false, _rpm, _velocity_strength);
+		mesh->SetSimulatePhysics(false);
+	}
+	else {
+		mesh->SetSimulatePhysics(true);
+	}
+	gear_train->addGear(this);
+	updateCollisionMode();
+}
+
+void AProceduralGear::addMeshingGear(AProceduralGear* gear)
+{
+	_meshes_with.AddUnique(TSoftObjectPtr<AProceduralGear>(gear));
+	if (auto gear_train = GetWorld() ? GetWorld()->GetSubsystem<UGearTrainSubsystem>() : nullptr) {
+		gear_train->markDirty();
+	}
+	updateCollisionMode();
+}
+
+void AProceduralGear::addShaftGear(AProceduralGear* gear)
+{
+	_shaft_with.AddUnique(TSoftObjectPtr<AProceduralGear>(gear));
+	if (auto gear_train = GetWorld() ? GetWorld()->GetSubsystem<UGearTrainSubsystem>() : nullptr) {
+		gear_train->markDirty();
+	}
+	if (auto assembly = _assembly.Get()) {
+		assembly->markDirty();
+	}
+}
+
+void AProceduralGear::setKinematicRotation(const FQuat& rotation)
+{
+	mesh->SetRelativeRotation(rotation);
+}
+
+void AProceduralGear::applyPhysicsDrive(bool enabled, float rpm, float strength)
+{
+	if (!enabled) {
+		constraint->SetAngularVelocityDrive(false, false);
+		return;
+	}
+
+	constraint->SetAngularDriveMode(EAngularDriveMode::TwistAndSwing);
+	constraint->SetAngularVelocityTarget(FVector(0, rpm/60.0, 0));
+	constraint->SetAngularVelocityDrive(true, false);
+	constraint->SetAngularDriveParams(0, strength, 0);
+}
+
+bool AProceduralGear::usesMeshingWindow() const
+{
+	return geometry && applied_params.collision_mode == EGearCollisionMode::MeshingWindow;
+}
+
+void AProceduralGear::updateMeshingWindow()
+{
+	//A body kept while the new collision cooks has the shapes of other params
+	auto body_instance = mesh->GetBodyInstance();
+	if (!usesMeshingWindow() || collision_pending || !body_instance || !body_instance->IsValidBodyInstance()) {
+		return;
+	}
+
+	//A new body starts with every shape colliding
+	if (window_physics_serial != mesh->getPhysicsStateSerial() || window_colliding.Num() != int32(_number_of_teeth)) {
+		window_physics_serial = mesh->getPhysicsStateSerial();
+		window_colliding.Init(true, _number_of_teeth);
+	}
+
+	const int32 teeth = _number_of_teeth;
+	const int32 window = _meshing_window_teeth;
+	auto pitch = 2.0 * PI / teeth;
+	const auto& mesh_transform = mesh->GetComponentTransform();
+
+	TBitArray<> colliding(false, teeth);
+	for (const auto& partner : _meshes_with) {
+		if (auto partner_gear = partner.Get()) {
+			auto direction = mesh_transform.InverseTransformPosition(partner_gear->getMeshTransform().GetLocation());
+
+			//Teeth start at their offset and are about half a pitch wide
+			auto center_tooth = FMath::RoundToInt(FMath::Atan2(direction.Z, direction.X) / pitch - 0.25);
+			for (int32 offset = -window; offset <= window; offset++) {
+				colliding[((center_tooth + offset) % teeth + teeth) % teeth] = true;
+			}
+		}
+	}
+
+	//Tooth hulls come first in the body setup, so the shape index is the tooth index
+	auto enabled_type = mesh->GetCollisionEnabled();
+	for (int32 tooth = 0; tooth < teeth; tooth++) {
+		if (colliding[tooth] != window_colliding[tooth]) {
+			body_instance->SetShapeCollisionEnabled(tooth, colliding[tooth] ? enabled_type : ECollisionEnabled::NoCollision);
+		}
+	}
+	window_colliding = MoveTemp(colliding);
+}
+
+void AProceduralGear::applyMassProperties()
+{
+	if (!geometry || applied_params.collision_mode == EGearCollisionMode::None) {
+		return;
+	}
+
+	//Density is in g/cm^3, positions in cm and inertia in kg cm^2
+	auto density = _density / 1000.0;
+	auto width = getWidth();
+	auto mass = density * geometry->profile_area * width;
+	auto axial_inertia = density * width * geometry->profile_polar_moment;
+
+	//The profile is symmetric, so each in-plane axis gets half of the polar moment plus the extrusion term
+	auto radial_inertia = axial_inertia / 2.0 + mass * width * width / 12.0;
+	mesh->setMassProperties(mass, FVector(radial_inertia, axial_inertia, radial_inertia));
+}
+
+void AProceduralGear::showBakedMesh(bool show)
+{
+	if (!show) {
+		if (baked_component) {
+			baked_component->DestroyComponent();
+			baked_component = nullptr;
+		}
+		return;
+	}
+
+	if (!baked_component) {
+		baked_component = NewObject<UStaticMeshComponent>(this, NAME_None, RF_Transient);
+		baked_component->SetupAttachment(mesh);
+		baked_component->SetMobility(EComponentMobility::Movable);
+		baked_component->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+		baked_component->SetVisibility(mesh->IsVisible());
+		baked_component->RegisterComponent();
+	}
+	baked_component->SetStaticMesh(_baked_mesh);
+	baked_component->SetMaterial(0, _material);
+}
+
+void AProceduralGear::updateCollisionMode()
+{
+	if (geometry && getResolvedCollisionMode() != applied_params.collision_mode) {
+		markDirty(EGearDirtyFlags::Collision);
+	}
+}
+
+UGearTrainSubsystem* AProceduralGear::getGearTrain() const
+{
+	return HasActorBegunPlay() ? GetWorld()->GetSubsystem<UGearTrainSubsystem>() : nullptr;
+}
+
+void AProceduralGear::waitForGeneration()
+{
+	finishGeneration(generation_serial);
+}
+
+void AProceduralGear::flushUpdate()
+{
+	rebuild_requested = false;
+	if (dirty_flags == EGearDirtyFlags::None) {
+		return;
+	}
+
+	auto flags = dirty_flags;
+	dirty_flags = EGearDirtyFlags::None;
+
+	if (EnumHasAnyFlags(flags, EGearDirtyFlags::Material)) {
+		mesh->SetMaterial(0, _material);
+		if (baked_component) {
+			baked_component->SetMaterial(0, _material);
+		}
+		if (auto instancer = _instancer.Get()) {
+			instancer->updateGear(this);
+		}
+		if (auto assembly = _assembly.Get()) {
+			assembly->updateGear(this);
+		}
+	}
+	if (EnumHasAnyFlags(flags, EGearDirtyFlags::Geometry)) {
+		generateGear();
+	}
+}
+
+bool AProceduralGear::isUpdatePending() const
+{
+	return dirty_flags != EGearDirtyFlags::None;
+}
+
+void AProceduralGear::markDirty(EGearDirtyFlags flags)
+{
+	dirty_flags |= flags;
+	if (EnumHasAnyFlags(flags, EGearDirtyFlags::Dimensions)) {
+		dimensions_dirty = true;
+		tessellation_dirty = true;
+		updateReferenceDiameter();
+	}
+
+	if (update_depth == 0) {
+		requestRebuild();
+	}
+}
+
+void AProceduralGear::requestRebuild()
+{
+	if (rebuild_requested) {
+		return;
+	}
+
+	//Game worlds collect the changes of a frame, editor and preview worlds show them right away
+	auto world = GetWorld();
+	auto gear_train = world && world->IsGameWorld() ? world->GetSubsystem<UGearTrainSubsystem>() : nullptr;
+	if (!gear_train) {
+		flushUpdate();
+		return;
+	}
+
+	rebuild_requested = true;
+	gear_train->requestRebuild(this);
 }
 
 void AProceduralGear::updateReferenceDiameter()
@@ -0,0 +1,87 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "GearAssembly.generated.h"
+
+class AProceduralGear;
+class UMaterialInterface;
+class UStaticMesh;
+class UStaticMeshComponent;
+
+/**
+ * Renders registered gears merged by shaft. Gears joined through their shaft gears turn as one, so the geometry of
+ * every shaft is merged into one transient static mesh with one section per material, drawn by one component that
+ * follows the first gear of the shaft. UGearTrainSubsystem updates the shafts once every gear has turned for the frame.
+ * Gears of any params can share a shaft, unlike with AGearInstancer. Changed shafts are merged again once per frame,
+ * gears joining or leaving only merge the shafts they were or are on again.
+ *
+ * A shaft with one gear still gets its own component and a full mesh rebuild whenever the gear changes, so trains
+ * without shaft gears draw no fewer components than without the assembly.
+ */
+UCLASS()
+class GEARS_API AGearAssembly : public AActor
+{
+	GENERATED_BODY()
+
+public:
+	AGearAssembly();
+
+	void addGear(AProceduralGear* gear);
+	void removeGear(AProceduralGear* gear);
+
+	//Merges the shaft of the gear again after its geometry or material changed
+	void updateGear(AProceduralGear* gear);
+	//Groups the gears into shafts again after shaft gears changed
+	void markDirty();
+
+	//Merges the shafts that changed, right away instead of in the next tick
+	void flushShafts();
+	void updateShaftTransforms();
+
+	//Accessors
+	int32 getGearCount() const;
+	//One component per shaft
+	int32 getShaftCount() const;
+	//Mesh sections of LOD 0 over every shaft, an estimate of the draw calls
+	int32 getSectionCount() const;
+	//Where the merged mesh draws the gear
+	bool getGearTransform(const AProceduralGear* gear, FTransform& transform) const;
+
+protected:
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+private:
+	struct FShaft
+	{
+		UStaticMeshComponent* component = nullptr;
+		TArray<AProceduralGear*> gears;
+		//Mesh transforms of the gears relative to the first one, as they were merged
+		TArray<FTransform> relative_transforms;
+		TArray<UMaterialInterface*> materials;
+		bool dirty = false;
+	};
+
+	USceneComponent* scene;
+
+	TArray<AProceduralGear*> gears;
+	TArray<FShaft> shafts;
+	TMap<const AProceduralGear*, int32> gear_shafts;
+	bool regroup = false;
+
+	//Keeps the merged meshes and shaft components alive
+	UPROPERTY(Transient)
+	TArray<UStaticMesh*> merged_meshes;
+
+	UPROPERTY(Transient)
+	TArray<UStaticMeshComponent*> shaft_components;
+
+	void clearShafts();
+	void groupShafts();
+	UStaticMeshComponent* createShaftComponent();
+	void destroyShaftComponent(UStaticMeshComponent* component);
+	void mergeShaft(FShaft& shaft);
+};
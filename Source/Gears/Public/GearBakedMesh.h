@@ -0,0 +1,56 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/AssetUserData.h"
+#include "GearGeometry.h"
+#include "MeshTypes.h"
+#include "GearBakedMesh.generated.h"
+
+struct FMeshDescription;
+class UStaticMesh;
+
+//Attached to the static meshes written by the GearBake commandlet, records what the mesh was built from
+UCLASS()
+class GEARS_API UGearBakeData : public UAssetUserData
+{
+	GENERATED_BODY()
+
+public:
+	//GearGeometry::makeKey of the params and the kernel version
+	UPROPERTY();
+	FString key;
+
+	UPROPERTY();
+	uint32 version = 0;
+
+	//GearBakedMesh::BAKE_VERSION the mesh was baked with
+	UPROPERTY();
+	uint32 bake_version = 0;
+
+	//Mass properties of the profile, see FGearMeshData
+	UPROPERTY();
+	double profile_area = 0.0;
+
+	UPROPERTY();
+	double profile_polar_moment = 0.0;
+};
+
+namespace GearBakedMesh
+{
+	//Bump whenever the commandlet bakes meshes differently. Meshes baked before are built at load until baked again
+	constexpr uint32 BAKE_VERSION = 2;
+
+	//Baked assets live in /Game/_GENERATED/Gears
+	GEARS_API FString getPackageName(const FGearParams& params);
+
+	//Triangles and normals of the gear in one polygon group
+	GEARS_API void buildMeshDescription(const FGearMeshData& geometry, FMeshDescription& mesh_description);
+	//Adds the triangles of the gear moved by transform to a polygon group of a mesh description with registered static
+	//mesh attributes
+	GEARS_API void appendMeshDescription(const FGearMeshData& geometry, const FTransform& transform, FPolygonGroupID polygon_group, FMeshDescription& mesh_description);
+
+	//The bake data of the mesh if it was baked from these params by the current kernel and bake, nullptr otherwise
+	GEARS_API const UGearBakeData* findBakeData(const UStaticMesh* static_mesh, const FGearParams& params);
+}
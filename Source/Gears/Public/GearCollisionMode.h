@@ -0,0 +1,35 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GearCollisionMode.generated.h"
+
+//Collision representation of a gear, from cheapest to most detailed
+UENUM()
+enum class EGearCollisionMode : uint8
+{
+	//Per tooth hulls for gears driven by tooth contacts, the hub for coupled gears and the tip circle otherwise
+	Auto,
+	None,
+	//Cylinder at the root circle, teeth of meshing gears pass through it
+	Hub,
+	//Cylinder at the tip circle
+	TipCircle,
+	//One hull per tooth
+	PerTooth,
+	//Hub plus one hull per tooth, but only the teeth facing a meshing partner collide
+	MeshingWindow
+};
+
+//What a gear collides with while the collision of its new params is cooked
+UENUM()
+enum class EGearCollisionCooking : uint8
+{
+	//Cook on the game thread, the gear never shows without its collision
+	Synchronous,
+	//Cook in the background and keep colliding with the previous collision until it is ready. A new gear has no body until then
+	KeepPrevious,
+	//Cook in the background and have no body until it is ready
+	DisableUntilReady
+};
@@ -0,0 +1,202 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GearCollisionMode.h"
+
+//Input for the gear kernel. Uses the same units as the AProceduralGear properties (millimeters and degrees)
+struct GEARS_API FGearParams
+{
+	float module = 10;
+	unsigned int number_of_teeth = 24;
+	float width = 15;
+	float profile_shift = 0.0;
+	float pressure_angle = 20.0;
+	unsigned int involute_steps = 4;
+	//Spaces the flank samples so every flank edge is equally far from the involute instead of evenly along it.
+	//Set by gears whose involute steps come from a chordal error, see GearGeometry::setChordalError
+	bool adaptive_spacing = false;
+	//Samples of the spacing arc between two teeth, 0 uses involute_steps
+	unsigned int spacing_steps = 0;
+	//Never Auto, the owner resolves it before building
+	EGearCollisionMode collision_mode = EGearCollisionMode::PerTooth;
+	//Render level of detail, set by GearGeometry::getLODParams. Only LOD 0 is authored
+	uint8 lod = 0;
+
+	bool operator==(const FGearParams& other) const
+	{
+		return module == other.module
+			&& number_of_teeth == other.number_of_teeth
+			&& width == other.width
+			&& profile_shift == other.profile_shift
+			&& pressure_angle == other.pressure_angle
+			&& involute_steps == other.involute_steps
+			&& adaptive_spacing == other.adaptive_spacing
+			&& spacing_steps == other.spacing_steps
+			&& collision_mode == other.collision_mode
+			&& lod == other.lod;
+	}
+
+	bool operator!=(const FGearParams& other) const
+	{
+		return !(*this == other);
+	}
+
+	friend uint32 GetTypeHash(const FGearParams& params)
+	{
+		auto hash = GetTypeHash(params.module);
+		hash = HashCombine(hash, GetTypeHash(params.number_of_teeth));
+		hash = HashCombine(hash, GetTypeHash(params.width));
+		hash = HashCombine(hash, GetTypeHash(params.profile_shift));
+		hash = HashCombine(hash, GetTypeHash(params.pressure_angle));
+		hash = HashCombine(hash, GetTypeHash(params.involute_steps));
+		hash = HashCombine(hash, GetTypeHash(params.adaptive_spacing));
+		hash = HashCombine(hash, GetTypeHash(params.spacing_steps));
+		hash = HashCombine(hash, GetTypeHash(uint8(params.collision_mode)));
+		return HashCombine(hash, GetTypeHash(params.lod));
+	}
+};
+
+//Output of the gear kernel. Positions are in centimeters
+struct GEARS_API FGearMeshData
+{
+	TArray<FVector> verts;
+	TArray<int> indices;
+	TArray<FVector> normals;
+
+	//Convex hulls back to back. Hull i is collision_verts[collision_offsets[i]] up to collision_offsets[i + 1]
+	TArray<FVector> collision_verts;
+	TArray<int32> collision_offsets;
+
+	//Mass properties of the extruded profile, in cm^2 and cm^4 about the rotation axis
+	double profile_area = 0.0;
+	double profile_polar_moment = 0.0;
+
+	void Reset();
+	SIZE_T GetAllocatedSize() const;
+	//Loading reuses the allocations already in the arrays where they are large enough
+	void Serialize(FArchive& ar);
+
+	int32 getCollisionShapeCount() const;
+	TArrayView<const FVector> getCollisionShape(int32 shape) const;
+};
+
+//Values derived from FGearParams, in centimeters and radians
+struct GEARS_API FGearDimensions
+{
+	double module = 0.0;
+	double width = 0.0;
+	double profile_shift = 0.0;
+	double ref_diameter = 0.0;
+	double base_diameter = 0.0;
+	double base_radius = 0.0;
+	double tip_diameter = 0.0;
+	double tip_radius = 0.0;
+	double root_radius = 0.0;
+	//Involute parameter at the tip circle
+	double u = 0.0;
+	//Involute function of the pressure angle
+	double inv_alpha = 0.0;
+	//Angle covered by a tooth on the base circle and by the gap to the next one
+	double tooth_thickness_rad = 0.0;
+	double spacing_arc_length = 0.0;
+};
+
+//Exact buffer sizes of a gear, so the output can be allocated once up front
+struct GEARS_API FGearMeshSizes
+{
+	int32 verts = 0;
+	int32 indices = 0;
+	int32 collision_shapes = 0;
+	int32 collision_verts = 0;
+};
+
+//How generateGear evaluates the tooth profile and rotates it into place. The vector paths use 4 wide SIMD registers
+//and match Scalar within VECTOR_FLOAT_TOLERANCE and VECTOR_DOUBLE_TOLERANCE
+enum class EGearKernelPath : uint8
+{
+	Scalar,
+	VectorFloat,
+	VectorDouble
+};
+
+//What has to be redone to turn the geometry of one params into the geometry of another
+enum class EGearChange : uint8
+{
+	None = 0,
+	//Module scales the profile around the axis and width scales it along the axis, the topology stays
+	Scale = 1 << 0,
+	//Only the collision hulls change
+	Collision = 1 << 1,
+	//Teeth, involute steps, pressure angle or profile shift change the shape, the kernel has to run again
+	Rebuild = 1 << 2
+};
+ENUM_CLASS_FLAGS(EGearChange);
+
+//Engine independent gear geometry. Only depends on Core so it can be profiled without the editor
+namespace GearGeometry
+{
+	//Bump whenever generateGear output changes, it invalidates geometry and collision stored on disk
+	constexpr uint32 VERSION = 5;
+
+	constexpr unsigned int CENTER_RINGS = 2;
+	//Lower LODs halve the involute steps down to MIN_INVOLUTE_STEPS and keep one center ring. The last one is a
+	//polygonal outline with a point on each flank tip, tooth base and spacing root
+	constexpr int32 LOD_COUNT = 4;
+	constexpr unsigned int MIN_INVOLUTE_STEPS = 2;
+	constexpr unsigned int SILHOUETTE_POINTS_PER_TOOTH = 5;
+	//Screen size below which each LOD is drawn, in the convention of static mesh LODs
+	constexpr float LOD_SCREEN_SIZES[LOD_COUNT] = { 1.0f, 0.3f, 0.12f, 0.04f };
+	//Most flank and spacing arc samples setChordalError picks
+	constexpr unsigned int MAX_INVOLUTE_STEPS = 100;
+	//Both flanks and the spacing arc, when the arc has as many samples as a flank
+	constexpr unsigned int SECTIONS_PER_TOOTH = 3;
+	constexpr unsigned int COLLISION_CIRCLE_SEGMENTS = 32;
+
+	//Largest distance in cm of a vertex from its Scalar position
+	constexpr double VECTOR_FLOAT_TOLERANCE = 1e-3;
+	constexpr double VECTOR_DOUBLE_TOLERANCE = 1e-5;
+	//Largest distance in cm of a vertex derived with deriveGear from the one generateGear builds
+	constexpr double DERIVED_TOLERANCE = 1e-4;
+
+	GEARS_API FGearDimensions computeDimensions(const FGearParams& params);
+	GEARS_API FGearMeshSizes computeSizes(const FGearParams& params);
+
+	//Largest distance in mm between the flanks and spacing arcs of the gear and the edges drawing them. The tip land
+	//is always a single edge and is not counted
+	GEARS_API double computeChordalError(const FGearParams& params);
+	//Sets the fewest flank and spacing arc samples, with adaptive spacing, that keep the chordal error of params below
+	//max_chordal_error in mm. Both counts are clamped to MAX_INVOLUTE_STEPS
+	GEARS_API void setChordalError(FGearParams& params, double max_chordal_error);
+
+	//Collision hulls of teeth, which come first among the collision shapes, 0 when the collision mode has none
+	GEARS_API int32 getToothHullCount(const FGearParams& params);
+	//Angle in radians of the tooth about the rotation axis. Tooth hull i is the first one rotated by it, from the X axis
+	//towards the Z axis
+	GEARS_API double getToothAngle(const FGearParams& params, int32 tooth);
+	//Angle in radians of the middle of the first tooth, from the X axis towards the Z axis. Teeth are symmetric about it
+	GEARS_API double getToothCenterAngle(const FGearDimensions& dimensions);
+
+	//Params of a render LOD of the gear. LODs after the first have no collision, it always comes from LOD 0
+	GEARS_API FGearParams getLODParams(const FGearParams& params, int32 lod);
+
+	//Identifies params on disk. Floats are written as their bits so equal keys mean equal params
+	GEARS_API FString makeKey(const FGearParams& params);
+
+	//Set with gears.Kernel.Path
+	GEARS_API EGearKernelPath getKernelPath();
+
+	//Reuses the allocations already in out, so regenerating into the same buffers does not allocate
+	GEARS_API void generateGear(const FGearParams& params, FGearMeshData& out);
+	GEARS_API void generateGear(const FGearParams& params, FGearMeshData& out, EGearKernelPath path);
+
+	GEARS_API EGearChange classifyChange(const FGearParams& from, const FGearParams& to);
+
+	//Builds the geometry of params by transforming source, the geometry of source_params, without running the kernel.
+	//Only valid when the change between them has no Rebuild. Reuses the allocations already in out
+	GEARS_API void deriveGear(const FGearParams& source_params, const FGearMeshData& source, const FGearParams& params, FGearMeshData& out);
+}
+
+//Geometry of the render LODs of a gear, LOD 0 first
+using FGearLODGeometry = TArray<TSharedPtr<const FGearMeshData>, TInlineAllocator<GearGeometry::LOD_COUNT>>;
@@ -0,0 +1,96 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "GearGeometry.h"
+#include "GearInstancer.generated.h"
+
+class AProceduralGear;
+class UInstancedStaticMeshComponent;
+class UMaterialInterface;
+class UStaticMesh;
+
+//Gears with the same geometry and material are drawn by one instanced component
+struct FGearInstanceKey
+{
+	FGearParams params;
+	UMaterialInterface* material = nullptr;
+
+	bool operator==(const FGearInstanceKey& other) const
+	{
+		return params == other.params && material == other.material;
+	}
+
+	friend uint32 GetTypeHash(const FGearInstanceKey& key)
+	{
+		return HashCombine(GetTypeHash(key.params), GetTypeHash(key.material));
+	}
+};
+
+/**
+ * Renders registered gears through instanced static mesh components.
+ * Every distinct gear geometry is baked into a transient static mesh once, and the instance
+ * transforms of all gears in a batch are updated together by UGearTrainSubsystem, once every gear
+ * has turned for the frame. Batches are destroyed once their last gear leaves.
+ */
+UCLASS()
+class GEARS_API AGearInstancer : public AActor
+{
+	GENERATED_BODY()
+
+	//Use hierarchical instancing. Better culling for large static layouts, slower when gears move
+	UPROPERTY(EditAnywhere);
+	bool _hierarchical = false;
+
+public:
+	AGearInstancer();
+
+	void addGear(AProceduralGear* gear);
+	void removeGear(AProceduralGear* gear);
+
+	//Moves the gear to a new batch after its params or material changed
+	void updateGear(AProceduralGear* gear);
+
+	void updateInstanceTransforms();
+
+	//Accessors
+	int32 getBatchCount() const;
+	int32 getInstanceCount() const;
+	//Instances in the batch of the gear, 0 when it is not instanced
+	int32 getBatchInstanceCount(const AProceduralGear* gear) const;
+	bool getInstanceTransform(const AProceduralGear* gear, FTransform& transform) const;
+	const UStaticMesh* getBakedMesh(const FGearParams& params) const;
+
+protected:
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+private:
+	struct FBatch
+	{
+		UInstancedStaticMeshComponent* component = nullptr;
+		TArray<AProceduralGear*> gears;
+		TArray<FTransform> transforms;
+	};
+
+	USceneComponent* scene;
+
+	TMap<FGearInstanceKey, FBatch> batches;
+	TMap<const AProceduralGear*, FGearInstanceKey> gear_keys;
+	//Index of the instance of every gear in its batch
+	TMap<const AProceduralGear*, int32> gear_instances;
+	TMap<FGearParams, UStaticMesh*> baked_mesh_lookup;
+
+	//Keeps the baked meshes and batch components alive
+	UPROPERTY(Transient)
+	TArray<UStaticMesh*> baked_meshes;
+
+	UPROPERTY(Transient)
+	TArray<UInstancedStaticMeshComponent*> batch_components;
+
+	UStaticMesh* bakeMesh(const FGearParams& params);
+	FBatch& findOrAddBatch(const FGearInstanceKey& key);
+	static FGearInstanceKey makeKey(const AProceduralGear* gear);
+};
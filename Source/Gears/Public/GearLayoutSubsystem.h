@@ -0,0 +1,103 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "GearLayoutSubsystem.generated.h"
+
+class AProceduralGear;
+
+//What keeps two gears whose tip circles overlap from meshing
+enum class EGearMeshingProblem : uint8
+{
+	None = 0,
+	//Different modules or pressure angles, the teeth do not fit at any distance
+	Incompatible = 1 << 0,
+	//Closer than their reference circles touching, the teeth jam
+	Interference = 1 << 1,
+	//Further apart than their reference circles touching, the teeth rattle
+	Backlash = 1 << 2,
+	//Teeth face teeth instead of gaps
+	Phase = 1 << 3
+};
+ENUM_CLASS_FLAGS(EGearMeshingProblem);
+
+//Two gears with parallel axes whose tip circles overlap. Distances are in cm
+struct GEARS_API FGearMeshing
+{
+	AProceduralGear* gear_a = nullptr;
+	AProceduralGear* gear_b = nullptr;
+	double center_distance = 0.0;
+	//Where the reference circles touch
+	double ideal_center_distance = 0.0;
+	//Play along the reference circles, negative when the teeth are pressed into each other
+	double backlash = 0.0;
+	//How far the teeth are from interlocking, in tooth pitches from -0.5 to 0.5
+	double phase_error = 0.0;
+	EGearMeshingProblem problems = EGearMeshingProblem::None;
+};
+
+/**
+ * Finds meshing partners from where gears are placed. Every gear of the world is kept in a spatial hash with cells as
+ * large as the largest gear, so partners are found by looking at the neighbouring cells only, in O(n) for gears of
+ * similar size. Gears moved since the last updateLayout() are found where they were.
+ */
+UCLASS()
+class GEARS_API UGearLayoutSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	//Rereads the position, axis and size of every gear and hashes them again
+	void updateLayout();
+	int32 getGearCount() const;
+
+	//Every pair of gears whose tip circles overlap, with its problems
+	void findMeshings(TArray<FGearMeshing>& out) const;
+	//Same as findMeshings for one pair, without the hash. False when their tip circles do not overlap
+	static bool measureMeshing(AProceduralGear* gear_a, AProceduralGear* gear_b, FGearMeshing& out);
+
+	//Adds every compatible pair to the meshing gears of both gears. Returns the number of pairs added
+	int32 connectMeshingGears();
+
+	//Moves gear along the line of centres until its reference circle touches the one of partner, and turns it about
+	//its axis until its teeth interlock with those of partner
+	static void snapGear(AProceduralGear* gear, AProceduralGear* partner);
+	//Snaps every group of compatible gears, starting from the first gear found of the group, which stays in place.
+	//A gear meshing with more than one gear of the group is only snapped to the first one. Returns the snapped gears
+	int32 snapLayout();
+
+private:
+	//Gear geometry in world space, the axis is the Y axis of the mesh and the teeth turn from x_axis to z_axis
+	struct FLayoutEntry
+	{
+		AProceduralGear* gear = nullptr;
+		FVector center = FVector::ZeroVector;
+		FVector axis = FVector::YAxisVector;
+		FVector x_axis = FVector::XAxisVector;
+		FVector z_axis = FVector::ZAxisVector;
+		double ref_radius = 0.0;
+		double tip_radius = 0.0;
+		double width = 0.0;
+		double module = 0.0;
+		double pressure_angle = 0.0;
+		double tooth_center_angle = 0.0;
+		int32 teeth = 0;
+	};
+
+	TArray<FLayoutEntry> entries;
+	TMap<const AProceduralGear*, int32> entry_indices;
+	//Entries of every cell are back to back in cell_entries, from the start to the count of the cell
+	TMap<FIntVector, FIntPoint> cells;
+	TArray<int32> cell_entries;
+	double cell_size = 1.0;
+
+	FIntVector getCell(const FVector& location) const;
+
+	static FLayoutEntry makeEntry(AProceduralGear* gear);
+	static bool measureMeshing(const FLayoutEntry& a, const FLayoutEntry& b, FGearMeshing& out);
+	//Where direction points in the tooth pitch of the gear, 0 at the middle of a tooth and 0.5 at the middle of a gap
+	static double getPitchFraction(const FLayoutEntry& entry, const FVector& direction);
+	static void snapEntry(FLayoutEntry& entry, const FLayoutEntry& partner);
+};
@@ -0,0 +1,149 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/GCObject.h"
+#include "GearGeometry.h"
+
+class UBodySetup;
+
+//Runs on the game thread once collision cooked in the background is ready
+DECLARE_DELEGATE_OneParam(FOnGearCollisionCooked, UBodySetup*);
+
+/**
+ * Process wide cache of gear geometry and cooked collision keyed by FGearParams.
+ * Geometry is handed out as shared references so identical gears do not keep their own copy.
+ * Least recently used entries are evicted once the resident size exceeds gears.MeshCache.BudgetMB, as long as no gear
+ * uses them anymore. Entries in use stay resident above the budget, evicting them would not free anything.
+ * Buffers of geometry nobody uses anymore are kept aside and reused for the next miss.
+ * In the editor, misses are loaded from the derived data cache before building, and cooked collision is cached
+ * on disk by the engine under a guid derived from the params.
+ * Misses of a gear being rescaled are transformed from its previous geometry and collision instead.
+ * Tooth hulls are the same convex rotated, so collision cooks a single tooth convex that every tooth elem shares.
+ * Collision can also be cooked in the background, gears asking for params that are already cooking wait for that cook.
+ */
+class GEARS_API FGearMeshCache : public FGCObject
+{
+public:
+	struct FStats
+	{
+		uint64 hits = 0;
+		uint64 misses = 0;
+		uint64 evictions = 0;
+		//Misses transformed from the previous geometry of a gear instead of built
+		uint64 derived = 0;
+		uint64 collision_hits = 0;
+		uint64 collision_misses = 0;
+		//Collision misses that share the cooked hulls of the previous params at another scale
+		uint64 collision_scaled = 0;
+		//Cooks started in the background, and requests that waited for one already running
+		uint64 collision_async_cooks = 0;
+		uint64 collision_joined = 0;
+		//Background cooks in flight, now and at most
+		int32 collision_pending = 0;
+		int32 collision_peak_pending = 0;
+		//Memory misses loaded from disk, and those built because the disk cache did not have them either
+		uint64 ddc_hits = 0;
+		uint64 ddc_misses = 0;
+		int32 entries = 0;
+		SIZE_T resident_bytes = 0;
+		SIZE_T budget_bytes = 0;
+	};
+
+	static FGearMeshCache& Get();
+
+	//Safe to call from any thread
+	TSharedRef<const FGearMeshData> getGeometry(const FGearParams& params);
+
+	//On a miss, derives the geometry from source, the geometry of source_params, when only their scale or collision
+	//mode differ. Gears being edited pass their previous geometry, which is the closest match there is. Source may be null
+	TSharedRef<const FGearMeshData> getGeometry(const FGearParams& params, const FGearParams& source_params, const TSharedPtr<const FGearMeshData>& source);
+
+	//Builds the misses in parallel on at most max_workers threads, 0 uses every worker. Results are in params order
+	void getGeometry(TArrayView<const FGearParams> params, TArray<TSharedPtr<const FGearMeshData>>& geometry, int32 max_workers = 0);
+
+	//Geometry of every render LOD of params, derived from the matching LOD of source when only the scale changes.
+	//Source may hold fewer LODs or none
+	void getLODs(const FGearParams& params, const FGearParams& source_params, TArrayView<const TSharedPtr<const FGearMeshData>> source, FGearLODGeometry& lods);
+
+	//Drops the caller's reference. If nothing else uses the geometry, its entry is removed and the buffers are
+	//reused for the next miss, so a gear edited over and over keeps building into the same memory
+	void releaseGeometry(const FGearParams& params, TSharedPtr<const FGearMeshData>& geometry);
+	void releaseLODs(const FGearParams& params, FGearLODGeometry& lods);
+
+	//Game thread only, also from inside game thread tasks. Returns nullptr when the params have collision disabled.
+	//Cooks right away even when the params are cooking in the background, that cook then finishes with this body setup
+	UBodySetup* getCollision(const FGearParams& params);
+
+	//On a miss, shares the cooked hulls of source_params at another scale when only module or width differ. Geometry
+	//is the geometry of params the caller already holds, so a miss does not look it up or build it again. May be null
+	UBodySetup* getCollision(const FGearParams& params, const FGearParams& source_params, const TSharedPtr<const FGearMeshData>& geometry);
+
+	//Returns the collision right away when it is cached or shares cooked hulls at another scale, and nullptr when the
+	//params have collision disabled. Otherwise returns nullptr and cooks in the background, calling on_cooked on the
+	//game thread once it is ready. Game thread only
+	UBodySetup* getCollisionAsync(const FGearParams& params, const FGearParams& source_params, const TSharedPtr<const FGearMeshData>& geometry, FOnGearCollisionCooked&& on_cooked);
+	bool isCollisionPending(const FGearParams& params) const;
+	//Finishes every background cook on the game thread. Not from inside a game thread task
+	void flushCollision();
+
+	FStats getStats() const;
+	void resetStats();
+	void Empty();
+
+	//Body setup holding the first tooth hull and the shapes after the teeth, the only convexes that need cooking
+	static UBodySetup* prepareCollision(const FGearParams& params, const FGearMeshData& geometry);
+	//Fills body_setup, or a new transient one when null, with the cooked convexes of prepareCollision. Every tooth
+	//shares the convex of the first one with its rotation as the elem transform
+	static UBodySetup* finishCollision(const FGearParams& params, UBodySetup* cooked, UBodySetup* body_setup = nullptr);
+	//Body setups loaded from disk create a convex for every elem. Points the tooth elems of a body setup filled by
+	//finishCollision back at the convex of the first tooth
+	static void shareToothConvex(const FGearParams& params, UBodySetup* body_setup);
+
+	virtual void AddReferencedObjects(FReferenceCollector& Collector) override;
+	virtual FString GetReferencerName() const override;
+
+private:
+	struct FEntry
+	{
+		FGearParams params;
+		TSharedPtr<FGearMeshData> geometry;
+		UBodySetup* body_setup = nullptr;
+		SIZE_T size = 0;
+		//Neighbours in the use order
+		FEntry* older = nullptr;
+		FEntry* newer = nullptr;
+	};
+
+	//Body setup being cooked in the background and the requests waiting for it
+	struct FPendingCook
+	{
+		TSharedPtr<const FGearMeshData> geometry;
+		UBodySetup* cooked = nullptr;
+		TArray<FOnGearCollisionCooked> waiting;
+	};
+
+	TSharedRef<const FGearMeshData> findOrBuildGeometry(const FGearParams& params, const FGearParams* source_params, const FGearMeshData* source);
+	UBodySetup* findOrCookCollision(const FGearParams& params, const FGearParams* source_params, const TSharedPtr<const FGearMeshData>& geometry, FOnGearCollisionCooked* on_cooked);
+	void startCook(const FGearParams& params, const TSharedRef<const FGearMeshData>& geometry, FOnGearCollisionCooked&& on_cooked);
+	void finishCook(bool success, FGearParams params);
+	void storeCollision(const FGearParams& params, const TSharedRef<const FGearMeshData>& geometry, UBodySetup* body_setup, bool scaled);
+	FEntry* findEntry(const FGearParams& params) const;
+	FEntry& findOrAddEntry(const FGearParams& params);
+	void touchEntry(FEntry& entry);
+	void unlinkEntry(FEntry& entry);
+	void evictToBudget(const FGearParams& keep);
+	void removeEntry(const FGearParams& params);
+	void recycleGeometry(TSharedPtr<FGearMeshData>&& geometry);
+
+	//Entries are allocated on their own so the use order can link them
+	TMap<FGearParams, TUniquePtr<FEntry>> entries;
+	FEntry* least_recent = nullptr;
+	FEntry* most_recent = nullptr;
+	TMap<FGearParams, FPendingCook> pending_cooks;
+	TArray<TSharedPtr<FGearMeshData>> spare_geometry;
+	SIZE_T resident_bytes = 0;
+	FStats stats;
+	mutable FCriticalSection lock;
+};
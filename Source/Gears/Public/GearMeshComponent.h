@@ -0,0 +1,72 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/MeshComponent.h"
+#include "GearGeometry.h"
+#include "GearMeshComponent.generated.h"
+
+class UBodySetup;
+
+/**
+ * Draws gear geometry shared through FGearMeshCache without keeping a copy of it. The render buffers use float
+ * positions, packed normals, one UV channel and 16 bit indices when they fit. Geometry with the same topology
+ * is written into the existing buffers, which are dynamic for that reason, instead of recreating them. Every
+ * view draws the LOD picked by the screen size of the gear. Collision comes from a body setup shared between
+ * gears instead of cooking its own convex meshes, and never depends on the LOD.
+ */
+UCLASS()
+class GEARS_API UGearMeshComponent : public UMeshComponent
+{
+	GENERATED_BODY()
+
+public:
+	//An empty array clears the mesh
+	void setGeometry(const FGearLODGeometry& lods);
+	//LOD 0, null when the mesh is empty
+	TSharedPtr<const FGearMeshData> getGeometry() const;
+	const FGearLODGeometry& getLODs() const;
+
+	//Index of the LOD drawn at a screen size, set with gears.LOD.Force for every gear
+	static int32 selectLOD(float screen_size);
+
+	void setSharedBodySetup(UBodySetup* body_setup);
+	UBodySetup* getSharedBodySetup() const;
+
+	//Replaces the mass and inertia Chaos derives from the collision shapes. Inertia is in kg cm^2 along the component axes
+	void setMassProperties(float mass_kg, const FVector& inertia);
+
+	//Incremented every time the body is created, shape state does not survive that
+	uint32 getPhysicsStateSerial() const;
+
+	//Size of the vertex and index buffers of every LOD of the current mesh
+	SIZE_T getGPUMemory() const;
+	//Incremented when the buffers are recreated, not when they are updated in place
+	uint32 getRenderBufferSerial() const;
+
+	virtual FPrimitiveSceneProxy* CreateSceneProxy() override;
+	virtual FBoxSphereBounds CalcBounds(const FTransform& LocalToWorld) const override;
+	virtual int32 GetNumMaterials() const override;
+	virtual UBodySetup* GetBodySetup() override;
+	virtual void GetResourceSizeEx(FResourceSizeEx& CumulativeResourceSize) override;
+
+protected:
+	virtual void OnCreatePhysicsState() override;
+
+private:
+	UPROPERTY(Transient)
+	UBodySetup* shared_body_setup = nullptr;
+
+	FGearLODGeometry lods;
+	FBox local_box = FBox(ForceInit);
+	SIZE_T gpu_memory = 0;
+	uint32 render_buffer_serial = 0;
+
+	bool has_mass_properties = false;
+	float mass = 0.0f;
+	FVector inertia = FVector::OneVector;
+	uint32 physics_state_serial = 0;
+
+	void applyMassProperties();
+};
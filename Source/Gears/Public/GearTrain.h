@@ -0,0 +1,50 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Kinematic gear train. Angular velocities are propagated from the driver gears through
+ * meshing pairs (w2 = -w1 * z1 / z2) and shared shafts (w2 = w1), and phases are integrated from them.
+ * Only depends on Core so it can be benchmarked headlessly.
+ */
+class GEARS_API FGearTrain
+{
+public:
+	int32 addGear(unsigned int teeth_count, double start_phase = 0.0);
+	void addMesh(int32 gear_a, int32 gear_b);
+	void addShaft(int32 gear_a, int32 gear_b);
+	void setDriver(int32 gear, double rpm);
+	void clearDrivers();
+	void Reset();
+
+	//Propagates the driver speeds through the train. Returns false if the train contradicts itself,
+	//for example an odd loop of meshing gears or two drivers with incompatible speeds
+	bool solve();
+
+	//Phases are independent of each other, so large trains can be advanced with ParallelFor
+	void advance(double delta_seconds, bool parallel = false);
+
+	int32 Num() const;
+	double getAngularVelocity(int32 gear) const;
+	double getRPM(int32 gear) const;
+	double getPhase(int32 gear) const;
+	bool isDriven(int32 gear) const;
+
+private:
+	struct FConnection
+	{
+		int32 gear;
+		double ratio;
+	};
+
+	TArray<unsigned int> teeth;
+	TArray<double> angular_velocity;
+	TArray<double> phase;
+	TArray<bool> driven;
+	TArray<TArray<FConnection>> connections;
+	TArray<TPair<int32, double>> drivers;
+
+	void connect(int32 gear_a, int32 gear_b, double ratio);
+};
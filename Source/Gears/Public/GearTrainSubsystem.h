@@ -0,0 +1,131 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "GearTrain.h"
+#include "GearTrainSubsystem.generated.h"
+
+class AProceduralGear;
+class AGearAssembly;
+class AGearInstancer;
+class FGearCouplingCallback;
+class FPhysScene_Chaos;
+class FSingleParticlePhysicsProxy;
+class UPrimitiveComponent;
+
+/**
+ * Central rotation manager for every gear in the world, so gears do not tick on their own.
+ * Rotation state is kept as parallel arrays indexed like the gear train. Kinematic gears are rotated
+ * from the gear train in one pass per frame, physics gears get their constraint drive refreshed
+ * whenever their RPM or drive strength changes. Gears with MeshingWindow collision get their tooth shapes
+ * toggled in the same pass. Gears changed through their mutators are rebuilt once per frame, before the update,
+ * with their geometry built in parallel. Coupled gears and their racks are kept at their gear ratio by
+ * FGearCouplingCallback on the physics thread, their couplings are sent right before every physics step.
+ * Assemblies and instancers registered here are updated at the end of every update, once every gear has turned for the frame.
+ */
+UCLASS()
+class GEARS_API UGearTrainSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	void addGear(AProceduralGear* gear);
+	void removeGear(AProceduralGear* gear);
+
+	//Rebuilds the train before the next update. Call after meshing partners, shafts or drive modes change
+	void markDirty();
+
+	void setRPM(const AProceduralGear* gear, float rpm);
+	void setDriveStrength(const AProceduralGear* gear, float strength);
+	void setDriving(const AProceduralGear* gear, bool driving);
+	void setMeshingWindow(const AProceduralGear* gear, bool enabled);
+
+	//Couples the body of a Coupled gear to a simulated rack moving along direction, which also picks the side the gear
+	//turns the rack to. The gear moves it by its reference circle
+	void addRack(const AProceduralGear* gear, UPrimitiveComponent* rack, const FVector& direction);
+	void removeRack(const AProceduralGear* gear, UPrimitiveComponent* rack);
+	//Gear ratio couplings between the bodies of Coupled gears and racks
+	int32 getCouplingCount() const;
+
+	//Queues a gear for rebuilding. Every gear is rebuilt at most once per frame no matter how many properties changed
+	void requestRebuild(AProceduralGear* gear);
+	void flushRebuilds();
+
+	void addAssembly(AGearAssembly* assembly);
+	void removeAssembly(AGearAssembly* assembly);
+	void addInstancer(AGearInstancer* instancer);
+	void removeInstancer(AGearInstancer* instancer);
+
+	void updateGears(float delta_seconds);
+
+	const FGearTrain& getTrain() const;
+	int32 getGearIndex(const AProceduralGear* gear) const;
+
+	//Builds the gears of a loaded level together before they begin play
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+private:
+	TArray<AProceduralGear*> gears;
+	TArray<float> rpms;
+	TArray<float> drive_strengths;
+	TArray<bool> driving_flags;
+	TArray<bool> kinematic_flags;
+	TArray<bool> coupled_flags;
+	TArray<bool> drive_dirty_flags;
+	TArray<bool> windowed_flags;
+	TArray<FQuat> rotations;
+
+	TArray<TWeakObjectPtr<AProceduralGear>> pending_rebuilds;
+	TArray<TWeakObjectPtr<AGearAssembly>> assemblies;
+	TArray<TWeakObjectPtr<AGearInstancer>> instancers;
+
+	struct FRack
+	{
+		const AProceduralGear* gear = nullptr;
+		TWeakObjectPtr<UPrimitiveComponent> rack;
+		FVector direction = FVector::XAxisVector;
+	};
+
+	//Gear ratio coupling between two gears, or a gear and a rack when gear_b is INDEX_NONE. Angles are unwrapped
+	//from the twist of each gear about its axis, so the drift of ratio_a * angle_a + ratio_b * angle_b can be corrected
+	struct FCoupling
+	{
+		int32 gear_a = INDEX_NONE;
+		int32 gear_b = INDEX_NONE;
+		int32 rack = INDEX_NONE;
+		double ratio_a = 1.0;
+		double ratio_b = -1.0;
+		double twist_a = 0.0;
+		double twist_b = 0.0;
+		double angle_a = 0.0;
+		double angle_b = 0.0;
+		double start_position = 0.0;
+		bool started = false;
+	};
+
+	TArray<FRack> racks;
+	TArray<FCoupling> couplings;
+	FGearCouplingCallback* coupling_callback = nullptr;
+	FDelegateHandle physics_pre_tick_handle;
+	TMap<FSingleParticlePhysicsProxy*, int32> coupling_body_indices;
+	uint64 coupling_frame = 0;
+
+	TMap<const AProceduralGear*, int32> gear_indices;
+	FGearTrain train;
+	TArray<const AProceduralGear*> train_gears;
+	bool dirty = false;
+	bool drivers_dirty = false;
+	bool any_drive_dirty = false;
+
+	void rebuildTrain();
+	void rebuildCouplings();
+	void updateDrivers();
+	void applyPhysicsDrives();
+	void pushCouplings(FPhysScene_Chaos* physics_scene, float delta_seconds);
+	void updateRenderers();
+};
@@ -4,10 +4,46 @@
 
 #include "CoreMinimal.h"
 #include "GameFramework/Actor.h"
+#include "GearGeometry.h"
+#include "Tasks/Task.h"
 #include "ProceduralGear.generated.h"
 
-class UProceduralMeshComponent;
+class UGearMeshComponent;
+class AGearInstancer;
+class AGearAssembly;
 class UPhysicsConstraintComponent;
+class UGearTrainSubsystem;
+class UStaticMesh;
+class UStaticMeshComponent;
+class UPrimitiveComponent;
+class UBodySetup;
+
+//Properties changed since the gear was last built
+enum class EGearDirtyFlags : uint8
+{
+	None = 0,
+	//Module, teeth, width, pressure angle or profile shift
+	Dimensions = 1 << 0,
+	//Involute steps or chordal error
+	InvoluteSteps = 1 << 1,
+	Collision = 1 << 2,
+	Material = 1 << 3,
+
+	Geometry = Dimensions | InvoluteSteps | Collision
+};
+ENUM_CLASS_FLAGS(EGearDirtyFlags);
+
+UENUM()
+enum class EGearDriveMode : uint8
+{
+	//Rotation comes from the constraint motor and tooth contacts
+	Physics,
+	//Rotation comes from the gear train solver, physics is disabled
+	Kinematic,
+	//Rotation comes from the constraint motor. Coupled partners and racks follow through gear ratio couplings solved
+	//by the physics, their teeth do not touch
+	Coupled
+};
 
 UCLASS()
 class GEARS_API AProceduralGear : public AActor
@@ -15,14 +51,11 @@ class GEARS_API AProceduralGear : public AActor
 	GENERATED_BODY()
 
 		virtual void PostLoad() override;
+	virtual void OnConstruction(const FTransform& Transform) override;
 #if WITH_EDITOR
 	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
 #endif // WITH_EDITOR
 
-	const unsigned int CENTER_RINGS = 2;
-	const unsigned int SECTIONS_PER_TOOTH = 3;
-
-
 	//UPROPERTY(EditAnywhere);
 	USceneComponent* scene;
 
@@ -59,6 +92,16 @@ class GEARS_API AProceduralGear : public AActor
 	UPROPERTY(EditAnywhere, Meta = (EditCondition = "_apply_rotation"));
 	float _velocity_strength = 0.0;
 
+	UPROPERTY(EditAnywhere, Category = "Gear Train");
+	EGearDriveMode _drive_mode = EGearDriveMode::Physics;
+
+	//Used by the kinematic gear train and by the MeshingWindow collision mode
+	UPROPERTY(EditAnywhere, Category = "Gear Train");
+	TArray<TSoftObjectPtr<AProceduralGear>> _meshes_with;
+
+	UPROPERTY(EditAnywhere, Category = "Gear Train", Meta = (EditCondition = "_drive_mode != EGearDriveMode::Physics"));
+	TArray<TSoftObjectPtr<AProceduralGear>> _shaft_with;
+
 	//UPROPERTY(EditAnywhere);
 	UPhysicsConstraintComponent* constraint;
 
@@ -77,19 +120,79 @@ class GEARS_API AProceduralGear : public AActor
 	UPROPERTY(EditAnywhere);
 	UMaterialInstance* _material = nullptr;
 
-	UPROPERTY(EditAnywhere, AdvancedDisplay, Meta = (ClampMin = 4, ClampMax = 50));
+	//Draw this gear through a shared instanced mesh instead of its own mesh component
+	UPROPERTY(EditAnywhere);
+	TSoftObjectPtr<AGearInstancer> _instancer;
+
+	//Draw this gear merged with the gears on its shaft through an assembly, instead of its own mesh component.
+	//Takes precedence over _instancer
+	UPROPERTY(EditAnywhere);
+	TSoftObjectPtr<AGearAssembly> _assembly;
+
+	UPROPERTY(EditAnywhere, AdvancedDisplay, Meta = (ClampMin = 4, ClampMax = 50, EditCondition = "_max_chordal_error <= 0"));
 	unsigned int _involute_steps = 4;
 
+	//Largest distance of the drawn flanks and spacing arcs from the true curves. When set, the gear gets the fewest
+	//samples that meet it instead of _involute_steps, so small gears get fewer vertices and large gears more
+	UPROPERTY(EditAnywhere, AdvancedDisplay, Meta = (Units = "Millimeters", ClampMin = 0.0, ClampMax = 10.0));
+	float _max_chordal_error = 0.0;
+
+	//Vertices and chordal error of the applied geometry
+	UPROPERTY(VisibleAnywhere, AdvancedDisplay, Transient);
+	int32 _vertex_count = 0;
+
+	UPROPERTY(VisibleAnywhere, AdvancedDisplay, Transient, Meta = (Units = "Millimeters"));
+	float _chordal_error = 0.0;
+
 	UPROPERTY(EditAnywhere, AdvancedDisplay);
 	bool _enable_collision = true;
 
+	UPROPERTY(EditAnywhere, AdvancedDisplay, Meta = (EditCondition = "_enable_collision"));
+	EGearCollisionMode _collision_mode = EGearCollisionMode::Auto;
+
+	//Collision that is not cached yet is cooked in the background unless this is Synchronous. The mesh shows right away
+	UPROPERTY(EditAnywhere, AdvancedDisplay, Meta = (EditCondition = "_enable_collision"));
+	EGearCollisionCooking _collision_cooking = EGearCollisionCooking::KeepPrevious;
+
+	//Teeth on each side of a meshing partner that keep colliding in MeshingWindow mode
+	UPROPERTY(EditAnywhere, AdvancedDisplay, Meta = (EditCondition = "_enable_collision", ClampMin = 1, ClampMax = 10));
+	unsigned int _meshing_window_teeth = 2;
+
+	//In g/cm^3, the mass is computed from the gear profile instead of the collision shapes. Steel by default
+	UPROPERTY(EditAnywhere, AdvancedDisplay, Meta = (ClampMin = 0.01, ClampMax = 25.0));
+	float _density = 7.85;
+
+	//Build the gear on a worker thread and commit it to the mesh on the game thread
+	UPROPERTY(EditAnywhere, AdvancedDisplay);
+	bool _async_generation = false;
+
+	//Written by the GearBake commandlet. Drawn and collided with instead of building the gear while the params match
+	UPROPERTY(VisibleAnywhere, AdvancedDisplay);
+	UStaticMesh* _baked_mesh = nullptr;
+
 	void generateGear();
+#if WITH_EDITOR
+	void generatePreview(bool reduce_steps);
+#endif // WITH_EDITOR
+	void finishGeneration(uint32 serial);
+	void finishCollision(UBodySetup* body_setup, uint32 serial);
+	//LOD 0 comes first and is the one the gear collides and weighs with
+	void applyGeometry(const FGearLODGeometry& built_lods, const FGearParams& params);
 public:
 	// Sets default values for this actor's properties
 	AProceduralGear();
 
+	//Builds the gear once per instance, later calls only apply pending changes
 	void Initialize();
 
+	//Spawns gears deferred, with their params set before construction so each one is built exactly once.
+	//Geometry for distinct params is built in parallel up front. Pass one params to share it or one per transform
+	static TArray<AProceduralGear*> spawnGears(UWorld* world, TArrayView<const FTransform> transforms, TArrayView<const FGearParams> params, UMaterialInstance* material = nullptr);
+
+	//Builds gears that were never built and applies pending changes of the others. Geometry of distinct params is built
+	//in parallel on at most max_workers threads, then meshes and collision are committed in one game thread pass
+	static void generateGears(TArrayView<AProceduralGear* const> gears, int32 max_workers = 0);
+
 	//Accessors
 	float getModule() const;
 	unsigned int getNumberOfTeeth() const;
@@ -108,9 +211,44 @@ public:
 	bool isJoinedCollisionDisabled() const;
 	const UMaterialInstance* getMaterial() const;
 	unsigned int getInvoluteSteps() const;
+	float getMaxChordalError() const;
+	int32 getVertexCount() const;
+	float getChordalError() const;
 	bool isCollisionEnabled() const;
-
-	//Mutators
+	EGearCollisionMode getCollisionMode() const;
+	//The mode the collision is built with, Auto picks one from the drive mode and meshing partners
+	EGearCollisionMode getResolvedCollisionMode() const;
+	EGearCollisionCooking getCollisionCooking() const;
+	//True while the collision of the applied params is cooked in the background
+	bool isCollisionPending() const;
+	unsigned int getMeshingWindowTeeth() const;
+	float getDensity() const;
+	float getMass() const;
+	bool isAsyncGenerationEnabled() const;
+	bool isGenerationPending() const;
+	//True while the mesh shows the reduced preview of a slider drag in the editor
+	bool isShowingPreview() const;
+	//Incremented by every rebuild of the geometry
+	uint32 getGenerationSerial() const;
+	FGearParams getParams() const;
+	const FGearDimensions& getDimensions() const;
+	const TSoftObjectPtr<AGearInstancer>& getInstancer() const;
+	const TSoftObjectPtr<AGearAssembly>& getAssembly() const;
+	//Null when the gear has no baked mesh or was changed since it was baked
+	UStaticMesh* getBakedMesh() const;
+	FTransform getMeshTransform() const;
+	UPrimitiveComponent* getMesh() const;
+	EGearDriveMode getDriveMode() const;
+	const TArray<TSoftObjectPtr<AProceduralGear>>& getMeshingGears() const;
+	const TArray<TSoftObjectPtr<AProceduralGear>>& getShaftGears() const;
+
+	//Mutators. Changes are collected and the gear is rebuilt once, at the end of the frame in game worlds
+	//and right away elsewhere. Nest them in beginUpdate()/endUpdate() to also defer the immediate rebuild
+	void beginUpdate();
+	void endUpdate();
+	//Collision mode Auto is allowed here. Involute steps of adaptive params are ignored, the gear keeps resolving
+	//them from its own chordal error
+	void setParams(const FGearParams& params);
 	void setModule(float module_value);
 	void setNumberOfTeeth(unsigned int num);
 	void setWidth(float width);
@@ -124,19 +262,85 @@ public:
 	void disableJoinedCollision(bool value);
 	void setMaterial(UMaterialInstance* material);
 	void setInvoluteSteps(unsigned int steps);
+	//0 goes back to the involute steps
+	void setMaxChordalError(float max_chordal_error);
 	void enableCollision(bool value);
+	void setCollisionMode(EGearCollisionMode mode);
+	void setCollisionCooking(EGearCollisionCooking cooking);
+	void setMeshingWindowTeeth(unsigned int teeth);
+	void setDensity(float density);
+	void enableAsyncGeneration(bool value);
+	void setInstancer(AGearInstancer* instancer);
+	void setAssembly(AGearAssembly* assembly);
+	//Only rebuilds gears that were already built, so baking loaded levels stays cheap
+	void setBakedMesh(UStaticMesh* static_mesh);
+	void setDriveMode(EGearDriveMode mode);
+	void addMeshingGear(AProceduralGear* gear);
+	void addShaftGear(AProceduralGear* gear);
+
+	//Used by the gear train subsystem, which drives the rotation of every gear
+	void setKinematicRotation(const FQuat& rotation);
+	void applyPhysicsDrive(bool enabled, float rpm, float strength);
+	bool usesMeshingWindow() const;
+	void updateMeshingWindow();
+
+	//Commits a pending asynchronous build right away
+	void waitForGeneration();
+
+	//Applies changes collected by the mutators right away
+	void flushUpdate();
+	bool isUpdatePending() const;
 
 protected:
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
-
-public:
-	// Called every frame
-	virtual void Tick(float DeltaTime) override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
 private:
 	//UPROPERTY(VisibleAnywhere);
-	UProceduralMeshComponent* mesh;
+	UGearMeshComponent* mesh;
+
+	//Draws the baked mesh, the body stays on mesh
+	UStaticMeshComponent* baked_component = nullptr;
+
+	//LOD 0, shared with every gear built from the same params. The mesh holds the other LODs
+	TSharedPtr<const FGearMeshData> geometry;
+
+	//Incremented on every build request so results of outdated builds are dropped
+	uint32 generation_serial = 0;
+	UE::Tasks::TTask<FGearLODGeometry> pending_generation;
+	FGearParams pending_params;
+	bool showing_preview = false;
+
+	//Incremented on every collision request so outdated background cooks are dropped
+	uint32 collision_serial = 0;
+	bool collision_pending = false;
+
+	//Params of the applied geometry and the tooth shapes currently colliding in MeshingWindow mode
+	FGearParams applied_params;
+	TBitArray<> window_colliding;
+	uint32 window_physics_serial = 0;
+
+	EGearDirtyFlags dirty_flags = EGearDirtyFlags::None;
+	int32 update_depth = 0;
+	bool rebuild_requested = false;
+
+	//Derived values are recomputed on first use after a change
+	mutable FGearDimensions dimensions;
+	mutable bool dimensions_dirty = true;
+	//Sample counts picked for _max_chordal_error
+	mutable FGearParams tessellation;
+	mutable bool tessellation_dirty = true;
+
+	void markDirty(EGearDirtyFlags flags);
+	void requestRebuild();
+
+	//Null until the gear has begun play
+	UGearTrainSubsystem* getGearTrain() const;
+
+	void applyMassProperties();
+	void showBakedMesh(bool show);
+	void updateCollisionMode();
 
 	void updateReferenceDiameter();
 	void updateBaseDiameter();